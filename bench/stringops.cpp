@@ -0,0 +1,121 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/**
+ * Microbenchmark for stringops.h, comparing the SIMD kernels against the
+ * std::transform/lowercase-copy versions they replaced. Build with
+ * -DBUILD_BENCHMARKS=ON and run ./bench_stringops. Set SPORKS_STRINGKERNELS
+ * to "scalar" or "sse2" to force a lower kernel level.
+ */
+
+#include <sporks/stringops.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cctype>
+
+namespace legacy {
+
+	std::string lowercase(const std::string& s)
+	{
+		std::string s2 = s;
+		std::transform(s2.begin(), s2.end(), s2.begin(), tolower);
+		return s2;
+	}
+
+	std::string ReplaceString(std::string subject, const std::string& search, const std::string& replace) {
+		size_t pos = 0;
+		std::string subject_lc = lowercase(subject);
+		std::string search_lc = lowercase(search);
+		std::string replace_lc = lowercase(replace);
+		while((pos = subject_lc.find(search_lc, pos)) != std::string::npos) {
+			subject.replace(pos, search.length(), replace);
+			subject_lc.replace(pos, search_lc.length(), replace_lc);
+			pos += replace.length();
+		}
+		return subject;
+	}
+
+	std::string trim(std::string s)
+	{
+		s.erase(s.find_last_not_of(" \t\n\r\f\v") + 1);
+		s.erase(0, s.find_first_not_of(" \t\n\r\f\v"));
+		return s;
+	}
+};
+
+/* Stops the optimiser throwing away results */
+static size_t sink = 0;
+
+template<typename F> double timeit(const char* name, size_t iterations, F func)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i) {
+		sink += func();
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+	std::cout << "  " << std::left << std::setw(28) << name << std::right << std::setw(10) << std::fixed << std::setprecision(1) << ns << " ns/op\n";
+	return ns;
+}
+
+static std::string random_message(std::mt19937& rng, size_t length)
+{
+	static const std::string words[] = { "sporks", "what", "is", "The", "BOT", "<@1234567890>", "héllo", "wörld", "a", "Discord", "   ", "\t", "!" };
+	std::string out;
+	while (out.length() < length) {
+		out += words[rng() % (sizeof(words) / sizeof(*words))];
+		out += ' ';
+	}
+	return out;
+}
+
+int main()
+{
+	std::mt19937 rng(42);
+	bool ok = true;
+
+	/* Verify both implementations agree before timing anything */
+	for (size_t len = 0; len < 600; ++len) {
+		std::string s = "  \t" + random_message(rng, len) + "\n ";
+		if (lowercase(s) != legacy::lowercase(s) || trim(s) != legacy::trim(s) ||
+		    ReplaceString(s, "SPORKS", "<@1>") != legacy::ReplaceString(s, "SPORKS", "<@1>") ||
+		    ReplaceString(s, "<@1234567890>", "") != legacy::ReplaceString(s, "<@1234567890>", "")) {
+			std::cerr << "Mismatch at length " << len << ": " << s << "\n";
+			ok = false;
+		}
+	}
+
+	std::cout << "stringops benchmark, kernels: " << stringkernels::implementation() << "\n";
+
+	for (size_t len : { 16, 64, 256, 2000 }) {
+		std::string s = "  " + random_message(rng, len) + "  ";
+		std::cout << "message length " << s.length() << "\n";
+		double a = timeit("legacy lowercase", 200000, [&]() { return legacy::lowercase(s).length(); });
+		double b = timeit("lowercase", 200000, [&]() { return lowercase(s).length(); });
+		double c = timeit("legacy ReplaceString", 200000, [&]() { return legacy::ReplaceString(s, "<@1234567890>", "sporks").length(); });
+		double d = timeit("ReplaceString", 200000, [&]() { return ReplaceString(s, "<@1234567890>", "sporks").length(); });
+		double e = timeit("legacy trim", 200000, [&]() { return legacy::trim(s).length(); });
+		double f = timeit("trim", 200000, [&]() { return trim(s).length(); });
+		std::cout << "  speedup: lowercase " << std::setprecision(2) << a / b << "x, ReplaceString " << c / d << "x, trim " << e / f << "x\n";
+	}
+
+	return (ok && sink) ? 0 : 1;
+}
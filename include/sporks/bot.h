@@ -32,15 +32,18 @@
 #include <dpp/dpp.h>
 #include <vector>
 #include <string>
+#include <map>
 #include <mutex>
 #include <thread>
 #include <tuple>
 #include <unordered_map>
+#include <atomic>
 
 using json = nlohmann::json;
 
 class Module;
 class ModuleLoader;
+class Outbound;
 
 class Bot {
 
@@ -55,29 +58,33 @@ class Bot {
 
 	/* Threads */
 	std::thread* thr_presence;
+	std::thread* thr_signals;
 
 	/* Set to true if all threads are to end */
 	bool terminate;
 
 	uint32_t shard_init_count;
 
+	/* Generic named counters, written and read from several threads */
+	std::map<std::string, uint64_t> counters;
+	std::mutex counters_mutex;
+
 	/* Thread handlers */
 	void UpdatePresenceThread();	/* Updates the bot presence every 120 seconds */
-
-	void SetSignals();
+	void SignalThread();		/* Shuts down cleanly on SIGTERM or SIGINT */
 
 public:
 	/* D++ cluster */
 	class dpp::cluster* core;
 
-	/* Generic named counters */
-	std::map<std::string, uint64_t> counters;
-
 	/* The bot's user details from ready event */
 	dpp::user user;
 
-	uint64_t sent_messages;
-	uint64_t received_messages;
+	std::atomic<uint64_t> sent_messages;
+	std::atomic<uint64_t> received_messages;
+
+	/* Send all messages through this, see outbound.h */
+	Outbound* outbound;
 
 	Bot(bool development, bool testing, bool intents, dpp::cluster* dppcluster);
 	virtual ~Bot();
@@ -91,6 +98,12 @@ public:
 	/* Join and delete a non-null pointer to std::thread */
 	void DisposeThread(std::thread* thread);
 
+	/* Set a named counter, creating it if it doesn't exist */
+	void SetCounter(const std::string &name, uint64_t value);
+
+	/* Get a named counter, returns false if nothing has set it yet */
+	bool GetCounter(const std::string &name, uint64_t &value);
+
 	/* Shorthand to get bot's user id */
 	int64_t getID();
 
@@ -128,7 +141,15 @@ public:
 	void onVoiceServerUpdate (const dpp::voice_server_update_t &event);
 	void onWebhooksUpdate (const dpp::webhooks_update_t &event);
 
+	/* Called by a module after it has changed the locked state of an infobot fact */
+	void onFactLock (const std::string &key, bool locked);
+
 	static std::string GetConfig(const std::string &name);
+	/* As above, but returns default_value if the setting is missing, for optional settings */
+	static std::string GetConfig(const std::string &name, const std::string &default_value);
 
 	static void SetSignal(int signal);
+
+	/* Set signal handlers. Must be called before any threads are started, see SignalThread() */
+	static void SetSignals();
 };
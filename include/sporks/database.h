@@ -23,6 +23,7 @@
 #include <map>
 #include <string>
 #include <variant>
+#include <cstdint>
 
 /*
  * db::resultset r = db::query("SELECT * FROM infobot WHERE setby = '?'", {"SKIPDX00"});
@@ -47,6 +48,8 @@ namespace db {
 	bool close();
 	/* Issue a database query and return results */
 	resultset query(const std::string &format, const paramlist &parameters);
-	/* Returns the last error string */
+	/* Returns the error string from the last query made by the calling thread, or an empty string */
 	const std::string& error();
+	/* Returns the number of rows changed by the last INSERT, UPDATE or DELETE made by the calling thread */
+	uint64_t affected_rows();
 };
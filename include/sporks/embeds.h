@@ -0,0 +1,64 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+
+#include <dpp/dpp.h>
+#include <string>
+#include <ctime>
+
+class Bot;
+
+/* Colour used by all sporks embeds */
+#define SPORKS_COLOUR 16767488
+#define SPORKS_FOOTER_TEXT "Powered by Sporks!"
+#define SPORKS_FOOTER_ICON "https://www.sporks.gg/images/sporks_2020.png"
+
+/**
+ * Builds a dpp::embed directly, for embeds the bot makes itself.
+ *
+ * Text is kept exactly as given and only serialised once, by D++, when the message is
+ * sent, so callers never escape anything. Text longer than Discord allows is cut short
+ * rather than having the whole message rejected. Embeds written by users as JSON (the
+ * <embed> reply and javascript) still go through dpp::embed(json*).
+ */
+class EmbedBuilder {
+	dpp::embed embed;
+public:
+	/* Starts an empty embed in the sporks colour */
+	EmbedBuilder();
+
+	EmbedBuilder& Title(const std::string &title);
+	EmbedBuilder& Description(const std::string &description);
+	EmbedBuilder& Colour(uint32_t colour);
+	EmbedBuilder& Url(const std::string &url);
+	EmbedBuilder& Image(const std::string &url);
+	EmbedBuilder& Thumbnail(const std::string &url);
+	EmbedBuilder& Author(const std::string &name, const std::string &url = "", const std::string &icon_url = "");
+	EmbedBuilder& Timestamp(time_t when);
+	EmbedBuilder& Footer(const std::string &text = SPORKS_FOOTER_TEXT, const std::string &icon_url = SPORKS_FOOTER_ICON);
+	/* Fields past Discord's limit of 25 are ignored. Empty names or values are sent as a zero width space */
+	EmbedBuilder& Field(const std::string &name, const std::string &value, bool is_inline = false);
+
+	const dpp::embed& Get() const;
+
+	/* Send the embed to a channel through the outbound queue. Returns false if the channel is unknown */
+	bool Send(Bot* bot, int64_t channelID) const;
+};
@@ -66,6 +66,7 @@ enum Implementation
 	I_OnVoiceStateUpdate,
 	I_OnVoiceServerUpdate,
 	I_OnWebhooksUpdate,
+	I_OnFactLock,
 	I_END
 };
 
@@ -166,6 +167,10 @@ public:
 	 */
 	bool Reload(const std::string &filename);
 
+	/* Unload all modules, calling each Module class's destructor
+	 */
+	void UnloadAll();
+
 	/* Enumerate modules within modules.json and load them all. Any modules that are
 	 * already loaded will be ignored, so we can use this to load new modules on rehash
 	 */
@@ -233,6 +238,9 @@ public:
 	virtual bool OnVoiceServerUpdate(const dpp::voice_server_update_t &obj);
 	virtual bool OnWebhooksUpdate(const dpp::webhooks_update_t &obj);
 
+	/* Bot events */
+	virtual bool OnFactLock(const std::string &key, bool locked);
+
 	/* Emit a simple text only embed to a channel, many modules use this for error reporting */
 	void EmbedSimple(const std::string &message, int64_t channelID);
 };
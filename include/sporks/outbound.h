@@ -0,0 +1,88 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+
+#include <dpp/dpp.h>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+class Bot;
+
+/**
+ * All messages the bot sends to Discord go through here.
+ *
+ * Messages for servers other than the test server are dropped in test mode. Sends are
+ * paced per channel by a token bucket which stays inside Discord's per-channel rate
+ * limit, so that messages wait here instead of being rejected with a 429. Plain text
+ * replies queued for the same channel while it waits may be joined into one message.
+ * Each channel's queue is capped, the oldest plain text replies being dropped first.
+ */
+class Outbound {
+
+	struct pending {
+		dpp::message msg;
+		/* May be joined with neighbouring coalescable messages */
+		bool coalesce;
+		dpp::command_completion_event_t callback;
+	};
+
+	struct channel_state {
+		std::deque<pending> queue;
+		double tokens;
+		std::chrono::steady_clock::time_point refilled;
+	};
+
+	Bot* bot;
+	bool test_mode;
+	uint64_t test_server;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::unordered_map<uint64_t, channel_state> channels;
+	size_t queued;
+	bool terminating;
+	std::thread* sender;
+
+	/* Take the next message for a channel, joining coalescable messages. Caller holds the lock */
+	pending Take(channel_state &c);
+	void Queue(pending &&p, uint64_t channel_id);
+	void SenderThread();
+
+public:
+	Outbound(Bot* bot);
+	~Outbound();
+
+	/* True if messages may be sent to this guild, false in test mode for all but the test server */
+	bool Allowed(uint64_t guild_id) const;
+
+	/* Queue a message for the given guild. Returns false if it was dropped by test mode */
+	bool Send(const dpp::message &msg, uint64_t guild_id, bool coalesce = false);
+
+	/* As above, calling callback with Discord's response once it has been sent */
+	bool Send(const dpp::message &msg, uint64_t guild_id, dpp::command_completion_event_t callback);
+
+	/* Messages waiting to be sent */
+	size_t GetQueued();
+};
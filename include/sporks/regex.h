@@ -43,10 +43,13 @@ class PCRE
 	const char* pcre_error;
 	int pcre_error_ofs;
 	struct real_pcre* compiled_regex;
+	struct pcre_extra* extra;
  public:
 	/* Constructor */
 	PCRE(const std::string &match, bool case_insensitive = false);
 	~PCRE();
+	/* Limit the work done by each match, for expressions which aren't trusted */
+	void SetMatchLimit(unsigned long match_limit, unsigned long recursion_limit);
 	/* Match methods */
 	bool Match(const std::string &comparison);
 	bool Match(const std::string &comparison, std::vector<std::string>& matches);
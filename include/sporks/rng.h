@@ -0,0 +1,101 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+/**
+ * xoshiro256** pseudo random number generator. Fast and good enough for choosing
+ * replies, NOT suitable for anything which needs to be unpredictable.
+ * Meets the UniformRandomBitGenerator requirements, so it works with <random> and <algorithm>.
+ */
+class xoshiro256 {
+	uint64_t s[4];
+
+	static inline uint64_t rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+public:
+	typedef uint64_t result_type;
+
+	explicit xoshiro256(uint64_t seed) {
+		/* Expand the seed with splitmix64, as recommended by the authors */
+		for (int i = 0; i < 4; ++i) {
+			uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			s[i] = z ^ (z >> 31);
+		}
+	}
+
+	static constexpr result_type min() {
+		return 0;
+	}
+
+	static constexpr result_type max() {
+		return std::numeric_limits<result_type>::max();
+	}
+
+	inline result_type operator()() {
+		const uint64_t result = rotl(s[1] * 5, 7) * 9;
+		const uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+};
+
+/**
+ * Random numbers from a generator owned by the calling thread, so that there is no locking
+ * and no shared state, unlike rand(). Each thread seeds its own generator on first use.
+ */
+namespace rng {
+
+	inline xoshiro256& generator() {
+		thread_local xoshiro256 g(((uint64_t)std::random_device{}() << 32) ^ std::random_device{}() ^ std::hash<std::thread::id>{}(std::this_thread::get_id()) ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count());
+		return g;
+	}
+
+	/* Random 64 bit number */
+	inline uint64_t next() {
+		return generator()();
+	}
+
+	/* Random number in the range [0, n). n must not be zero */
+	inline uint64_t below(uint64_t n) {
+		return (uint64_t)(((unsigned __int128)generator()() * n) >> 64);
+	}
+
+	/* Random integer in the range [min, max] */
+	inline int64_t range(int64_t min, int64_t max) {
+		return min + (int64_t)below((uint64_t)(max - min) + 1);
+	}
+};
@@ -0,0 +1,64 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <cstddef>
+
+/**
+ * Low level string scanning kernels used by stringops.h.
+ *
+ * All of these work on raw byte buffers and only ever treat the ASCII range as letters
+ * or whitespace. Bytes with the top bit set (all parts of UTF-8 multibyte sequences) are
+ * never changed and never match a letter or whitespace class, so UTF-8 text passes through
+ * unharmed. The best implementation for the running CPU (AVX2, SSE2 or plain C++) is
+ * picked once at startup.
+ */
+namespace stringkernels {
+
+	/* Returned by the find functions when nothing matched, same value as std::string::npos */
+	constexpr size_t npos = static_cast<size_t>(-1);
+
+	/* Copy len bytes from src to dst, converting A-Z to a-z. src and dst may be the same buffer */
+	void to_lower(char* dst, const char* src, size_t len);
+
+	/* Copy len bytes from src to dst, converting a-z to A-Z. src and dst may be the same buffer */
+	void to_upper(char* dst, const char* src, size_t len);
+
+	/* Case insensitive search for needle within haystack. Returns offset of first match or npos */
+	size_t ifind(const char* haystack, size_t hlen, const char* needle, size_t nlen);
+
+	/* Returns true if both buffers are equal ignoring ASCII case */
+	bool iequals(const char* a, size_t alen, const char* b, size_t blen);
+
+	/* Offset of the first byte which is not one of " \t\n\r\f\v", or npos */
+	size_t find_first_not_space(const char* s, size_t len);
+
+	/* Offset of the last byte which is not one of " \t\n\r\f\v", or npos */
+	size_t find_last_not_space(const char* s, size_t len);
+
+	/* Offset of the first byte which is any of the bytes in set, or npos */
+	size_t find_first_of(const char* s, size_t len, const char* set, size_t setlen);
+
+	/* Returns true if the buffer contains only 7 bit ASCII */
+	bool is_ascii(const char* s, size_t len);
+
+	/* Name of the implementation selected for this CPU, e.g. "avx2" */
+	const char* implementation();
+};
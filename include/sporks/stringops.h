@@ -23,6 +23,7 @@
 #include <iomanip>
 #include <locale>
 #include <algorithm>
+#include <sporks/stringkernels.h>
 
 /**
  * Convert a string to lowercase using tolower()
@@ -44,7 +45,49 @@ template <typename T> std::basic_string<T> uppercase(const std::basic_string<T>&
     return std::move(s2);
 }
 
-/* Simple search and replace, case sensitive */
+/**
+ * Convert a std::string to lowercase. Only A-Z are changed, UTF-8 sequences pass through
+ * untouched. Preferred over the template above for plain std::string.
+ */
+inline std::string lowercase(const std::string& s)
+{
+	std::string s2(s.length(), '\0');
+	stringkernels::to_lower(&s2[0], s.data(), s.length());
+	return s2;
+}
+
+/**
+ * Convert a std::string to uppercase. Only a-z are changed, UTF-8 sequences pass through
+ * untouched. Preferred over the template above for plain std::string.
+ */
+inline std::string uppercase(const std::string& s)
+{
+	std::string s2(s.length(), '\0');
+	stringkernels::to_upper(&s2[0], s.data(), s.length());
+	return s2;
+}
+
+/**
+ * Case insensitive find, returns std::string::npos if not found
+ */
+inline size_t ifind(const std::string& haystack, const std::string& needle, size_t pos = 0)
+{
+	if (pos > haystack.length()) {
+		return std::string::npos;
+	}
+	size_t found = stringkernels::ifind(haystack.data() + pos, haystack.length() - pos, needle.data(), needle.length());
+	return found == stringkernels::npos ? std::string::npos : found + pos;
+}
+
+/**
+ * Returns true if two strings are equal, ignoring case
+ */
+inline bool iequals(const std::string& a, const std::string& b)
+{
+	return stringkernels::iequals(a.data(), a.length(), b.data(), b.length());
+}
+
+/* Simple search and replace, case insensitive */
 std::string ReplaceString(std::string subject, const std::string& search, const std::string& replace);
 
 /**
@@ -52,7 +95,7 @@ std::string ReplaceString(std::string subject, const std::string& search, const
  */
 inline std::string rtrim(std::string s)
 {
-	s.erase(s.find_last_not_of(" \t\n\r\f\v") + 1);
+	s.erase(stringkernels::find_last_not_space(s.data(), s.length()) + 1);
 	return s;
 }
 
@@ -61,18 +104,35 @@ inline std::string rtrim(std::string s)
  */
 inline std::string ltrim(std::string s)
 {
-	s.erase(0, s.find_first_not_of(" \t\n\r\f\v"));
+	size_t first = stringkernels::find_first_not_space(s.data(), s.length());
+	s.erase(0, first == stringkernels::npos ? s.length() : first);
 	return s;
 }
 
 /**
- * trim from both ends of string (right then left)
+ * trim from both ends of string (right then left), in place so that the string is only copied once
  */
 inline std::string trim(std::string s)
 {
-	return ltrim(rtrim(s));
+	s.erase(stringkernels::find_last_not_space(s.data(), s.length()) + 1);
+	s.erase(0, std::min(s.length(), stringkernels::find_first_not_space(s.data(), s.length())));
+	return s;
 }
 
+/**
+ * Fold a string for comparison the way MySQL's utf8mb4_general_ci collation compares it:
+ * ASCII case, accents on Latin letters up to U+017F and trailing spaces are ignored.
+ * Other characters are left as they are, see general_ci_exact().
+ */
+std::string general_ci_fold(const std::string& s);
+
+/**
+ * True if general_ci_fold() gives the same result as MySQL for every character of s, so that
+ * two such strings are equal in MySQL exactly when their folds are. False for characters from
+ * other scripts, which MySQL also folds, so they must be compared by MySQL.
+ */
+bool general_ci_exact(const std::string& s);
+
 /**
  * Add commas to a string (or dots) based on current locale server-side
  */
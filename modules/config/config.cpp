@@ -23,6 +23,7 @@
 #include <fmt/format.h>
 #include <sporks/modules.h>
 #include <sporks/bot.h>
+#include <sporks/embeds.h>
 #include <sporks/config.h>
 #include <sporks/database.h>
 #include <sporks/stringops.h>
@@ -33,7 +34,6 @@
 #include <cstdint>
 #include <mutex>
 #include <stdlib.h>
-#include <sporks/statusfield.h>
 #include <sporks/regex.h>
 
 using json = nlohmann::json;
@@ -60,7 +60,7 @@ public:
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 19$";
+		std::string version = "$ModVer 21$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -193,9 +193,9 @@ public:
 			if (currentlist.empty()) {
 				s << "**Ignore list for <#" << channelID << "> is empty!**";
 			} else {
-				s << "**Ignore list for <#" << channelID << ">**\\n\\n";
+				s << "**Ignore list for <#" << channelID << ">**\n\n";
 				for (auto i = currentlist.begin(); i != currentlist.end(); ++i) {
-					s << "<@" << *i << "> (" << *i << ")\\n";
+					s << "<@" << *i << "> (" << *i << ")\n";
 				}
 			}
 			EmbedSimple(s.str(), channelID);
@@ -207,41 +207,17 @@ public:
 	 */
 	void DoConfigShow(int64_t channelID, const dpp::user &issuer) {
 		json csettings = getSettings(bot, channelID, 0);
-		json embed_json;
-		std::stringstream s;
-	
-		const statusfield statusfields[] = {
-			statusfield("Talk without being mentioned?", settings::IsTalkative(csettings) ? "Yes" : "No"),
-			statusfield("Learn from this channel?", settings::IsLearningEnabled(csettings) ? "Yes" : "No"),
-			statusfield("Ignored users", Comma(settings::GetIgnoreList(csettings).size())),
-			statusfield("", "")
-		};
-		s << "{\"title\":\"Settings for this channel\",\"color\":16767488,";
-		s << "\"footer\":{\"text\":\"Powered by Sporks!\",\"icon_url\":\"https://sporks.gg/images/sporks_2020.png\"},\"fields\":[";
-		for (int i = 0; statusfields[i].name != ""; ++i) {
-			s << "{\"name\":\"" +  statusfields[i].name + "\",\"value\":\"" + statusfields[i].value + "\", \"inline\": false}";
-			if (statusfields[i + 1].name != "") {
-				s << ",";
-			}
-		}
-		s << "],\"description\":\"For help on changing these settings, please see [the wiki](https://github.com/brainboxdotcc/sporks/wiki/Configuration)\"}";
-		try {
-			embed_json = json::parse(s.str());
+		bool sent = EmbedBuilder()
+			.Title("Settings for this channel")
+			.Description("For help on changing these settings, please see [the wiki](https://github.com/brainboxdotcc/sporks/wiki/Configuration)")
+			.Field("Talk without being mentioned?", settings::IsTalkative(csettings) ? "Yes" : "No")
+			.Field("Learn from this channel?", settings::IsLearningEnabled(csettings) ? "Yes" : "No")
+			.Field("Ignored users", Comma(settings::GetIgnoreList(csettings).size()))
+			.Footer()
+			.Send(bot, channelID);
+		if (!sent) {
+			bot->core->log(dpp::ll_error, fmt::format("Invalid channel {} passed to DoConfigShow", channelID));
 		}
-		catch (const std::exception &e) {
-			bot->core->log(dpp::ll_error, fmt::format("Config show for channel ID {}, invalid json: {}", channelID, s.str()));
-		}
-		dpp::channel* channel = dpp::find_channel(channelID);
-		if (channel) {
-			if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-				dpp::message m;
-				m.channel_id = channel->id;
-				m.embeds.push_back(dpp::embed(&embed_json));
-				bot->core->message_create(m);
-			}
-		} else {
-			bot->core->log(dpp::ll_error, fmt::format("Invalid channel {} passed to EmbedSimple", channelID));
-		}	
 	}
 
 	/**
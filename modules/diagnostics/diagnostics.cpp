@@ -21,6 +21,7 @@
 #include <dpp/dpp.h>
 #include <fmt/format.h>
 #include <sporks/bot.h>
+#include <sporks/outbound.h>
 #include <sporks/regex.h>
 #include <sporks/modules.h>
 #include <sporks/stringops.h>
@@ -86,7 +87,7 @@ public:
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 31$";
+		std::string version = "$ModVer 33$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -144,10 +145,7 @@ public:
 
 						dpp::channel* c = dpp::find_channel(msg.channel_id);
 						if (c) {
-							if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == c->guild_id) {
-								bot->core->message_create(dpp::message(c->id, s.str()));
-								bot->sent_messages++;
-							}
+							bot->outbound->Send(dpp::message(c->id, s.str()), c->guild_id);
 						}
 						
 					} else if (lowercase(subcommand) == "load") {
@@ -189,22 +187,21 @@ public:
 						std::string result = exec("top -b -n1 -d0 | head -n7 && top -b -n1 -d0 -H | grep \"./bot\\|run.sh\" | grep -v grep | grep -v perl");
 						dpp::channel* c = dpp::find_channel(msg.channel_id);
 						if (c) {
-							if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == c->guild_id) {
-								bot->core->message_create(dpp::message(msg.channel_id, "```" + result + "```"));
-								bot->sent_messages++;
-							}
+							bot->outbound->Send(dpp::message(msg.channel_id, "```" + result + "```"), c->guild_id);
 						}
 					} else if (lowercase(subcommand) == "lock") {
 						std::string keyword;
 						std::getline(tokens, keyword);
 						keyword = trim(keyword);
 						db::query("UPDATE infobot SET locked = 1 WHERE key_word = '?'", {keyword});
+						bot->onFactLock(keyword, true);
 						EmbedSimple("**Locked** key word: " + keyword, msg.channel_id);
 					} else if (lowercase(subcommand) == "unlock") {
 						std::string keyword;
 						std::getline(tokens, keyword);
 						keyword = trim(keyword);
 						db::query("UPDATE infobot SET locked = 0 WHERE key_word = '?'", {keyword});
+						bot->onFactLock(keyword, false);
 						EmbedSimple("**Unlocked** key word: " + keyword, msg.channel_id);
 					} else if (lowercase(subcommand) == "sql") {
 						std::string sql;
@@ -262,10 +259,7 @@ public:
 							}
 							dpp::channel* c = dpp::find_channel(msg.channel_id);
 							if (c) {
-								if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == c->guild_id) {
-									bot->core->message_create(dpp::message(msg.channel_id, "```diff\n" + w.str() + "```"));
-									bot->sent_messages++;
-								}
+								bot->outbound->Send(dpp::message(msg.channel_id, "```diff\n" + w.str() + "```"), c->guild_id);
 							}
 						}
 					} else if (lowercase(subcommand) == "restart") {
@@ -278,7 +272,7 @@ public:
 						if (c) {
 							std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
 							dpp::snowflake cid = msg.channel_id;
-							bot->core->message_create(dpp::message(msg.channel_id, "Pinging..."), [cid, this, start_time](const dpp::confirmation_callback_t & state) {
+							bot->outbound->Send(dpp::message(msg.channel_id, "Pinging..."), c->guild_id, [cid, this, start_time](const dpp::confirmation_callback_t & state) {
 								double microseconds_ping = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
 								dpp::snowflake mid = (std::get<dpp::message>(state.value)).id;
 								this->bot->core->message_delete(mid, cid);
@@ -336,10 +330,7 @@ public:
 						w << "```";
 						dpp::channel *channel = dpp::find_channel(msg.channel_id);
 						if (channel) {
-							if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-								bot->core->message_create(dpp::message(channel->id, w.str()));
-								bot->sent_messages++;
-							}
+							bot->outbound->Send(dpp::message(channel->id, w.str()), channel->guild_id);
 						}
 					} else {
 						/* Invalid command */
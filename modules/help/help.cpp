@@ -22,13 +22,13 @@
 #include <dpp/nlohmann/json.hpp>
 #include <fmt/format.h>
 #include <sporks/modules.h>
+#include <sporks/outbound.h>
 #include <sporks/regex.h>
 #include <string>
 #include <cstdint>
-#include <fstream>
-#include <streambuf>
 #include <sporks/stringops.h>
 #include <sporks/statusfield.h>
+#include "templates.h"
 
 using json = nlohmann::json;
 
@@ -39,22 +39,25 @@ using json = nlohmann::json;
 class HelpModule : public Module
 {
 	PCRE* helpmessage;
+	HelpTemplates* templates;
 public:
 	HelpModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml)
 	{
 		ml->Attach({ I_OnMessage }, this);
 		helpmessage = new PCRE("^help(|\\s+(.+?))$", true);
+		templates = new HelpTemplates(bot, "../help");
 	}
 
 	virtual ~HelpModule()
 	{
 		delete helpmessage;
+		delete templates;
 	}
 
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 17$";
+		std::string version = "$ModVer 20$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -83,11 +86,10 @@ public:
 	}
 	
 	/**
-	 * Emit help using a json file in the help/ directory. Missing help files emit a generic error message.
+	 * Emit help using a template loaded from the help/ directory. Missing help sections emit a generic error message.
 	 */
 	void GetHelp(const std::string &section, int64_t channelID, const std::string &botusername, int64_t botid, const std::string &author, int64_t authorid, bool dm)
 	{
-		json embed_json;
 		char timestamp[256];
 		time_t timeval = time(NULL);
 		dpp::channel* channel = dpp::find_channel(channelID);
@@ -96,42 +98,24 @@ public:
 			bot->core->log(dpp::ll_error, fmt::format("Can't find channel {}!", channelID));
 			return;
 		}
-	
-		std::ifstream t("../help/" + section + ".json");
-		if (!t) {
-			t = std::ifstream("../help/error.json");
-		}
-		std::string _json((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
 
-		tm _tm;
-		gmtime_r(&timeval, &_tm);
-		strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &_tm);
-
-		_json = ReplaceString(_json, ":section:" , section);
-		_json = ReplaceString(_json, ":user:", botusername);
-		_json = ReplaceString(_json, ":id:", std::to_string(botid));
-		_json = ReplaceString(_json, ":author:", author);
-		_json = ReplaceString(_json, ":ts:", timestamp);
-	
-		try {
-			embed_json = json::parse(_json);
+		bool malformed = false;
+		std::shared_ptr<const HelpTemplate> help = templates->Get(section, malformed);
+		if (!help && !malformed) {
+			help = templates->Get("error", malformed);
 		}
-		catch (const std::exception &e) {
-			if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-				bot->core->message_create(dpp::message(channel->id, "<@" + std::to_string(authorid) + ">, herp derp, theres a malformed help file. Please contact a developer on the official support server: https://discord.gg/brainbox"));
-				bot->sent_messages++;
-			}
+		if (!help) {
+			bot->outbound->Send(dpp::message(channel->id, "<@" + std::to_string(authorid) + ">, herp derp, theres a malformed help file. Please contact a developer on the official support server: https://discord.gg/brainbox"), channel->guild_id);
 			bot->core->log(dpp::ll_error, fmt::format("Malformed help file {}.json!", section));
 			return;
 		}
 
-		if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-			dpp::message m;
-			m.embeds.push_back(dpp::embed(&embed_json));
-			m.channel_id = channel->id;
-			bot->core->message_create(m);
-			bot->sent_messages++;
-		}
+		tm _tm;
+		gmtime_r(&timeval, &_tm);
+		strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &_tm);
+
+		const std::string values[slot_count] = { section, botusername, std::to_string(botid), author, timestamp };
+		help->Render(values).Send(bot, channelID);
 	}
 };
 
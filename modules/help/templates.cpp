@@ -0,0 +1,283 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <sporks/bot.h>
+#include <sporks/stringops.h>
+#include <fmt/format.h>
+#include <fstream>
+#include <streambuf>
+#include <mutex>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "templates.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+	/* Placeholder text for each help_slot */
+	const std::string slot_names[slot_count] = { ":section:", ":user:", ":id:", ":author:", ":ts:" };
+
+	const std::string suffix = ".json";
+
+	/* Section name for a help file name, or empty if it isn't a help file */
+	std::string section_name(const std::string &filename)
+	{
+		if (filename.length() <= suffix.length() || filename.compare(filename.length() - suffix.length(), suffix.length(), suffix) != 0 || filename[0] == '.') {
+			return "";
+		}
+		return filename.substr(0, filename.length() - suffix.length());
+	}
+
+	std::string text_of(const json &j, const char* name)
+	{
+		if (j.is_object() && j.contains(name) && j[name].is_string()) {
+			return j[name].get<std::string>();
+		}
+		return "";
+	}
+};
+
+HelpText::HelpText() : literal_length(0)
+{
+}
+
+HelpText::HelpText(const std::string &text) : literal_length(0)
+{
+	std::string literal;
+	size_t pos = 0;
+	while (pos < text.length()) {
+		help_slot found = slot_none;
+		if (text[pos] == ':') {
+			for (int s = 0; s < slot_count; ++s) {
+				/* Case insensitive, as ReplaceString() was when placeholders were substituted on every render */
+				if (text.length() - pos >= slot_names[s].length() && stringkernels::iequals(text.data() + pos, slot_names[s].length(), slot_names[s].data(), slot_names[s].length())) {
+					found = static_cast<help_slot>(s);
+					break;
+				}
+			}
+		}
+		if (found == slot_none) {
+			literal += text[pos++];
+		} else {
+			literal_length += literal.length();
+			parts.emplace_back(literal, found);
+			literal.clear();
+			pos += slot_names[found].length();
+		}
+	}
+	if (!literal.empty()) {
+		literal_length += literal.length();
+		parts.emplace_back(literal, slot_none);
+	}
+}
+
+std::string HelpText::Render(const std::string* values) const
+{
+	std::string out;
+	out.reserve(literal_length + (parts.size() * 16));
+	for (auto & p : parts) {
+		out += p.first;
+		if (p.second != slot_none) {
+			out += values[p.second];
+		}
+	}
+	return out;
+}
+
+bool HelpText::Empty() const
+{
+	return parts.empty();
+}
+
+HelpTemplate::HelpTemplate(const std::string &json_text) : colour(0), has_colour(false), has_timestamp(false), has_footer(false), has_author(false)
+{
+	json j = json::parse(json_text);
+	if (!j.is_object()) {
+		throw std::invalid_argument("Help file is not a JSON object");
+	}
+	title = HelpText(text_of(j, "title"));
+	description = HelpText(text_of(j, "description"));
+	url = HelpText(text_of(j, "url"));
+	if (j.contains("color") && j["color"].is_number()) {
+		colour = j["color"].get<uint32_t>();
+		has_colour = true;
+	}
+	has_timestamp = j.contains("timestamp");
+	if (j.contains("thumbnail")) {
+		thumbnail = HelpText(text_of(j["thumbnail"], "url"));
+	}
+	if (j.contains("image")) {
+		image = HelpText(text_of(j["image"], "url"));
+	}
+	if (j.contains("author")) {
+		has_author = true;
+		author_name = HelpText(text_of(j["author"], "name"));
+		author_url = HelpText(text_of(j["author"], "url"));
+		author_icon = HelpText(text_of(j["author"], "icon_url"));
+	}
+	if (j.contains("footer")) {
+		has_footer = true;
+		footer_text = HelpText(text_of(j["footer"], "text"));
+		footer_icon = HelpText(text_of(j["footer"], "icon_url"));
+	}
+	if (j.contains("fields") && j["fields"].is_array()) {
+		for (auto & f : j["fields"]) {
+			fields.push_back({HelpText(text_of(f, "name")), HelpText(text_of(f, "value")), f.is_object() && f.contains("inline") && f["inline"].is_boolean() && f["inline"].get<bool>()});
+		}
+	}
+}
+
+EmbedBuilder HelpTemplate::Render(const std::string* values) const
+{
+	EmbedBuilder embed;
+	embed.Title(title.Render(values)).Description(description.Render(values)).Url(url.Render(values));
+	if (has_colour) {
+		embed.Colour(colour);
+	}
+	if (has_timestamp) {
+		embed.Timestamp(time(NULL));
+	}
+	if (!thumbnail.Empty()) {
+		embed.Thumbnail(thumbnail.Render(values));
+	}
+	if (!image.Empty()) {
+		embed.Image(image.Render(values));
+	}
+	if (has_author) {
+		embed.Author(author_name.Render(values), author_url.Render(values), author_icon.Render(values));
+	}
+	if (has_footer) {
+		embed.Footer(footer_text.Render(values), footer_icon.Render(values));
+	}
+	for (auto & f : fields) {
+		embed.Field(f.name.Render(values), f.value.Render(values), f.is_inline);
+	}
+	return embed;
+}
+
+HelpTemplates::HelpTemplates(Bot* instigator, const std::string &dir) : bot(instigator), directory(dir), watcher(nullptr), terminating(false)
+{
+	DIR* d = opendir(directory.c_str());
+	if (d) {
+		struct dirent* entry;
+		while ((entry = readdir(d))) {
+			if (!section_name(entry->d_name).empty()) {
+				LoadFile(entry->d_name);
+			}
+		}
+		closedir(d);
+	} else {
+		bot->core->log(dpp::ll_error, fmt::format("Can't open help directory {}", directory));
+	}
+	bot->core->log(dpp::ll_info, fmt::format("Loaded {} help sections", GetCount()));
+	watcher = new std::thread(&HelpTemplates::Watch, this);
+}
+
+HelpTemplates::~HelpTemplates()
+{
+	terminating = true;
+	bot->DisposeThread(watcher);
+}
+
+void HelpTemplates::LoadFile(const std::string &filename)
+{
+	std::string name = section_name(filename);
+	std::ifstream t(directory + "/" + filename);
+	if (!t) {
+		/* Removed again before we got to it */
+		Forget(filename);
+		return;
+	}
+	std::string text((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+	try {
+		auto parsed = std::make_shared<const HelpTemplate>(text);
+		std::unique_lock lock(mtx);
+		sections[name] = parsed;
+		malformed.erase(name);
+	}
+	catch (const std::exception &e) {
+		bot->core->log(dpp::ll_error, fmt::format("Malformed help file {}: {}", filename, e.what()));
+		std::unique_lock lock(mtx);
+		if (sections.find(name) == sections.end()) {
+			malformed.insert(name);
+		}
+	}
+}
+
+void HelpTemplates::Forget(const std::string &filename)
+{
+	std::string name = section_name(filename);
+	std::unique_lock lock(mtx);
+	sections.erase(name);
+	malformed.erase(name);
+}
+
+void HelpTemplates::Watch()
+{
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+		bot->core->log(dpp::ll_error, fmt::format("Can't watch help directory {} for changes, help files will not be reloaded", directory));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+	alignas(struct inotify_event) char buffer[4096];
+	while (!terminating) {
+		struct pollfd p = { fd, POLLIN, 0 };
+		/* Wake once a second to check for termination */
+		if (poll(&p, 1, 1000) <= 0) {
+			continue;
+		}
+		ssize_t len = read(fd, buffer, sizeof(buffer));
+		for (ssize_t pos = 0; pos < len;) {
+			const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + pos);
+			pos += sizeof(struct inotify_event) + event->len;
+			if (!event->len || section_name(event->name).empty()) {
+				continue;
+			}
+			if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				bot->core->log(dpp::ll_info, fmt::format("Help file {} removed", event->name));
+				Forget(event->name);
+			} else {
+				bot->core->log(dpp::ll_info, fmt::format("Reloading help file {}", event->name));
+				LoadFile(event->name);
+			}
+		}
+	}
+	close(fd);
+}
+
+std::shared_ptr<const HelpTemplate> HelpTemplates::Get(const std::string &section, bool &is_malformed) const
+{
+	std::shared_lock lock(mtx);
+	auto i = sections.find(section);
+	is_malformed = (i == sections.end() && malformed.find(section) != malformed.end());
+	return i == sections.end() ? nullptr : i->second;
+}
+
+size_t HelpTemplates::GetCount() const
+{
+	std::shared_lock lock(mtx);
+	return sections.size();
+}
@@ -0,0 +1,110 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+
+#include <dpp/dpp.h>
+#include <dpp/nlohmann/json.hpp>
+#include <sporks/embeds.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+
+class Bot;
+
+/* Placeholders which may appear in help file text, in the order render() takes their values */
+enum help_slot {
+	slot_section = 0,
+	slot_user,
+	slot_id,
+	slot_author,
+	slot_ts,
+	slot_count,
+	slot_none = slot_count
+};
+
+/**
+ * A string from a help file, split at its placeholders so that it renders in one pass
+ */
+class HelpText {
+	std::vector<std::pair<std::string, help_slot>> parts;
+	size_t literal_length;
+public:
+	HelpText();
+	explicit HelpText(const std::string &text);
+	std::string Render(const std::string* values) const;
+	bool Empty() const;
+};
+
+/**
+ * One help section: the embed from a help file with its text split into HelpText.
+ * Throws std::exception if the file is not a valid JSON object.
+ */
+class HelpTemplate {
+	struct field {
+		HelpText name, value;
+		bool is_inline;
+	};
+	HelpText title, description, url, thumbnail, image;
+	HelpText author_name, author_url, author_icon;
+	HelpText footer_text, footer_icon;
+	std::vector<field> fields;
+	uint32_t colour;
+	bool has_colour;
+	bool has_timestamp;
+	bool has_footer;
+	bool has_author;
+public:
+	explicit HelpTemplate(const std::string &json_text);
+	EmbedBuilder Render(const std::string* values) const;
+};
+
+/**
+ * All help sections, loaded from the help directory when the module loads.
+ *
+ * A thread watches the directory with inotify and reloads any file which is written,
+ * created or renamed into place, and forgets files which are removed. A file which
+ * fails to parse keeps its previous version if it had one.
+ */
+class HelpTemplates {
+	Bot* bot;
+	std::string directory;
+	mutable std::shared_mutex mtx;
+	std::unordered_map<std::string, std::shared_ptr<const HelpTemplate>> sections;
+	std::unordered_set<std::string> malformed;
+	std::thread* watcher;
+	std::atomic<bool> terminating;
+
+	void LoadFile(const std::string &name);
+	void Forget(const std::string &name);
+	void Watch();
+public:
+	HelpTemplates(Bot* instigator, const std::string &dir);
+	~HelpTemplates();
+
+	/* Template for a section, or nullptr. is_malformed is set if its file exists but can't be parsed */
+	std::shared_ptr<const HelpTemplate> Get(const std::string &section, bool &is_malformed) const;
+	size_t GetCount() const;
+};
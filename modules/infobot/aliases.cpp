@@ -0,0 +1,259 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+#include <sporks/stringops.h>
+#include "backend.h"
+#include "aliases.h"
+
+AliasGraph aliases;
+
+AliasGraph::AliasGraph() : rebuilding(false), cyclic(0), broken(0)
+{
+}
+
+/* Same as matching the value against "<alias>\s*(.*)", case insensitive */
+bool AliasGraph::Parse(const std::string &value, std::string &target)
+{
+	size_t pos = ifind(value, "<alias>");
+	if (pos == std::string::npos) {
+		return false;
+	}
+	pos = value.find_first_not_of(" \t\r\n\f\v", pos + 7);
+	if (pos == std::string::npos) {
+		target.clear();
+		return true;
+	}
+	size_t end = value.find('\n', pos);
+	target = value.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+	return true;
+}
+
+void AliasGraph::Link(const std::string &key, const std::string &target)
+{
+	edges[key] = target;
+	referrers[target].insert(key);
+}
+
+void AliasGraph::Unlink(const std::string &key)
+{
+	auto e = edges.find(key);
+	if (e == edges.end()) {
+		return;
+	}
+	auto r = referrers.find(e->second);
+	if (r != referrers.end()) {
+		r->second.erase(key);
+		if (r->second.empty()) {
+			referrers.erase(r);
+		}
+	}
+	edges.erase(e);
+}
+
+/* Forget the resolved target of key and of every alias which leads to it */
+void AliasGraph::Invalidate(const std::string &key)
+{
+	std::vector<std::string> pending{key};
+	std::unordered_set<std::string> seen{key};
+	while (!pending.empty()) {
+		std::string k = pending.back();
+		pending.pop_back();
+		resolved.erase(k);
+		auto r = referrers.find(k);
+		if (r != referrers.end()) {
+			for (auto & from : r->second) {
+				if (seen.insert(from).second) {
+					pending.push_back(from);
+				}
+			}
+		}
+	}
+}
+
+AliasGraph::resolution AliasGraph::ResolveLocked(const std::string &key)
+{
+	std::vector<std::string> path;
+	std::unordered_set<std::string> on_path;
+	std::string current = key;
+	resolution result;
+	while (true) {
+		auto r = resolved.find(current);
+		if (r != resolved.end()) {
+			result = r->second;
+			break;
+		}
+		auto e = edges.find(current);
+		if (e == edges.end()) {
+			result = {current, false};
+			break;
+		}
+		if (!on_path.insert(current).second) {
+			/* Every alias on the path loops, including those leading into the loop */
+			result = {"", true};
+			break;
+		}
+		path.push_back(current);
+		current = e->second;
+	}
+	for (auto & k : path) {
+		resolved[k] = result;
+	}
+	return result;
+}
+
+void AliasGraph::Change(const std::string &key, const std::string *target)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (rebuilding) {
+		/* Rows for this key already read by the scan may be older than this */
+		touched.insert(key);
+		if (target) {
+			building[key] = *target;
+		} else {
+			building.erase(key);
+		}
+	}
+	auto e = edges.find(key);
+	if (target ? (e != edges.end() && e->second == *target) : (e == edges.end())) {
+		/* Nothing changed in the graph */
+		return;
+	}
+	Invalidate(key);
+	Unlink(key);
+	if (target) {
+		Link(key, *target);
+	}
+}
+
+void AliasGraph::Learn(const std::string &key, const std::string &value)
+{
+	std::string target;
+	if (Parse(value, target)) {
+		target = normalise_key(target);
+		Change(normalise_key(key), &target);
+	} else {
+		Change(normalise_key(key), nullptr);
+	}
+}
+
+void AliasGraph::Forget(const std::string &key)
+{
+	Change(normalise_key(key), nullptr);
+}
+
+bool AliasGraph::Resolve(const std::string &key, std::string &target)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	resolution r = ResolveLocked(normalise_key(key));
+	target = r.target;
+	return !r.cyclic;
+}
+
+void AliasGraph::BeginRebuild()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	building.clear();
+	touched.clear();
+	rebuilding = true;
+}
+
+void AliasGraph::AddToRebuild(const std::string &key, const std::string &value)
+{
+	std::string target;
+	if (!Parse(value, target)) {
+		return;
+	}
+	std::string k = normalise_key(key);
+	std::lock_guard<std::mutex> lock(mtx);
+	if (rebuilding && touched.find(k) == touched.end()) {
+		building[k] = normalise_key(target);
+	}
+}
+
+void AliasGraph::CommitRebuild()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!rebuilding) {
+		return;
+	}
+	edges.swap(building);
+	referrers.clear();
+	for (auto & e : edges) {
+		referrers[e.second].insert(e.first);
+	}
+	resolved.clear();
+	building.clear();
+	touched.clear();
+	rebuilding = false;
+}
+
+void AliasGraph::AbortRebuild()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	building.clear();
+	touched.clear();
+	rebuilding = false;
+}
+
+void AliasGraph::Audit(const std::function<bool(const std::string&)> &exists, size_t max_examples, std::vector<std::string> &examples)
+{
+	std::vector<std::string> keys;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		keys.reserve(edges.size());
+		for (auto & e : edges) {
+			keys.push_back(e.first);
+		}
+	}
+	size_t loops = 0, missing = 0;
+	for (auto & k : keys) {
+		std::string target;
+		if (!Resolve(k, target)) {
+			if (loops++ < max_examples) {
+				examples.push_back(fmt::format("'{}' is part of an alias loop", k));
+			}
+		} else if (!exists(target)) {
+			if (missing++ < max_examples) {
+				examples.push_back(fmt::format("'{}' is an alias of '{}' which doesn't exist", k, target));
+			}
+		}
+	}
+	cyclic = loops;
+	broken = missing;
+}
+
+size_t AliasGraph::GetCount()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return edges.size();
+}
+
+size_t AliasGraph::GetCyclic()
+{
+	return cyclic;
+}
+
+size_t AliasGraph::GetBroken()
+{
+	return broken;
+}
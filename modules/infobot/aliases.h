@@ -0,0 +1,106 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <atomic>
+
+/**
+ * Every fact whose value is "<alias> otherkey", held as a graph of alias edges so
+ * that an aliased question can be followed to its final definition in memory and
+ * answered with a single get_def().
+ *
+ * The graph is loaded by the maintenance thread's scan of the table and kept current
+ * by set_def() and del_def(). The final target of each alias is worked out once and
+ * remembered, and forgotten again when any fact along its chain changes. Alias loops
+ * are detected while resolving rather than by limiting the number of hops.
+ */
+class AliasGraph {
+
+	/* Final target of an alias, or a loop */
+	struct resolution {
+		std::string target;
+		bool cyclic;
+	};
+
+	std::mutex mtx;
+	/* Alias key to the key it points at, both normalised */
+	std::unordered_map<std::string, std::string> edges;
+	/* Key to the aliases which point at it */
+	std::unordered_map<std::string, std::unordered_set<std::string>> referrers;
+	/* Resolved targets, filled in on demand */
+	std::unordered_map<std::string, resolution> resolved;
+
+	/* Edges found by a rebuild scan, and keys changed since it started */
+	std::unordered_map<std::string, std::string> building;
+	std::unordered_set<std::string> touched;
+	bool rebuilding;
+
+	std::atomic<size_t> cyclic;
+	std::atomic<size_t> broken;
+
+	/* These expect the lock to be held */
+	void Link(const std::string &key, const std::string &target);
+	void Unlink(const std::string &key);
+	void Invalidate(const std::string &key);
+	resolution ResolveLocked(const std::string &key);
+	void Change(const std::string &key, const std::string *target);
+
+public:
+	AliasGraph();
+
+	/* Returns true if a fact value is an alias, and the key it points at */
+	static bool Parse(const std::string &value, std::string &target);
+
+	/* Record a fact which has just been written, alias or not */
+	void Learn(const std::string &key, const std::string &value);
+
+	/* Record a fact which has just been deleted */
+	void Forget(const std::string &key);
+
+	/* Follow the alias chain from key and set target to the key at the end of it.
+	 * A key which is not an alias is its own target. Returns false if the chain loops.
+	 */
+	bool Resolve(const std::string &key, std::string &target);
+
+	/* Rebuild from a scan of the table. AddToRebuild() is given every alias fact */
+	void BeginRebuild();
+	void AddToRebuild(const std::string &key, const std::string &value);
+	void CommitRebuild();
+	void AbortRebuild();
+
+	/* Resolve every alias, counting those which loop and those whose target doesn't
+	 * exist according to the exists callback. Descriptions of up to max_examples bad
+	 * aliases are added to examples.
+	 */
+	void Audit(const std::function<bool(const std::string&)> &exists, size_t max_examples, std::vector<std::string> &examples);
+
+	size_t GetCount();
+	/* Results of the last Audit() */
+	size_t GetCyclic();
+	size_t GetBroken();
+};
+
+extern AliasGraph aliases;
@@ -19,21 +19,35 @@
  ************************************************************************************/
 
 #include <random>
+#include <algorithm>
 #include <iterator>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <iostream>
+#include <thread>
 #include <sporks/regex.h>
 #include <sporks/database.h>
 #include <sporks/stringops.h>
+#include <sporks/outbound.h>
+#include <sporks/embeds.h>
 #include <fmt/format.h>
 #include <dpp/nlohmann/json.hpp>
 #include "backend.h"
+#include "factcache.h"
+#include "keyfilter.h"
+#include "factstore.h"
+#include "aliases.h"
+#include "factcount.h"
+#include "search.h"
+#include "keytrie.h"
+#include "replies.h"
 #include "infobot.h"
 
 using json = nlohmann::json;
 
 infostats stats;
+SingleFlight<std::string, infodef> factlookups;
 
 /* Infodef represents a definition from the database */
 infodef::infodef() : key(""), value(""), word(""), setby(""), whenset(0), locked(false), found(false) {
@@ -42,51 +56,6 @@ infodef::infodef() : key(""), value(""), word(""), setby(""), whenset(0), locked
 infodef::~infodef() {
 }
 
-infodef get_def(const std::string &key);
-uint64_t get_phrase_count();
-void set_def(std::string key, const std::string &value, const std::string &word, const std::string &setby, time_t when, bool locked);
-std::string expand(std::string str, const std::string &nick, time_t timeval, const std::string &mynick, const std::string &randuser);
-void del_def(const std::string &key);
-std::string getreply(std::string s, const std::string &delim = "|");
-bool locked(const std::string &key);
-std::string getreply(std::vector<std::string> v);
-
-/* Reply templates */
-std::map<std::string, std::vector<std::string>> replies = {
-
-	/* Positive replies to question: Response found */
-	{"replies",  {"I heard %k %w %v", "They say %k %w %v", "%k %w %v... I think", "someone said %k %w %v", "%k %w like, %v", "%k %w %v", "%k %w %v, maybe?", "%s once said %k %w %v"}},
-
-	/* Negative replies to question: No response found */
-	{"dontknow", {"Sorry %n I don't know what %k is.", "%k? no idea %n.", "I'm not a genius, %n...", "Its best to ask a real person about %k.", "Not a clue.", "Don't you know, %n?", "If i knew about %k i'd tell you.", "Never heard of %k", "%k isn't something im aware of", "%n, what are you jabbering about, fool?", "%n, i've not got any idea what %k is."}},
-
-	/* Negative replies: Response found, but refusing to overwrite it */
-	{"notnew",   {"but %k %w %v :(", "fool, %k %w %v :p", "%k already %w %v...", "Are you sure, %n? I am sure that %k %w %v!", "NO! %k %w %v!!!"}},
-
-	/* Confirmation that the bot has learned a phrase */
-	{"confirm",  {"Ok, %n", "Your wish is my command.", "Okay.", "Whatever...", "Gotcha.", "Ok.", "Right.", "If you say so.", "I understand", "Really? OK...", "Understood."}},
-
-	/* Rejection of a new phrase due to the existing phrase being locked */
-	{"locked",   {"You don't have the power, %n.", "No, I like that just the way it is.", "You can't edit that! The keyword '%k' has been locked against changes!"}},
-
-	/* Plaintext version of the "who told you about" embed for talkative mode */
-	{"heard", {"%s told me about %k on %d", "I learned that on %d, and i think it was %s that told me it.", "I think it was %s who said that, way back on %d...",  "%n: Back on %d, %s told me about %k"}},
-
-	/* Confirmation that the bot has deleted a phrase */
-	{"forgot",   {"I forgot %k", "%k is gone from my mind, %n", "As you wish.", "It's history.", "Done.", "%k is no more.", "Consider it gone.", "It's vanished." }}
-};
-
-/* Emoji to use in embeds for positive/negative feedback */
-std::map<std::string, std::string> emoji = {
-	{"replies", ""},
-	{"dontknow", "<:wc_rs:667695516737470494>"},
-	{"notnew", "<:wc_rs:667695516737470494>"},
-	{"confirm", ":white_check_mark:"},
-	{"locked", "<:wc_rs:667695516737470494>"},
-	{"forgot", ":white_check_mark:"},
-	{"heard", ":white_check_mark:"}
-};
-
 void copy_to_def(const infodef &source, infodef &dest)
 {
 	dest.found = source.found;
@@ -117,60 +86,26 @@ void InfobotModule::ProcessEmbed(const std::string &embed_json, int64_t channelI
 	}
 	catch (const std::exception &e) {
 		if (channel) {
-			if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-				bot->core->message_create(dpp::message(channel->id, "<:sporks_error:664735896251269130> I can't make an **embed** from this: ```js\n" + cleaned_json + "\n```**Error:** ``" + e.what() + "``"));
-				bot->sent_messages++;
-			}
+			bot->outbound->Send(dpp::message(channel->id, "<:sporks_error:664735896251269130> I can't make an **embed** from this: ```js\n" + cleaned_json + "\n```**Error:** ``" + e.what() + "``"), channel->guild_id);
 		}
 	}
 	if (channel) {
-		if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-			dpp::message m;
-			m.channel_id = channel->id;
-			m.embeds.push_back(dpp::embed(&embed));
-			bot->core->message_create(m);
-			bot->sent_messages++;
-		}
+		dpp::message m;
+		m.channel_id = channel->id;
+		m.embeds.push_back(dpp::embed(&embed));
+		bot->outbound->Send(m, channel->guild_id);
 	}
 }
 
-/* Make a string safe to send as a JSON literal */
-std::string escape_json(const std::string &s) {
-	std::ostringstream o;
-	for (auto c = s.cbegin(); c != s.cend(); c++) {
-		switch (*c) {
-		case '"': o << "\\\""; break;
-		case '\\': o << "\\\\"; break;
-		case '\b': o << "\\b"; break;
-		case '\f': o << "\\f"; break;
-		case '\n': o << "\\n"; break;
-		case '\r': o << "\\r"; break;
-		case '\t': o << "\\t"; break;
-		default:
-			if ('\x00' <= *c && *c <= '\x1f') {
-				o << "\\u"
-				  << std::hex << std::setw(4) << std::setfill('0') << (int)*c;
-			} else {
-				o << *c;
-			}
-		}
-	}
-	return o.str();
-}
-
 /* Send an embed containing one or more fields */
 void InfobotModule::EmbedWithFields(const std::string &title, std::map<std::string, std::string> fields, int64_t channelID)
 {
-	std::string json = "{\"title\":\"" + title + "\",\"color\":16767488,\"fields\":[";
-	for (auto v = fields.begin(); v != fields.end(); ++v) {
-		json += "{\"name\":\"" + v->first + "\",\"value\":\"" + v->second + "\",\"inline\":true}";
-		auto n = v;
-		if (++n != fields.end()) {
-			json += ",";
-		}
+	EmbedBuilder embed;
+	embed.Title(title).Footer();
+	for (auto & f : fields) {
+		embed.Field(f.first, f.second, true);
 	}
-	json += "],\"footer\":{\"link\":\"https://sporks.gg/\",\"text\":\"Powered by Sporks!\",\"icon_url\":\"https://www.sporks.gg/images/sporks_2020.png\"}}";
-	ProcessEmbed(json, channelID);
+	embed.Send(bot, channelID);
 }
 
 /* Infobot initialisation */
@@ -195,8 +130,8 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 {
 	/* Default reply level for the command is NOT_ADDRESSED which doesn't generate any feedback to the user */
 	reply_level level = NOT_ADDRESSED;
-	/* rpllist contains the name of the reply list to get the reply template from (see `replies` above) */
-	std::string rpllist = "";
+	/* rpllist is the reply list to get the reply template from (see reply_lists in replies.cpp) */
+	reply_list rpllist = rl_none;
 	infodef reply;
 	/* Regex for identifying direct questions, e.g. ends in '?' */
 	bool direct_question = (PCRE("[\\?!]$").Match(otext));
@@ -233,15 +168,15 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 					tm _tm;
 					gmtime_r(&reply.whenset, &_tm);
 					strftime(timestamp, sizeof(timestamp), "%H:%M:%S %d-%b-%Y", &_tm);
-					EmbedWithFields("Fact Information", {{"Key", escape_json(reply.key)}, {"Set By", escape_json(reply.setby)},{"Set Date", escape_json(timestamp)}, {"Value", "```" + escape_json(reply.value) + "```"}}, channelID);
+					EmbedWithFields("Fact Information", {{"Key", reply.key}, {"Set By", reply.setby},{"Set Date", timestamp}, {"Value", "```" + reply.value + "```"}}, channelID);
 					return "";
 				} else {
 					/* Not mentioned or key+reply too long, return plaintext */
-					rpllist = "heard";
+					rpllist = rl_heard;
 				}
 			} else {
 				reply.key = key;
-				rpllist = "dontknow";
+				rpllist = rl_dontknow;
 			}
 		}
 		// Forget command
@@ -251,16 +186,16 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 			if (reply.found) {
 				if (reply.locked) {
 					/* Fact is locked, don't delete it */
-					rpllist = "locked";
+					rpllist = rl_locked;
 				} else {
 					/* Fact is not locked, delete it and confirm */
 					del_def(key);
-					rpllist = "forgot";
+					rpllist = rl_forgot;
 				}
 			} else {
 				/* Fact didn't exist */
 				reply.key = key;
-				rpllist = "dontknow";
+				rpllist = rl_dontknow;
 			}
 		}
 		// status command
@@ -272,6 +207,36 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 			def.found = false;
 			return "";
 		}
+		// Search command, find facts by the words in them. "search for", so that facts starting with "search" can still be taught and asked
+		else if ((mentioned || talkative) && level >= ADDRESSED_BY_NICKNAME && PCRE("^search\\s+for\\s+(.+?)\\?*$", true).Match(text, matches)) {
+			if (factsearch.IsReady()) {
+				std::vector<std::string> found = factsearch.Search(matches[1], 10);
+				std::string list;
+				for (auto & k : found) {
+					list += (list.empty() ? "" : ", ") + std::string("``") + k + "``";
+				}
+				EmbedWithFields("Search Results", {{"Matching Facts", list.empty() ? "Nothing found" : list}}, channelID);
+			} else {
+				EmbedWithFields("Search Results", {{"Matching Facts", "Search isn't ready yet, try again later"}}, channelID);
+			}
+			def.found = false;
+			return "";
+		}
+		// Keys command, list facts by the start of their key. "keys starting with", so that facts starting with "keys" can still be taught and asked
+		else if ((mentioned || talkative) && level >= ADDRESSED_BY_NICKNAME && PCRE("^keys\\s+starting\\s+with\\s+(.+?)$", true).Match(text, matches)) {
+			if (factkeys.IsReady()) {
+				std::vector<std::string> found = factkeys.Complete(matches[1], 20);
+				std::string list;
+				for (auto & k : found) {
+					list += (list.empty() ? "" : ", ") + std::string("``") + k + "``";
+				}
+				EmbedWithFields("Keys", {{"Facts starting with " + matches[1], list.empty() ? "None" : list}}, channelID);
+			} else {
+				EmbedWithFields("Keys", {{"Facts starting with " + matches[1], "The key index isn't ready yet, try again later"}}, channelID);
+			}
+			def.found = false;
+			return "";
+		}
 		// Literal command, print out key and value with no parsing
 		else if (PCRE("^literal (.*)\\?*$", true).Match(text, matches)) {
 			std::string key = removepunct(matches[1]);
@@ -279,11 +244,10 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 			reply = get_def(key);
 			def.found = true;
 			if (reply.found) {
-				std::string e = escape_json(reply.value);
 				/* If bot is mentioned and key length and reply length short enough, send as a nice embed */
-				if ((mentioned || talkative) && e.length() < 1020 && reply.key.length() < 254) {
+				if ((mentioned || talkative) && reply.value.length() < 1018 && reply.key.length() < 254) {
 					/* Send a fancy embed if its not excessively too long */
-					EmbedWithFields("Literal Definition", {{"Key", escape_json(reply.key)}, {"Value", "```" + escape_json(reply.value) + "```"}}, channelID);
+					EmbedWithFields("Literal Definition", {{"Key", reply.key}, {"Value", "```" + reply.value + "```"}}, channelID);
 					return "";
 				} else {
 					/* Key or reply too long, or bot not mentioned, return plain text */
@@ -293,11 +257,11 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 			} else {
 				/* Key not found */
 				reply.key = key;
-				rpllist = "dontknow";
+				rpllist = rl_dontknow;
 			}
 		}
 		// Next option, someone is either adding a new phrase to the bot or editing an old one, a bit trickier...
-		else if ((PCRE("^(.*?)\\s+=(is|are|was|arent|aren't|can|can't|cant|will|has|had|r|might|may)=\\s+", true).Match(text, matches) || PCRE("^(.*?)\\s+(is|are|was|arent|aren't|can|can't|cant|will|has|had|r|might|may)\\s+", true).Match(text, matches)) && (rpllist == "")) {
+		else if ((PCRE("^(.*?)\\s+=(is|are|was|arent|aren't|can|can't|cant|will|has|had|r|might|may)=\\s+", true).Match(text, matches) || PCRE("^(.*?)\\s+(is|are|was|arent|aren't|can|can't|cant|will|has|had|r|might|may)\\s+", true).Match(text, matches)) && (rpllist == rl_none)) {
 			std::string key = removepunct(matches[1]);
 			std::string word = matches[2];
 			std::string value = text.substr(matches[0].length(), text.length() - matches[0].length());
@@ -312,12 +276,16 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 			reply = get_def(key);
 			
 			if (reply.locked) {
-				rpllist = "locked";
+				rpllist = rl_locked;
 			} else if (level == ADDRESSED_BY_NICKNAME_CORRECTION || reply.found == false) {
 				set_def(key, value, word, usernick, time(NULL), false);
 				stats.modcount++;
+				std::string alias_target;
+				if (AliasGraph::Parse(value, alias_target) && !aliases.Resolve(key, alias_target)) {
+					bot->core->log(dpp::ll_warning, fmt::format("Fact '{}' set by {} makes an alias loop", key, usernick));
+				}
 				if (level >= ADDRESSED_BY_NICKNAME) {
-					rpllist = "confirm";
+					rpllist = rl_confirm;
 				}
 			} else {
 				if (PCRE("^also\\s+(.*)$", true).Match(value, matches) || PCRE("^(.*)\\s(as well|too)$", true).Match(value, matches)) {
@@ -327,122 +295,109 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 					} else {
 						reply.value = reply.value + " or " + newvalue;
 					}
+					reply.parsed.reset();
 					set_def(key, reply.value, reply.word, usernick, time(NULL), false);
 					if (level >= ADDRESSED_BY_NICKNAME) {
-						rpllist = "confirm";
+						rpllist = rl_confirm;
 					}
 				} else if (lowercase(reply.value) != lowercase(value)) {
 					if (level >= ADDRESSED_BY_NICKNAME) {
-						rpllist = "notnew";
+						rpllist = rl_notnew;
 					}
 				}
 			}
 		}
 		
-		if (PCRE("(.*?)\\?*\\s*$", true).Match(text, matches) && rpllist == "") {
+		if (PCRE("(.*?)\\?*\\s*$", true).Match(text, matches) && rpllist == rl_none) {
 			std::string key = removepunct(matches[1]);
 			stats.qcount++;
 			reply = get_def(key);
 
 			if (reply.found) {
 				if (direct_question || level >= ADDRESSED_BY_NICKNAME /* did contain: || rand(15) > 13 */) {
-					rpllist = "replies";
+					rpllist = rl_replies;
 				}
 			} else if (level >= ADDRESSED_BY_NICKNAME) {
 				reply.key = key;
-				rpllist = "dontknow";
+				rpllist = rl_dontknow;
 			}
 		}
 	}
 	
-	/* Parse reply message from templates in replies map */
+	/* Parse reply message from templates in reply_lists */
 	
-	if (rpllist != "") {
+	if (rpllist != rl_none) {
 		bool repeat = false;
 		std::string s_reply = "";
+		std::string alias_target;
 		
 		do {
 			repeat = false;
-			s_reply = expand(getreply(replies[rpllist]), usernick, reply.whenset, mynick, randuser);
-
-			char timestr[256];
-			tm _tm;
-			gmtime_r(&reply.whenset, &_tm);
-			strftime(timestr, 255, "%c", &_tm);
-
-			s_reply = ReplaceString(s_reply, "%k", reply.key);
-			s_reply = ReplaceString(s_reply, "%w", reply.word);
-			s_reply = ReplaceString(s_reply, "%n", usernick);
-			s_reply = ReplaceString(s_reply, "%m", mynick);
-			s_reply = ReplaceString(s_reply, "%d", timestr);
-			s_reply = ReplaceString(s_reply, "%s", reply.setby);
-			s_reply = ReplaceString(s_reply, "%l", reply.locked ? "locked" : "unlocked");
 
 			// Gobble up empty reply
-			if (lowercase(reply.value) == "<reply>" && rpllist == "replies") {
+			if (lowercase(reply.value) == "<reply>" && rpllist == rl_replies) {
 				def.found = false;
 				return "";
 			}
 
-			if (rpllist == "replies" && PCRE("<alias>\\s*(.*)", true).Match(reply.value, matches)) {
-				std::string oldkey = reply.key;
-				reply.key = matches[1];
-				infodef r = get_def(reply.key);
-				if (!r.found) {
-					/* Broken alias */
+			if (rpllist == rl_replies && AliasGraph::Parse(reply.value, alias_target)) {
+				infodef r;
+				if (!resolve_alias(reply.key, reply.value, r)) {
+					/* Broken alias, or an alias loop */
 					def.found = false;
 					return "";
 				}
 				reply = r;
-				/* Prevent alias loops */
-				if (!PCRE("<alias>\\s*(.*)", true).Match(reply.value)) {
-					repeat = true;
-				}
+				repeat = true;
 			}
 		} while (repeat);
 
-		reply.value = getreply(reply.value);
+		std::shared_ptr<const parsed_value> parsed = parsed_value_of(reply);
+		const value_choice &choice = parsed->Pick();
+		reply.value = choice.text;
 
-		if (rpllist == "replies" && PCRE("<(reply|action|embed)>\\s*", true).Match(reply.value, matches)) {
-			std::string ml_reply = reply.value.substr(matches[0].length(), reply.value.length() - matches[0].length());
+		if (rpllist == rl_replies && choice.kind != vk_plain) {
 			/* Just a <reply>? bog off... */
-			if (trim(ml_reply) == "") {
+			if (trim(choice.body) == "") {
 				def.found = false;
 				return "";
 			}
 
-			if (matches[1] == "embed" && (mentioned || talkative)) {
-				ml_reply = expand(ml_reply, usernick, reply.whenset, mynick, randuser);
-				ProcessEmbed(ReplaceString(ml_reply, "<embed>", ""), channelID);
+			if (choice.kind == vk_embed && (mentioned || talkative)) {
+				ProcessEmbed(ReplaceString(choice.expanded.Render(usernick, reply.whenset, mynick, randuser), "<embed>", ""), channelID);
 				def.found = false;
 				return "";
 			}
 
-			reply.value = (lowercase(matches[1]) == "action") ? "*" + ml_reply + "*" : ml_reply;
-
-			std::string x = expand(ml_reply, usernick, reply.whenset, mynick, randuser);
-			if (x == "%v") {
-				def.found = false;
-				return "";
-			}
+			reply.value = (choice.kind == vk_action) ? "*" + choice.body + "*" : choice.body;
 
+			std::string x = choice.expanded.Render(usernick, reply.whenset, mynick, randuser);
 			copy_to_def(reply, def);
 			return x;
 		}
 
-		s_reply = ReplaceString(s_reply, "%v", reply.value);
+		char timestr[256];
+		tm _tm;
+		gmtime_r(&reply.whenset, &_tm);
+		strftime(timestr, 255, "%c", &_tm);
+
+		const std::string values[rs_count] = { reply.key, reply.word, usernick, mynick, timestr, reply.setby, reply.locked ? "locked" : "unlocked", reply.value };
+		s_reply = pick_reply(rpllist).Render(values);
 
 		if (s_reply == "%v" || s_reply == "") {
 			def.found = false;
 			return "";
 		}
 
+		if (rpllist == rl_dontknow) {
+			s_reply += suggest_facts(reply.key);
+		}
+
 		// If the bot is directly mentioned, we can answer with an embed.
 		// Otherwise it's plaintext all the way and it can be discarded if the channel
 		// isnt a talkative channel.
-		if (mentioned && rpllist != "replies") {
-			std::string json = "{\"color\":16767488,\"description\":\"" + emoji[rpllist] + " " + escape_json(s_reply) + "\"}";
-			ProcessEmbed(json, channelID);
+		if (mentioned && rpllist != rl_replies) {
+			EmbedBuilder().Description(reply_lists[rpllist].emoji + " " + s_reply).Send(bot, channelID);
 			def.found = false;
 			return "";
 		}
@@ -454,102 +409,184 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 	return "";
 }
 
-infodef get_def(const std::string &key)
+/* " Did you mean ...?" for a question with no answer, or an empty string. Keys spelt
+ * nearly the same come first, then facts which mention the same words.
+ */
+std::string suggest_facts(const std::string &key)
 {
-	infodef d;
-	db::resultset r = db::query("SELECT key_word, value, word, setby, whenset, locked FROM infobot WHERE key_word = '?'", {key});
-	if (r.size()) {
-		d.key = r[0]["key_word"];
-		d.value = r[0]["value"];
-		d.word = r[0]["word"];
-		d.setby = r[0]["setby"];
-		d.whenset = from_string<time_t>(r[0]["whenset"], std::dec);
-		d.locked = (r[0]["locked"] == "1");
-		d.found = true;
+	std::string normalised = normalise_key(key);
+	std::vector<std::string> candidates = factkeys.Nearest(normalised, normalised.length() > 5 ? 2 : 1, 3);
+	for (auto & k : factsearch.Search(key, 4)) {
+		candidates.push_back(normalise_key(k));
+	}
+	std::string suggestions;
+	size_t count = 0;
+	for (size_t i = 0; i < candidates.size() && count < 3; ++i) {
+		if (candidates[i] != normalised && std::find(candidates.begin(), candidates.begin() + i, candidates[i]) == candidates.begin() + i) {
+			suggestions += (suggestions.empty() ? "" : ", ") + candidates[i];
+			count++;
+		}
 	}
-	return d;
+	return suggestions.empty() ? "" : " Did you mean: " + suggestions + "?";
 }
 
-uint64_t get_phrase_count()
+/* Normalise a key the way MySQL compares key_word: case insensitive, trailing spaces ignored */
+std::string normalise_key(const std::string &key)
 {
-	/* Don't use `SELECT COUNT(*)` here. It will take seconds to complete, as opposed to `SHOW TABLE STATUS` which returns near-instantly. */
-	db::resultset r = db::query("show table status like '?'", {std::string("infobot")});
-	return r.size() > 0 ? from_string<uint64_t>(r[0]["Rows"], std::dec) : 0;
+	std::string k = lowercase(key);
+	k.erase(k.find_last_not_of(' ') + 1);
+	return k;
 }
 
-void set_def(std::string key, const std::string &value, const std::string &word, const std::string &setby, time_t when, bool locked)
+/**
+ * Walk every fact in key order, a batch at a time, passing each row to the callback.
+ * Uses keyset pagination so that each batch is a cheap range read on the primary key.
+ * Returns false if the callback asked to stop or a query failed.
+ */
+bool scan_facts(const std::string &columns, const std::function<bool(db::row&)> &callback)
 {
-	key = lowercase(key);
-	db::query("INSERT INTO infobot (key_word,value,word,setby,whenset,locked) VALUES ('?','?','?','?','?','?') ON DUPLICATE KEY UPDATE value = '?', word = '?', setby = '?', whenset = '?', locked = '?'",
-	{
-		key, value, word, setby, when, locked,
-		value, word, setby, when, locked
-	});
-
+	const size_t batch_size = 5000;
+	std::string last_key;
+	while (true) {
+		db::resultset r = db::query("SELECT " + columns + " FROM infobot WHERE key_word > '?' ORDER BY key_word LIMIT " + std::to_string(batch_size), {last_key});
+		if (!db::error().empty()) {
+			return false;
+		}
+		for (auto & row : r) {
+			if (!callback(row)) {
+				return false;
+			}
+		}
+		if (r.size() < batch_size) {
+			return true;
+		}
+		last_key = r.back()["key_word"];
+		/* Give other queries a turn at the database mutex */
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
 }
 
-void del_def(const std::string &key)
+infodef get_def(const std::string &key)
 {
-	db::query("DELETE FROM infobot WHERE key_word = '?'", {key});
+	infodef d;
+	uint64_t version;
+	if (!keyfilter.MightContain(key)) {
+		return d;
+	}
+	/* In snapshot mode every fact is in memory, but only keys which the store folds the same way
+	 * as MySQL can be found there. Keys in other scripts are looked up in MySQL as before.
+	 */
+	if (factstore.IsActive() && general_ci_exact(key)) {
+		return factstore.Get(key);
+	}
+	if (factcache.Get(key, d, version)) {
+		return d;
+	}
+	/* If another thread is already fetching this key from the database, wait for its answer rather than asking again */
+	return factlookups.Do(normalise_key(key), [&key, version]() {
+		infodef d;
+		db::resultset r = db::query("SELECT key_word, value, word, setby, whenset, locked FROM infobot WHERE key_word = '?'", {key});
+		if (r.size()) {
+			d.key = r[0]["key_word"];
+			d.value = r[0]["value"];
+			d.word = r[0]["word"];
+			d.setby = r[0]["setby"];
+			d.whenset = from_string<time_t>(r[0]["whenset"], std::dec);
+			d.locked = (r[0]["locked"] == "1");
+			d.found = true;
+		}
+		if (db::error().empty()) {
+			factcache.Fill(key, d, version);
+		}
+		return d;
+	});
 }
 
-std::string expand(std::string str, const std::string &nick, time_t timeval, const std::string &mynick, const std::string &randuser)
+/**
+ * Follow an alias to the fact at the end of its chain. The chain is walked in the alias
+ * graph, so normally only the final fact is fetched. If that turns out to be an alias the
+ * graph didn't know about, it is learned and the walk carries on from there.
+ * Returns false if the chain loops or leads to a fact that doesn't exist.
+ */
+bool resolve_alias(const std::string &key, const std::string &value, infodef &def)
 {
-	char timestr[256];
-	char currentstr[256];
-	tm _tm;
-	time_t now = time(NULL);
-	gmtime_r(&timeval, &_tm);
-	strftime(timestr, 255, "%c", &_tm);
-	strftime(currentstr, 255, "%c", localtime(&now));
-
-
-	str = ReplaceString(str, "<me>", mynick);
-	str = ReplaceString(str, "<who>", nick);
-	str = ReplaceString(str, "<random>", randuser);
-	str = ReplaceString(str, "<date>", std::string(timestr));
-	str = ReplaceString(str, "<now>", std::string(currentstr));
-
-	std::vector<std::string> m;
-	while (PCRE("<list:(.+?)>", true).Match(str, m)) {
-		std::string list = m[1];
-		std::string choice = getreply(m[1], ",");
-		str = ReplaceString(str, m[0], choice);
+	std::string target;
+	std::string current_key = key;
+	std::string current_value = value;
+	std::unordered_set<std::string> visited;
+	while (visited.insert(normalise_key(current_key)).second) {
+		aliases.Learn(current_key, current_value);
+		if (!aliases.Resolve(current_key, target)) {
+			return false;
+		}
+		def = get_def(target);
+		if (!def.found) {
+			return false;
+		}
+		std::string next;
+		if (!AliasGraph::Parse(def.value, next)) {
+			return true;
+		}
+		current_key = target;
+		current_value = def.value;
 	}
+	return false;
+}
 
-	if (str == "%v") {
-		return "";
-	}
-	return str;
+uint64_t get_phrase_count()
+{
+	return factcount.Get();
 }
 
-std::string getreply(std::vector<std::string> v)
+void set_def(std::string key, const std::string &value, const std::string &word, const std::string &setby, time_t when, bool locked)
 {
-	auto randIt = v.begin();
-	if (v.begin() != v.end()) {
-		std::advance(randIt, std::rand() % v.size());
-		return *randIt;
+	key = lowercase(key);
+	/* Added both before and after the insert, so that neither the filter in use nor one being rebuilt can miss it */
+	keyfilter.Add(key);
+	db::query("INSERT INTO infobot (key_word,value,word,setby,whenset,locked) VALUES ('?','?','?','?','?','?') ON DUPLICATE KEY UPDATE value = '?', word = '?', setby = '?', whenset = '?', locked = '?'",
+	{
+		key, value, word, setby, when, locked,
+		value, word, setby, when, locked
+	});
+
+	if (db::error().empty()) {
+		/* ON DUPLICATE KEY UPDATE reports one row for an insert, two for an update */
+		if (db::affected_rows() == 1) {
+			factcount.Adjust(key, 1);
+		}
+		infodef d;
+		d.found = true;
+		d.key = key;
+		d.value = value;
+		d.word = word;
+		d.setby = setby;
+		d.whenset = when;
+		d.locked = locked;
+		factcache.Put(key, d);
+		factstore.Put(d);
+		keyfilter.Add(key);
+		aliases.Learn(key, value);
+		factsearch.Put(key, value);
+		factkeys.Put(key);
 	} else {
-		return "";
+		factcache.Erase(key);
 	}
 }
 
-std::string getreply(std::string s, const std::string &delim)
+void del_def(const std::string &key)
 {
-	size_t pos = 0;
-	std::vector<std::string> v;
-	std::string token;
-	while ((pos = s.find(delim)) != std::string::npos) {
-		token = s.substr(0, pos);
-		v.push_back(token);
-		s.erase(0, pos + delim.length());
-	}
-	auto randIt = v.begin();
-	if (v.begin() != v.end()) {
-		std::advance(randIt, std::rand() % v.size());
-		return *randIt;
+	db::query("DELETE FROM infobot WHERE key_word = '?'", {key});
+	if (db::error().empty()) {
+		factcache.Forget(key);
+		if (db::affected_rows() > 0) {
+			factcount.Adjust(key, -1);
+		}
+		factstore.Erase(key);
+		aliases.Forget(key);
+		factsearch.Erase(key);
+		factkeys.Erase(key);
 	} else {
-		return s;
+		factcache.Erase(key);
 	}
 }
 
@@ -21,6 +21,11 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <sporks/database.h>
+#include "singleflight.h"
 
 enum reply_level {
 	NOT_ADDRESSED = 0,
@@ -30,10 +35,12 @@ enum reply_level {
 
 struct infostats {
 	time_t startup;
-	uint64_t modcount;
-	uint64_t qcount;
+	std::atomic<uint64_t> modcount;
+	std::atomic<uint64_t> qcount;
 };
 
+struct parsed_value;
+
 struct infodef {
 	bool found;
 	std::string key;
@@ -42,8 +49,22 @@ struct infodef {
 	std::string setby;
 	time_t whenset;
 	bool locked;
+	/* value split into its alternatives, shared by copies. Filled in by the fact cache, see replies.h */
+	std::shared_ptr<const parsed_value> parsed;
 
 	infodef();
 	~infodef();
 };
 
+infodef get_def(const std::string &key);
+std::string normalise_key(const std::string &key);
+std::string suggest_facts(const std::string &key);
+bool resolve_alias(const std::string &key, const std::string &value, infodef &def);
+bool scan_facts(const std::string &columns, const std::function<bool(db::row&)> &callback);
+uint64_t get_phrase_count();
+void set_def(std::string key, const std::string &value, const std::string &word, const std::string &setby, time_t when, bool locked);
+void del_def(const std::string &key);
+bool locked(const std::string &key);
+
+/* Database lookups for facts currently in progress, keyed by normalise_key() */
+extern SingleFlight<std::string, infodef> factlookups;
@@ -0,0 +1,178 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <functional>
+#include <sporks/stringops.h>
+#include "factcache.h"
+#include "replies.h"
+
+/* 200,000 facts at a few hundred bytes each, expiring after ten minutes */
+FactCache factcache(200000, 600);
+
+FactCache::FactCache(size_t max_entries, time_t _ttl) : max_per_shard(max_entries / shard_count), ttl(_ttl), hits(0), misses(0)
+{
+	if (max_per_shard == 0) {
+		max_per_shard = 1;
+	}
+}
+
+/* A copy of def with its value parsed, done before taking a shard lock */
+static infodef with_parsed_value(const infodef &def)
+{
+	infodef d = def;
+	if (d.found && !d.parsed) {
+		d.parsed = parse_value(d.value);
+	}
+	return d;
+}
+
+FactCache::shard& FactCache::ShardFor(const std::string &normalised_key)
+{
+	return shards[std::hash<std::string>()(normalised_key) % shard_count];
+}
+
+void FactCache::Store(shard &s, const std::string &normalised_key, const infodef &def)
+{
+	auto i = s.entries.find(normalised_key);
+	if (i != s.entries.end()) {
+		i->second.def = def;
+		i->second.fetched = time(NULL);
+		s.lru.splice(s.lru.begin(), s.lru, i->second.lru_pos);
+		return;
+	}
+	if (s.entries.size() >= max_per_shard) {
+		/* Evict least recently used */
+		s.entries.erase(s.lru.back());
+		s.lru.pop_back();
+	}
+	s.lru.push_front(normalised_key);
+	s.entries[normalised_key] = { def, time(NULL), s.lru.begin() };
+}
+
+bool FactCache::Get(const std::string &key, infodef &def, uint64_t &version)
+{
+	std::string k = normalise_key(key);
+	shard &s = ShardFor(k);
+	std::lock_guard<std::mutex> lock(s.mtx);
+	version = s.writes;
+	auto i = s.entries.find(k);
+	if (i == s.entries.end()) {
+		misses++;
+		return false;
+	}
+	if (time(NULL) - i->second.fetched > ttl) {
+		/* Expired, drop it so the caller refreshes from the database */
+		s.lru.erase(i->second.lru_pos);
+		s.entries.erase(i);
+		misses++;
+		return false;
+	}
+	s.lru.splice(s.lru.begin(), s.lru, i->second.lru_pos);
+	def = i->second.def;
+	hits++;
+	return true;
+}
+
+void FactCache::Fill(const std::string &key, const infodef &def, uint64_t version)
+{
+	std::string k = normalise_key(key);
+	infodef d = with_parsed_value(def);
+	shard &s = ShardFor(k);
+	std::lock_guard<std::mutex> lock(s.mtx);
+	if (s.writes == version) {
+		Store(s, k, d);
+	}
+}
+
+void FactCache::Put(const std::string &key, const infodef &def)
+{
+	std::string k = normalise_key(key);
+	infodef d = with_parsed_value(def);
+	shard &s = ShardFor(k);
+	std::lock_guard<std::mutex> lock(s.mtx);
+	s.writes++;
+	Store(s, k, d);
+}
+
+void FactCache::Forget(const std::string &key)
+{
+	std::string k = normalise_key(key);
+	shard &s = ShardFor(k);
+	std::lock_guard<std::mutex> lock(s.mtx);
+	/* Keep a negative entry, it is likely to be asked for again */
+	s.writes++;
+	Store(s, k, infodef());
+}
+
+void FactCache::Erase(const std::string &key)
+{
+	std::string k = normalise_key(key);
+	shard &s = ShardFor(k);
+	std::lock_guard<std::mutex> lock(s.mtx);
+	/* Counted as a write, so that a lookup already in progress doesn't fill it back in */
+	s.writes++;
+	auto i = s.entries.find(k);
+	if (i != s.entries.end()) {
+		s.lru.erase(i->second.lru_pos);
+		s.entries.erase(i);
+	}
+}
+
+void FactCache::SetLocked(const std::string &key, bool locked)
+{
+	std::string k = normalise_key(key);
+	shard &s = ShardFor(k);
+	std::lock_guard<std::mutex> lock(s.mtx);
+	s.writes++;
+	auto i = s.entries.find(k);
+	if (i != s.entries.end()) {
+		i->second.def.locked = locked;
+	}
+}
+
+void FactCache::Clear()
+{
+	for (size_t n = 0; n < shard_count; ++n) {
+		std::lock_guard<std::mutex> lock(shards[n].mtx);
+		shards[n].writes++;
+		shards[n].entries.clear();
+		shards[n].lru.clear();
+	}
+}
+
+uint64_t FactCache::GetHits()
+{
+	return hits;
+}
+
+uint64_t FactCache::GetMisses()
+{
+	return misses;
+}
+
+size_t FactCache::GetSize()
+{
+	size_t total = 0;
+	for (size_t n = 0; n < shard_count; ++n) {
+		std::lock_guard<std::mutex> lock(shards[n].mtx);
+		total += shards[n].entries.size();
+	}
+	return total;
+}
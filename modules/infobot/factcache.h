@@ -0,0 +1,108 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include "backend.h"
+
+/**
+ * A bounded LRU cache of infobot facts, sitting in front of get_def().
+ *
+ * Keys are normalised by normalise_key() so that "Foo" and "foo " share one entry. Negative
+ * results are cached too, as most lines seen in a channel are not facts.
+ *
+ * The cache is split into shards, each with its own mutex and LRU list, so that
+ * concurrent lookups of different keys rarely contend. Entries also expire after
+ * a fixed time, so that any change made to the table outside of the bot is picked
+ * up eventually. Found facts are stored with their value already split into its
+ * reply alternatives (infodef::parsed), so that this is done once per fetch.
+ */
+class FactCache {
+
+	struct entry {
+		infodef def;
+		time_t fetched;
+		std::list<std::string>::iterator lru_pos;
+	};
+
+	struct shard {
+		std::mutex mtx;
+		std::unordered_map<std::string, entry> entries;
+		/* Most recently used at the front */
+		std::list<std::string> lru;
+		/* Bumped on every write, so that a slow database lookup can't overwrite a newer value */
+		uint64_t writes = 0;
+	};
+
+	static constexpr size_t shard_count = 16;
+
+	shard shards[shard_count];
+	size_t max_per_shard;
+	time_t ttl;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+
+	shard& ShardFor(const std::string &normalised_key);
+
+	/* Insert or replace an entry, caller must hold the shard mutex */
+	void Store(shard &s, const std::string &normalised_key, const infodef &def);
+
+public:
+	/* max_entries is the total across all shards, ttl is in seconds */
+	FactCache(size_t max_entries, time_t ttl);
+
+	/* Fetch a fact. Returns false on a miss, in which case def is untouched and
+	 * version is set to the value to pass to Fill() after querying the database.
+	 */
+	bool Get(const std::string &key, infodef &def, uint64_t &version);
+
+	/* Store the result of a database lookup (found or not), unless the key was
+	 * written to since the Get() which returned version.
+	 */
+	void Fill(const std::string &key, const infodef &def, uint64_t version);
+
+	/* Store a fact which has just been written to the database */
+	void Put(const std::string &key, const infodef &def);
+
+	/* Record that a fact no longer exists */
+	void Forget(const std::string &key);
+
+	/* Drop whatever is cached for a fact, when a failed write leaves its state in the database unknown */
+	void Erase(const std::string &key);
+
+	/* Change the locked state of a cached fact */
+	void SetLocked(const std::string &key, bool locked);
+
+	/* Empty the cache */
+	void Clear();
+
+	uint64_t GetHits();
+	uint64_t GetMisses();
+	size_t GetSize();
+};
+
+/* The cache used by get_def(), set_def() and del_def() */
+extern FactCache factcache;
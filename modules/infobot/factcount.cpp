@@ -0,0 +1,123 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <string>
+#include <chrono>
+#include <thread>
+#include <sporks/database.h>
+#include <sporks/stringops.h>
+#include "backend.h"
+#include "factstore.h"
+#include "factcount.h"
+
+FactCounter factcount;
+
+/* Keys counted by each query of Reconcile() */
+static constexpr size_t count_batch_size = 50000;
+
+FactCounter::FactCounter() : count(0), exact(false), counting(false), passed_adjustments(0)
+{
+}
+
+void FactCounter::Seed()
+{
+	uint64_t rows = 0;
+	bool snapshot = factstore.IsActive();
+	if (snapshot) {
+		rows = factstore.Count();
+	} else {
+		db::resultset r = db::query("show table status like '?'", {std::string("infobot")});
+		rows = r.size() > 0 ? from_string<uint64_t>(r[0]["Rows"], std::dec) : 0;
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	count = rows;
+	exact = snapshot;
+}
+
+void FactCounter::Adjust(const std::string &key, int64_t delta)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	count += delta;
+	/* Keys after the cursor will be seen by the rest of the count */
+	if (counting && FactStore::collate_key(key) <= cursor) {
+		passed_adjustments += delta;
+	}
+}
+
+bool FactCounter::Reconcile(const std::atomic<bool> &terminating)
+{
+	/* The snapshot already knows exactly */
+	if (factstore.IsActive()) {
+		std::lock_guard<std::mutex> lock(mtx);
+		count = factstore.Count();
+		exact = true;
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		counting = true;
+		cursor.clear();
+		passed_adjustments = 0;
+	}
+
+	int64_t total = 0;
+	std::string last_key;
+	bool complete = false;
+	while (!terminating) {
+		db::resultset r = db::query("SELECT COUNT(*) AS n, MAX(key_word) AS last_key FROM (SELECT key_word FROM infobot WHERE key_word > '?' ORDER BY key_word LIMIT " + std::to_string(count_batch_size) + ") AS batch", {last_key});
+		if (!db::error().empty() || r.empty()) {
+			break;
+		}
+		uint64_t n = from_string<uint64_t>(r[0]["n"], std::dec);
+		total += n;
+		last_key = r[0]["last_key"];
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			cursor = FactStore::collate_key(last_key);
+		}
+		if (n < count_batch_size) {
+			complete = true;
+			break;
+		}
+		/* Give other queries a turn at the database mutex */
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	std::lock_guard<std::mutex> lock(mtx);
+	counting = false;
+	if (complete) {
+		count = total + passed_adjustments;
+		exact = true;
+	}
+	return complete;
+}
+
+uint64_t FactCounter::Get()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return count > 0 ? count : 0;
+}
+
+bool FactCounter::IsExact()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return exact;
+}
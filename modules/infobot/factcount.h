@@ -0,0 +1,67 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Number of facts in the infobot table, kept in memory so that nothing needs to ask
+ * MySQL for it. SHOW TABLE STATUS and COUNT(*) are both slow on a large InnoDB table.
+ *
+ * Seed() starts the count from the table statistics, which are approximate. set_def()
+ * and del_def() adjust it as facts are added and removed, and Reconcile() replaces it
+ * with an exact count every so often, taken a batch of keys at a time so that no one
+ * query holds the database for long.
+ */
+class FactCounter {
+
+	std::mutex mtx;
+	int64_t count;
+	bool exact;
+
+	/* While Reconcile() runs: collate_key() of the last key counted so far, and the
+	 * adjustments to keys at or before it, which the count has already passed.
+	 */
+	bool counting;
+	std::string cursor;
+	int64_t passed_adjustments;
+
+public:
+	FactCounter();
+
+	/* Set the starting count from the table statistics */
+	void Seed();
+
+	/* Record a fact added (+1) or removed (-1) */
+	void Adjust(const std::string &key, int64_t delta);
+
+	/* Count the table exactly. Returns false if a query failed or terminating was set */
+	bool Reconcile(const std::atomic<bool> &terminating);
+
+	uint64_t Get();
+
+	/* False until the first Reconcile() completes */
+	bool IsExact();
+};
+
+extern FactCounter factcount;
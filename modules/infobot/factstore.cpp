@@ -0,0 +1,772 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sporks/stringops.h>
+#include <sporks/database.h>
+#include "factstore.h"
+
+FactStore factstore;
+
+namespace {
+
+	const char snapshot_magic[8] = { 'S', 'P', 'K', 'F', 'A', 'C', 'T', 'S' };
+	const uint32_t snapshot_version = 2;
+
+	/* All offsets are from the start of the file */
+	struct file_header {
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+		uint64_t fact_count;
+		uint64_t intern_count;
+		uint64_t arena_offset;
+		uint64_t arena_size;
+		uint64_t intern_offset;
+		uint64_t index_offset;
+		int64_t created;
+	};
+
+	struct intern_entry {
+		uint64_t offset;
+		uint64_t length;
+	};
+
+	/* One fact. The index is an array of these sorted by the string at key_offset */
+	struct fact_record {
+		uint64_t key_offset;
+		uint64_t original_offset;
+		uint64_t value_offset;
+		uint32_t key_length;
+		uint32_t original_length;
+		uint32_t value_length;
+		uint32_t word_id;
+		uint32_t setby_id;
+		uint32_t flags;
+		int64_t whenset;
+	};
+
+	static_assert(sizeof(fact_record) == 56, "fact_record must have no padding");
+
+	const uint32_t flag_locked = 1;
+
+	struct journal_entry {
+		uint8_t deleted;
+		uint8_t locked;
+		uint16_t reserved;
+		uint32_t key_length;
+		uint32_t value_length;
+		uint32_t word_length;
+		uint32_t setby_length;
+		uint32_t reserved2;
+		int64_t whenset;
+	};
+
+	/* Copy a file's contents onto the end of another, used to put a journal back after a failed merge */
+	bool append_file(const std::string &from, const std::string &to)
+	{
+		FILE* in = fopen(from.c_str(), "rb");
+		if (!in) {
+			return true;
+		}
+		FILE* out = fopen(to.c_str(), "ab");
+		if (!out) {
+			fclose(in);
+			return false;
+		}
+		char buffer[65536];
+		size_t n;
+		bool ok = true;
+		while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+			ok = ok && fwrite(buffer, 1, n, out) == n;
+		}
+		fclose(in);
+		ok = (fclose(out) == 0) && ok;
+		return ok;
+	}
+
+	/**
+	 * Writes a snapshot file. Strings are appended to the arena as facts are added,
+	 * the index and intern table are held in memory and written at the end.
+	 */
+	class SnapshotWriter {
+		std::string filename;
+		FILE* f;
+		bool ok;
+		uint64_t arena_size;
+		std::vector<fact_record> index;
+		std::unordered_map<std::string, uint32_t> intern_ids;
+		std::vector<intern_entry> interns;
+
+		uint64_t AddString(const std::string &s) {
+			uint64_t offset = sizeof(file_header) + arena_size;
+			if (s.length() && fwrite(s.data(), 1, s.length(), f) != s.length()) {
+				ok = false;
+			}
+			arena_size += s.length();
+			return offset;
+		}
+
+		uint32_t Intern(const std::string &s) {
+			auto i = intern_ids.find(s);
+			if (i != intern_ids.end()) {
+				return i->second;
+			}
+			uint32_t id = interns.size();
+			interns.push_back({ AddString(s), s.length() });
+			intern_ids[s] = id;
+			return id;
+		}
+
+	public:
+		SnapshotWriter(const std::string &_filename) : filename(_filename), ok(true), arena_size(0) {
+			f = fopen(filename.c_str(), "w+b");
+			if (!f) {
+				ok = false;
+				return;
+			}
+			/* Header is filled in by Finish() */
+			file_header blank = {};
+			ok = fwrite(&blank, sizeof(blank), 1, f) == 1;
+		}
+
+		~SnapshotWriter() {
+			if (f) {
+				fclose(f);
+			}
+			if (!ok) {
+				unlink(filename.c_str());
+			}
+		}
+
+		bool IsOK() {
+			return ok;
+		}
+
+		void Add(const std::string &ckey, const infodef &def) {
+			if (!ok || ckey.length() > UINT32_MAX || def.key.length() > UINT32_MAX || def.value.length() > UINT32_MAX) {
+				return;
+			}
+			fact_record r = {};
+			r.key_offset = AddString(ckey);
+			r.key_length = ckey.length();
+			if (def.key == ckey) {
+				r.original_offset = r.key_offset;
+			} else {
+				r.original_offset = AddString(def.key);
+			}
+			r.original_length = def.key.length();
+			r.value_offset = AddString(def.value);
+			r.value_length = def.value.length();
+			r.word_id = Intern(def.word);
+			r.setby_id = Intern(def.setby);
+			r.flags = def.locked ? flag_locked : 0;
+			r.whenset = def.whenset;
+			index.push_back(r);
+		}
+
+		/* Write the index and header. If the facts weren't added in key order, sort them first */
+		bool Finish(bool sorted, time_t created) {
+			if (!ok || fflush(f) != 0) {
+				ok = false;
+				return false;
+			}
+			uint64_t arena_end = sizeof(file_header) + arena_size;
+			if (!sorted && index.size() > 1) {
+				/* The keys are only on disk, so map what has been written so far to compare them */
+				void* map = mmap(nullptr, arena_end, PROT_READ, MAP_SHARED, fileno(f), 0);
+				if (map == MAP_FAILED) {
+					ok = false;
+					return false;
+				}
+				const char* base = (const char*)map;
+				auto key = [base](const fact_record &r) {
+					return std::string_view(base + r.key_offset, r.key_length);
+				};
+				std::sort(index.begin(), index.end(), [&key](const fact_record &a, const fact_record &b) {
+					return key(a) < key(b);
+				});
+				/* Two different key_words can't collate the same in MySQL, but make sure */
+				index.erase(std::unique(index.begin(), index.end(), [&key](const fact_record &a, const fact_record &b) {
+					return key(a) == key(b);
+				}), index.end());
+				munmap(map, arena_end);
+			}
+
+			file_header h = {};
+			memcpy(h.magic, snapshot_magic, sizeof(h.magic));
+			h.version = snapshot_version;
+			h.record_size = sizeof(fact_record);
+			h.fact_count = index.size();
+			h.intern_count = interns.size();
+			h.arena_offset = sizeof(file_header);
+			h.arena_size = arena_size;
+			/* Keep the tables 8 byte aligned */
+			uint64_t padding = (8 - (arena_end % 8)) % 8;
+			const char zeroes[8] = {};
+			h.intern_offset = arena_end + padding;
+			h.index_offset = h.intern_offset + interns.size() * sizeof(intern_entry);
+			h.created = created;
+
+			ok = (fwrite(zeroes, 1, padding, f) == padding)
+				&& (interns.empty() || fwrite(interns.data(), sizeof(intern_entry), interns.size(), f) == interns.size())
+				&& (index.empty() || fwrite(index.data(), sizeof(fact_record), index.size(), f) == index.size())
+				&& fseek(f, 0, SEEK_SET) == 0
+				&& fwrite(&h, sizeof(h), 1, f) == 1
+				&& fflush(f) == 0
+				&& fsync(fileno(f)) == 0;
+			ok = (fclose(f) == 0) && ok;
+			f = nullptr;
+			return ok;
+		}
+	};
+};
+
+/**
+ * A read-only, mmap()ed snapshot file
+ */
+class FactStore::Snapshot {
+	int fd;
+	const char* base;
+	size_t size;
+	const file_header* header;
+	const fact_record* index;
+	const intern_entry* interns;
+
+public:
+	Snapshot() : fd(-1), base(nullptr), size(0), header(nullptr), index(nullptr), interns(nullptr) {
+	}
+
+	~Snapshot() {
+		if (base) {
+			munmap((void*)base, size);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	/* Map a snapshot file and check that everything in it lies within the file */
+	bool Open(const std::string &filename) {
+		struct stat st;
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(file_header)) {
+			return false;
+		}
+		size = st.st_size;
+		void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			return false;
+		}
+		base = (const char*)map;
+		header = (const file_header*)base;
+		if (memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header->version != snapshot_version || header->record_size != sizeof(fact_record)) {
+			return false;
+		}
+		uint64_t arena_end = header->arena_offset + header->arena_size;
+		if (arena_end > size || arena_end < header->arena_offset || header->intern_offset % 8 || header->index_offset % 8
+			|| header->intern_count > size / sizeof(intern_entry) || header->fact_count > size / sizeof(fact_record)
+			|| header->intern_offset + header->intern_count * sizeof(intern_entry) > size
+			|| header->index_offset + header->fact_count * sizeof(fact_record) > size) {
+			return false;
+		}
+		interns = (const intern_entry*)(base + header->intern_offset);
+		index = (const fact_record*)(base + header->index_offset);
+		auto in_arena = [this, arena_end](uint64_t offset, uint64_t length) {
+			return offset >= header->arena_offset && offset + length <= arena_end && offset + length >= offset;
+		};
+		for (uint64_t i = 0; i < header->intern_count; ++i) {
+			if (!in_arena(interns[i].offset, interns[i].length)) {
+				return false;
+			}
+		}
+		for (uint64_t i = 0; i < header->fact_count; ++i) {
+			const fact_record &r = index[i];
+			if (!in_arena(r.key_offset, r.key_length) || !in_arena(r.original_offset, r.original_length) || !in_arena(r.value_offset, r.value_length)
+				|| r.word_id >= header->intern_count || r.setby_id >= header->intern_count) {
+				return false;
+			}
+		}
+		/* Facts are read in a random order, read-ahead would just waste memory */
+		madvise(map, size, MADV_RANDOM);
+		return true;
+	}
+
+	uint64_t Count() const {
+		return header->fact_count;
+	}
+
+	time_t Created() const {
+		return header->created;
+	}
+
+	std::string_view Key(uint64_t i) const {
+		return std::string_view(base + index[i].key_offset, index[i].key_length);
+	}
+
+	/* Binary search for a collated key, returns nullptr if not present */
+	const fact_record* Find(const std::string &ckey) const {
+		uint64_t low = 0, high = header->fact_count;
+		std::string_view k(ckey);
+		while (low < high) {
+			uint64_t mid = low + (high - low) / 2;
+			if (Key(mid) < k) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		return (low < header->fact_count && Key(low) == k) ? &index[low] : nullptr;
+	}
+
+	infodef Materialise(uint64_t i) const {
+		return Materialise(index[i]);
+	}
+
+	infodef Materialise(const fact_record &r) const {
+		infodef d;
+		d.found = true;
+		d.key = std::string(base + r.original_offset, r.original_length);
+		d.value = std::string(base + r.value_offset, r.value_length);
+		d.word = std::string(base + interns[r.word_id].offset, interns[r.word_id].length);
+		d.setby = std::string(base + interns[r.setby_id].offset, interns[r.setby_id].length);
+		d.whenset = r.whenset;
+		d.locked = (r.flags & flag_locked);
+		return d;
+	}
+};
+
+FactStore::FactStore() : enabled(false), count_adjust(0), sequence(0), journal(nullptr), generation(0)
+{
+}
+
+FactStore::~FactStore()
+{
+	if (journal) {
+		fclose(journal);
+	}
+}
+
+std::string FactStore::collate_key(const std::string &key)
+{
+	return general_ci_fold(key);
+}
+
+void FactStore::Enable(const std::string &snapshot_path)
+{
+	std::unique_lock lock(mtx);
+	path = snapshot_path;
+	enabled = true;
+
+	auto s = std::make_shared<Snapshot>();
+	if (s->Open(path)) {
+		snapshot = s;
+	}
+	/* A .merging journal is left behind if the bot stopped part way through a merge */
+	ReplayJournal(path + ".merging");
+	ReplayJournal(path + ".journal");
+	journal = fopen((path + ".journal").c_str(), "ab");
+	RecalculateAdjust();
+}
+
+bool FactStore::IsEnabled() const
+{
+	return enabled;
+}
+
+bool FactStore::IsActive() const
+{
+	std::shared_lock lock(mtx);
+	return snapshot != nullptr;
+}
+
+infodef FactStore::Get(const std::string &key) const
+{
+	std::string ckey = collate_key(key);
+	std::shared_lock lock(mtx);
+	auto i = delta.find(ckey);
+	if (i != delta.end()) {
+		return i->second.deleted ? infodef() : i->second.def;
+	}
+	if (snapshot) {
+		const fact_record* r = snapshot->Find(ckey);
+		if (r) {
+			return snapshot->Materialise(*r);
+		}
+	}
+	return infodef();
+}
+
+uint64_t FactStore::Count() const
+{
+	std::shared_lock lock(mtx);
+	int64_t total = (snapshot ? snapshot->Count() : 0) + count_adjust;
+	return total > 0 ? total : 0;
+}
+
+time_t FactStore::GetSnapshotTime() const
+{
+	std::shared_lock lock(mtx);
+	return snapshot ? snapshot->Created() : 0;
+}
+
+size_t FactStore::GetDeltaSize() const
+{
+	std::shared_lock lock(mtx);
+	return delta.size();
+}
+
+void FactStore::Apply(const std::string &ckey, const infodef &def, bool deleted)
+{
+	bool existed;
+	auto i = delta.find(ckey);
+	if (i != delta.end()) {
+		existed = !i->second.deleted;
+	} else {
+		existed = snapshot && snapshot->Find(ckey);
+	}
+	count_adjust += (deleted ? 0 : 1) - (existed ? 1 : 0);
+	delta[ckey] = { def, deleted, ++sequence };
+}
+
+void FactStore::RecalculateAdjust()
+{
+	count_adjust = 0;
+	for (auto & d : delta) {
+		bool existed = snapshot && snapshot->Find(d.first);
+		count_adjust += (d.second.deleted ? 0 : 1) - (existed ? 1 : 0);
+	}
+}
+
+void FactStore::Journal(const infodef &def, bool deleted)
+{
+	if (!journal) {
+		return;
+	}
+	journal_entry e = {};
+	e.deleted = deleted;
+	e.locked = def.locked;
+	e.key_length = def.key.length();
+	e.value_length = def.value.length();
+	e.word_length = def.word.length();
+	e.setby_length = def.setby.length();
+	e.whenset = def.whenset;
+	bool ok = fwrite(&e, sizeof(e), 1, journal) == 1 &&
+		fwrite(def.key.data(), 1, def.key.length(), journal) == def.key.length() &&
+		fwrite(def.value.data(), 1, def.value.length(), journal) == def.value.length() &&
+		fwrite(def.word.data(), 1, def.word.length(), journal) == def.word.length() &&
+		fwrite(def.setby.data(), 1, def.setby.length(), journal) == def.setby.length() &&
+		fflush(journal) == 0;
+	if (!ok) {
+		Deactivate();
+	}
+}
+
+void FactStore::Deactivate()
+{
+	/* Without the change just made the snapshot is stale, so it isn't used again, even after a restart.
+	 * The journal only describes changes to that snapshot, so it goes too, and stays closed until the
+	 * maintenance thread rebuilds the snapshot. Reads go to MySQL until then.
+	 */
+	fclose(journal);
+	journal = nullptr;
+	unlink((path + ".journal").c_str());
+	snapshot.reset();
+	unlink(path.c_str());
+	delta.clear();
+	count_adjust = 0;
+	/* A merge or rebuild already running was started from what has just been thrown away */
+	generation++;
+}
+
+void FactStore::ReplayJournal(const std::string &filename)
+{
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (!f) {
+		return;
+	}
+	journal_entry e;
+	/* A short read means the bot stopped part way through writing an entry, ignore it */
+	while (fread(&e, sizeof(e), 1, f) == 1) {
+		uint64_t length = (uint64_t)e.key_length + e.value_length + e.word_length + e.setby_length;
+		if (length > 64 * 1024 * 1024) {
+			break;
+		}
+		std::string data(length, '\0');
+		if (length && fread(&data[0], 1, length, f) != length) {
+			break;
+		}
+		infodef d;
+		d.key = data.substr(0, e.key_length);
+		d.value = data.substr(e.key_length, e.value_length);
+		d.word = data.substr(e.key_length + e.value_length, e.word_length);
+		d.setby = data.substr(e.key_length + e.value_length + e.word_length, e.setby_length);
+		d.whenset = e.whenset;
+		d.locked = e.locked;
+		d.found = !e.deleted;
+		Apply(collate_key(d.key), d, e.deleted);
+	}
+	fclose(f);
+}
+
+void FactStore::Put(const infodef &def)
+{
+	if (!enabled) {
+		return;
+	}
+	std::string ckey = collate_key(def.key);
+	std::unique_lock lock(mtx);
+	Apply(ckey, def, false);
+	Journal(def, false);
+}
+
+void FactStore::Erase(const std::string &key)
+{
+	if (!enabled) {
+		return;
+	}
+	infodef d;
+	d.key = key;
+	std::string ckey = collate_key(key);
+	std::unique_lock lock(mtx);
+	Apply(ckey, d, true);
+	Journal(d, true);
+}
+
+void FactStore::SetLocked(const std::string &key, bool locked)
+{
+	if (!enabled) {
+		return;
+	}
+	std::string ckey = collate_key(key);
+	std::unique_lock lock(mtx);
+	infodef d;
+	auto i = delta.find(ckey);
+	if (i != delta.end()) {
+		if (i->second.deleted) {
+			return;
+		}
+		d = i->second.def;
+	} else {
+		const fact_record* r = snapshot ? snapshot->Find(ckey) : nullptr;
+		if (!r) {
+			return;
+		}
+		d = snapshot->Materialise(*r);
+	}
+	d.locked = locked;
+	Apply(ckey, d, false);
+	Journal(d, false);
+}
+
+bool FactStore::CatchUp()
+{
+	time_t since;
+	uint64_t start_sequence;
+	{
+		std::shared_lock lock(mtx);
+		if (!snapshot) {
+			return false;
+		}
+		/* A minute of overlap, for clock differences between here and the database */
+		since = snapshot->Created() - 60;
+		start_sequence = sequence;
+	}
+	db::resultset r = db::query("SELECT key_word, value, word, setby, whenset, locked FROM infobot WHERE whenset >= '?'", {(int64_t)since});
+	if (!db::error().empty()) {
+		return false;
+	}
+	std::unique_lock lock(mtx);
+	for (auto & row : r) {
+		infodef d;
+		d.found = true;
+		d.key = row["key_word"];
+		d.value = row["value"];
+		d.word = row["word"];
+		d.setby = row["setby"];
+		d.whenset = from_string<time_t>(row["whenset"], std::dec);
+		d.locked = (row["locked"] == "1");
+		std::string ckey = collate_key(d.key);
+		/* Don't overwrite anything the bot changed while the query was running */
+		auto i = delta.find(ckey);
+		if (i == delta.end() || i->second.sequence <= start_sequence) {
+			Apply(ckey, d, false);
+		}
+	}
+	return true;
+}
+
+/**
+ * Swap in a newly written snapshot. Delta entries which were written into it (those
+ * unchanged since the copy was taken) are dropped, and the rotated journal deleted.
+ * If the store was deactivated since the copy was taken, the new snapshot is missing the
+ * change which couldn't be journaled, so it is deleted instead.
+ */
+bool FactStore::Install(const std::map<std::string, delta_entry> &merged, uint64_t copied_generation)
+{
+	auto s = std::make_shared<Snapshot>();
+	if (!s->Open(path + ".tmp")) {
+		return false;
+	}
+	std::unique_lock lock(mtx);
+	if (generation != copied_generation || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+		return false;
+	}
+	snapshot = s;
+	for (auto & m : merged) {
+		auto i = delta.find(m.first);
+		if (i != delta.end() && i->second.sequence == m.second.sequence) {
+			delta.erase(i);
+		}
+	}
+	RecalculateAdjust();
+	unlink((path + ".merging").c_str());
+	return true;
+}
+
+/**
+ * Undo the journal rotation of a merge or rebuild which failed, putting the rotated journal
+ * back in front of anything written since. If the store was deactivated meanwhile, both
+ * journals describe a snapshot which no longer exists, so they are deleted and the journal
+ * stays closed until the next rebuild.
+ */
+void FactStore::RestoreJournal(uint64_t copied_generation)
+{
+	std::unique_lock lock(mtx);
+	unlink((path + ".tmp").c_str());
+	if (generation != copied_generation) {
+		unlink((path + ".merging").c_str());
+		return;
+	}
+	if (journal) {
+		fclose(journal);
+	}
+	append_file(path + ".journal", path + ".merging");
+	rename((path + ".merging").c_str(), (path + ".journal").c_str());
+	journal = fopen((path + ".journal").c_str(), "ab");
+}
+
+bool FactStore::Rebuild(const std::atomic<bool> &terminating)
+{
+	if (!enabled) {
+		return false;
+	}
+	std::map<std::string, delta_entry> copy;
+	uint64_t copied_generation;
+	time_t started = time(NULL);
+	{
+		/* Everything journaled so far is already in MySQL, so will be in the new snapshot */
+		std::unique_lock lock(mtx);
+		copy = delta;
+		copied_generation = generation;
+		if (journal) {
+			fclose(journal);
+		}
+		append_file(path + ".journal", path + ".merging");
+		unlink((path + ".journal").c_str());
+		journal = fopen((path + ".journal").c_str(), "ab");
+	}
+
+	bool ok;
+	{
+		SnapshotWriter w(path + ".tmp");
+		ok = scan_facts("key_word, value, word, setby, whenset, locked", [&](db::row &row) {
+			infodef d;
+			d.found = true;
+			d.key = row["key_word"];
+			d.value = row["value"];
+			d.word = row["word"];
+			d.setby = row["setby"];
+			d.whenset = from_string<time_t>(row["whenset"], std::dec);
+			d.locked = (row["locked"] == "1");
+			w.Add(collate_key(d.key), d);
+			return !terminating && w.IsOK();
+		}) && w.Finish(false, started);
+	}
+
+	if (!ok || !Install(copy, copied_generation)) {
+		RestoreJournal(copied_generation);
+		return false;
+	}
+	return true;
+}
+
+bool FactStore::Merge()
+{
+	if (!enabled) {
+		return false;
+	}
+	std::map<std::string, delta_entry> copy;
+	std::shared_ptr<Snapshot> base;
+	uint64_t copied_generation;
+	{
+		std::unique_lock lock(mtx);
+		if (delta.empty() || !snapshot) {
+			return true;
+		}
+		copy = delta;
+		base = snapshot;
+		copied_generation = generation;
+		if (journal) {
+			fclose(journal);
+		}
+		append_file(path + ".journal", path + ".merging");
+		unlink((path + ".journal").c_str());
+		journal = fopen((path + ".journal").c_str(), "ab");
+	}
+
+	bool ok;
+	{
+		/* Both the snapshot and the delta are in key order, so this is a simple merge */
+		SnapshotWriter w(path + ".tmp");
+		uint64_t i = 0, n = base->Count();
+		auto j = copy.begin();
+		while ((i < n || j != copy.end()) && w.IsOK()) {
+			if (j == copy.end() || (i < n && base->Key(i) < std::string_view(j->first))) {
+				w.Add(std::string(base->Key(i)), base->Materialise(i));
+				++i;
+			} else {
+				if (i < n && base->Key(i) == std::string_view(j->first)) {
+					++i;
+				}
+				if (!j->second.deleted) {
+					w.Add(j->first, j->second.def);
+				}
+				++j;
+			}
+		}
+		/* The merged snapshot is only as current as the one it came from, for CatchUp() */
+		ok = w.Finish(true, base->Created());
+	}
+
+	if (!ok || !Install(copy, copied_generation)) {
+		RestoreJournal(copied_generation);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,117 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <cstdio>
+#include "backend.h"
+
+/**
+ * Snapshot mode: serves every fact from memory, so that MySQL only takes writes.
+ *
+ * Enabled by setting "fact_snapshot" in config.json to a file path. The store is
+ * made of two layers:
+ *
+ * - A read-only snapshot file, mmap()ed. It holds a key index sorted by collate_key(),
+ *   a string arena, and an intern table for the few distinct `word` and `setby` values.
+ * - A delta of facts changed since the snapshot was written. Every change is also
+ *   appended to a journal file next to the snapshot, so that a restart loses nothing.
+ *
+ * The maintenance thread merges the delta into a new snapshot every so often, and
+ * rebuilds the snapshot from MySQL once a day to pick up changes made outside the bot.
+ */
+class FactStore {
+
+	class Snapshot;
+
+	struct delta_entry {
+		infodef def;
+		bool deleted;
+		uint64_t sequence;
+	};
+
+	std::string path;
+	bool enabled;
+
+	/* Guards snapshot, delta, count_adjust, the journal and generation */
+	mutable std::shared_mutex mtx;
+	std::shared_ptr<Snapshot> snapshot;
+	std::map<std::string, delta_entry> delta;
+	/* Number of facts the delta adds, minus the number it removes */
+	int64_t count_adjust;
+	uint64_t sequence;
+	FILE* journal;
+	/* Bumped by Deactivate(), so that a merge or rebuild running at the time doesn't install its result */
+	uint64_t generation;
+
+	/* Apply a change to the delta, caller must hold the lock exclusively */
+	void Apply(const std::string &ckey, const infodef &def, bool deleted);
+	void Journal(const infodef &def, bool deleted);
+	/* Stop serving reads after the journal couldn't be written, caller must hold the lock exclusively */
+	void Deactivate();
+	void ReplayJournal(const std::string &filename);
+	void RecalculateAdjust();
+	bool WriteSnapshot(const std::string &filename, std::shared_ptr<Snapshot> base, const std::map<std::string, delta_entry> &changes);
+	bool Install(const std::map<std::string, delta_entry> &merged, uint64_t copied_generation);
+	void RestoreJournal(uint64_t copied_generation);
+
+public:
+	FactStore();
+	~FactStore();
+
+	/* Key used for ordering and comparison in the store, see general_ci_fold(). It only matches
+	 * MySQL's comparison for keys where general_ci_exact() is true, so other keys must be
+	 * looked up in MySQL.
+	 */
+	static std::string collate_key(const std::string &key);
+
+	/* Turn on snapshot mode, loading the snapshot and journal at path if they exist */
+	void Enable(const std::string &snapshot_path);
+	bool IsEnabled() const;
+
+	/* True once a snapshot is loaded, after which reads must be served from here */
+	bool IsActive() const;
+
+	infodef Get(const std::string &key) const;
+	uint64_t Count() const;
+	time_t GetSnapshotTime() const;
+	size_t GetDeltaSize() const;
+
+	/* Record changes which have just been written to MySQL */
+	void Put(const infodef &def);
+	void Erase(const std::string &key);
+	void SetLocked(const std::string &key, bool locked);
+
+	/* Load facts changed in MySQL since the snapshot was written */
+	bool CatchUp();
+
+	/* Write a new snapshot from a full scan of MySQL */
+	bool Rebuild(const std::atomic<bool> &terminating);
+
+	/* Write a new snapshot combining the current one and the delta */
+	bool Merge();
+};
+
+extern FactStore factstore;
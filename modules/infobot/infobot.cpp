@@ -25,34 +25,43 @@
 #include <sporks/config.h>
 #include <sporks/stringops.h>
 #include <sporks/modules.h>
+#include <sporks/rng.h>
 #include <iostream>
 #include <sstream>
 #include <fmt/format.h>
 #include <dpp/nlohmann/json.hpp>
 #include "backend.h"
+#include "factcache.h"
+#include "keyfilter.h"
+#include "aliases.h"
+#include "factcount.h"
+#include "search.h"
+#include "keytrie.h"
+#include "factstore.h"
 
 using json = nlohmann::json;
 
 int InfobotModule::random(int min, int max)
 {
-	static bool first = true;
-	if (first) {
-		srand(time(NULL));
-		first = false;
-	}
-	return min + rand() % (( max + 1 ) - min);
+	return rng::range(min, max);
 }
 
 QueueStats InfobotModule::GetQueueStats() {
 	QueueStats q;
 	q.users = 0;
 	q.guilds = 0;
-	if (bot->counters.find("userqueue") != bot->counters.end()) {
-		q.users = bot->counters["userqueue"];
+	bot->GetCounter("userqueue", q.users);
+	bot->GetCounter("guildqueue", q.guilds);
+	q.input = 0;
+	for (auto & iq : input_queues) {
+		std::lock_guard<std::mutex> lock(iq->mtx);
+		q.input += iq->lines.size();
 	}
-	if (bot->counters.find("guildqueue") != bot->counters.end()) {
-		q.guilds = bot->counters["guildqueue"];
+	{
+		std::lock_guard<std::mutex> lock(output_mutex);
+		q.output = outputs.size();
 	}
+	q.dropped = dropped_lines;
 
 	return q;
 }
@@ -71,10 +80,17 @@ void InfobotModule::Input(QueueItem &query)
 	has_item = query.mentioned || settings::IsLearningEnabled(channel_settings);
 
 	if (has_item) {
-		/* Fix: If there isnt a list yet, don't try and do this otherwise it will result in a call of random(0, -1) and a SIGFPE */
 		std::string randnick = "";
-		if (nickList.find(query.serverID) != nickList.end() && this->nickList[query.serverID].size() > 0) {
-			randnick =  this->nickList[query.serverID][random(0, this->nickList[query.serverID].size() - 1)];
+		/* Members whose users have left the cache are skipped, up to a few tries */
+		for (int tries = 0; tries < 3 && randnick.empty(); ++tries) {
+			uint64_t member = members.Pick(query.serverID, rng::next());
+			if (!member) {
+				break;
+			}
+			dpp::user* u = dpp::find_user(member);
+			if (u) {
+				randnick = u->username;
+			}
 		}
 
 		/* Mangle common prefixes, so if someone asks "What is x" it is treated same as "x?" */
@@ -118,25 +134,43 @@ void InfobotModule::Input(QueueItem &query)
 		
 		if (found || query.mentioned) {
 			query.message = text;
-			Output(query);
+			QueueOutput(query);
 		}
 	}
 }
 
-InfobotModule::InfobotModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml)
+InfobotModule::InfobotModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml), maintenance_thread(nullptr), terminating(false), dropped_lines(0), output_thread(nullptr)
 {
-	ml->Attach({ I_OnMessage, I_OnGuildCreate }, this);
+	ml->Attach({ I_OnMessage, I_OnGuildCreate, I_OnGuildDelete, I_OnGuildMemberAdd, I_OnGuildMemberRemove, I_OnGuildMembersChunk, I_OnFactLock, I_OnPresenceUpdate }, this);
 	infobot_init();
+	std::string snapshot_path = Bot::GetConfig("fact_snapshot", "");
+	if (!snapshot_path.empty()) {
+		factstore.Enable(snapshot_path);
+		if (factstore.IsActive()) {
+			bot->core->log(dpp::ll_info, fmt::format("Serving {} facts from snapshot {} with {} changes since", factstore.Count(), snapshot_path, factstore.GetDeltaSize()));
+		} else {
+			bot->core->log(dpp::ll_info, fmt::format("No usable fact snapshot at {}, one will be built in the background", snapshot_path));
+		}
+	}
+	factkeys.SetBudget(from_string<size_t>(Bot::GetConfig("key_index_memory_mb", "256"), std::dec) * 1024 * 1024);
+	factsearch.SetBudget(from_string<size_t>(Bot::GetConfig("search_memory_mb", "512"), std::dec) * 1024 * 1024);
+	/* Approximate until the maintenance thread has counted the table */
+	factcount.Seed();
+	maintenance_thread = new std::thread(&InfobotModule::MaintenanceThread, this);
+	StartPipeline(std::max<size_t>(1, from_string<size_t>(Bot::GetConfig("infobot_workers", "4"), std::dec)));
 }
 
 InfobotModule::~InfobotModule()
 {
+	terminating = true;
+	StopPipeline();
+	bot->DisposeThread(maintenance_thread);
 }
 
 std::string InfobotModule::GetVersion()
 {
 	/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-	std::string version = "$ModVer 20$";
+	std::string version = "$ModVer 33$";
 	return "1.0." + version.substr(8,version.length() - 9);
 }
 
@@ -147,16 +181,61 @@ std::string InfobotModule::GetDescription()
 
 bool InfobotModule::OnGuildCreate(const dpp::guild_create_t &gc)
 {
-	this->nickList[gc.created->id] = std::vector<std::string>();
+	std::vector<uint64_t> ids;
+	ids.reserve(gc.created->members.size());
 	for (auto i = gc.created->members.begin(); i != gc.created->members.end(); ++i) {
-		dpp::user* u = dpp::find_user(i->second.user_id);
-		if (u) {
-			this->nickList[gc.created->id].push_back(u->username);
+		ids.push_back(i->second.user_id);
+	}
+	members.Set(gc.created->id, ids);
+	return true;
+}
+
+bool InfobotModule::OnGuildDelete(const dpp::guild_delete_t &gd)
+{
+	members.Forget(gd.deleted->id);
+	return true;
+}
+
+bool InfobotModule::OnGuildMemberAdd(const dpp::guild_member_add_t &gma)
+{
+	if (gma.adding_guild && gma.added.user_id) {
+		members.Add(gma.adding_guild->id, gma.added.user_id);
+	}
+	return true;
+}
+
+bool InfobotModule::OnGuildMemberRemove(const dpp::guild_member_remove_t &gmr)
+{
+	if (gmr.removing_guild && gmr.removed) {
+		members.Remove(gmr.removing_guild->id, gmr.removed->id);
+	}
+	return true;
+}
+
+bool InfobotModule::OnGuildMembersChunk(const dpp::guild_members_chunk_t &gmc)
+{
+	if (gmc.adding && gmc.members) {
+		for (auto i = gmc.members->begin(); i != gmc.members->end(); ++i) {
+			members.Add(gmc.adding->id, i->second.user_id);
 		}
 	}
 	return true;
 }
 
+bool InfobotModule::OnFactLock(const std::string &key, bool locked)
+{
+	factcache.SetLocked(key, locked);
+	factstore.SetLocked(key, locked);
+	return true;
+}
+
+bool InfobotModule::OnPresenceUpdate()
+{
+	/* The presence module shows this, everything else is on the status command */
+	bot->SetCounter("facts", factcount.Get());
+	return true;
+}
+
 bool InfobotModule::OnMessage(const dpp::message_create_t &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions)
 {
 	dpp::message_create_t msg = message;
@@ -169,7 +248,7 @@ bool InfobotModule::OnMessage(const dpp::message_create_t &message, const std::s
 	query.username = msg.msg->author ? msg.msg->author->username : "";
 	query.mentioned = mentioned;
 	query.original_username = query.username;
-	Input(query);
+	Enqueue(query);
 
 	return true;
 }
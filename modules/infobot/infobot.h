@@ -24,23 +24,55 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
 #include <sporks/modules.h>
 #include "queue.h"
 #include "backend.h"
+#include "members.h"
 
 using json = nlohmann::json; 
 
-typedef std::unordered_map<int64_t, std::vector<std::string>> RandomNickCache;
-
 /**
  * Infobot module: Allows smart responses from the botnix/infobot.pm system.
  */
 class InfobotModule : public Module
 {
 	/**
-	 *  Contains a vector of nicknames per-server for selecting a random nickname only
+	 *  Members of each server, for selecting a random nickname only
+	 */
+	MemberIndex members;
+
+	/* Background thread which builds and periodically rebuilds in-memory indexes of the fact table */
+	std::thread* maintenance_thread;
+
+	/* True if the maintenance thread is to terminate */
+	std::atomic<bool> terminating;
+
+	/* Input stage: one queue and worker thread per shard. Lines are sharded by channel so that
+	 * each channel's lines are answered in order.
 	 */
-	RandomNickCache nickList;
+	std::vector<std::unique_ptr<InputQueue>> input_queues;
+	std::vector<std::thread*> workers;
+	std::atomic<uint64_t> dropped_lines;
+
+	/* Output stage: replies waiting to be sent, in the order they were made */
+	std::mutex output_mutex;
+	std::condition_variable output_cv;
+	std::deque<QueueItem> outputs;
+	std::thread* output_thread;
+
+	void StartPipeline(size_t worker_count);
+	void StopPipeline();
+	void Enqueue(const QueueItem &item);
+	void QueueOutput(const QueueItem &item);
+	void InputWorker(size_t shard);
+	void OutputThread();
+
+	void MaintenanceThread();
+	bool RebuildIndexes();
+	void MaintainSnapshot(time_t &next_merge, time_t &next_snapshot_rebuild);
 
 	/**
 	 * Report bot status as an embed
@@ -66,6 +98,12 @@ public:
 
 	virtual bool OnMessage(const dpp::message_create_t &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions);
 	virtual bool OnGuildCreate(const dpp::guild_create_t &gc);
+	virtual bool OnGuildDelete(const dpp::guild_delete_t &gd);
+	virtual bool OnGuildMemberAdd(const dpp::guild_member_add_t &gma);
+	virtual bool OnGuildMemberRemove(const dpp::guild_member_remove_t &gmr);
+	virtual bool OnGuildMembersChunk(const dpp::guild_members_chunk_t &gmc);
+	virtual bool OnFactLock(const std::string &key, bool locked);
+	virtual bool OnPresenceUpdate();
 
 	/**
 	 * Random integer in range
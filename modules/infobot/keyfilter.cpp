@@ -0,0 +1,210 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <functional>
+#include <sporks/stringops.h>
+#include "backend.h"
+#include "keyfilter.h"
+
+KeyFilter keyfilter;
+
+/* Bits per key. 12, plus 25% headroom, gives around a 0.2% false positive rate */
+static constexpr uint64_t bits_per_key = 12;
+
+/* Plain letter for each code point from U+00C0 to U+017F (Latin-1 Supplement letters and
+ * Latin Extended-A). Folding too much is harmless, it only makes the filter say "maybe"
+ * more often, so letters without an obvious base are folded to something close.
+ */
+static const char latin_fold[] =
+	/* U+00C0 */ "aaaaaaaceeeeiiiidnoooooxouuuuyts"
+	/* U+00E0 */ "aaaaaaaceeeeiiiidnooooo/ouuuuyty"
+	/* U+0100 */ "aaaaaaccccccccddddeeeeeeeeeegggg"
+	/* U+0120 */ "gggghhhhiiiiiiiiiiiijjkkklllllll"
+	/* U+0140 */ "lllnnnnnnnnnoooooooorrrrrrssssss"
+	/* U+0160 */ "ssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
+static_assert(sizeof(latin_fold) == 0x180 - 0xC0 + 1, "latin_fold must cover U+00C0 to U+017F");
+
+KeyFilter::bloom::bloom(uint64_t expected_keys)
+{
+	blocks = (expected_keys * bits_per_key + 511) / 512;
+	if (blocks < 1024) {
+		blocks = 1024;
+	}
+	words.reset(new std::atomic<uint64_t>[blocks * 8]());
+}
+
+void KeyFilter::bloom::add(uint64_t hash)
+{
+	/* The top half of the hash picks the block, the bottom half picks one bit in each word */
+	uint64_t block = (uint64_t)(((unsigned __int128)hash * blocks) >> 64);
+	std::atomic<uint64_t>* w = &words[block * 8];
+	for (int i = 0; i < 8; ++i) {
+		w[i].fetch_or(1ULL << ((hash >> (i * 6)) & 63), std::memory_order_relaxed);
+	}
+}
+
+bool KeyFilter::bloom::test(uint64_t hash) const
+{
+	uint64_t block = (uint64_t)(((unsigned __int128)hash * blocks) >> 64);
+	const std::atomic<uint64_t>* w = &words[block * 8];
+	for (int i = 0; i < 8; ++i) {
+		if (!(w[i].load(std::memory_order_relaxed) & (1ULL << ((hash >> (i * 6)) & 63)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t KeyFilter::bloom::bytes() const
+{
+	return blocks * 64;
+}
+
+KeyFilter::KeyFilter() : current(nullptr), building(nullptr), rejected(0)
+{
+}
+
+KeyFilter::~KeyFilter()
+{
+	delete current.load();
+	delete building.load();
+}
+
+bool KeyFilter::Fold(const std::string &key, std::string &folded)
+{
+	std::string k = normalise_key(key);
+	if (stringkernels::is_ascii(k.data(), k.length())) {
+		folded = std::move(k);
+		return true;
+	}
+	folded.clear();
+	folded.reserve(k.length());
+	for (size_t i = 0; i < k.length(); ++i) {
+		unsigned char c = k[i];
+		if (c < 0x80) {
+			folded += c;
+			continue;
+		}
+		/* Two byte UTF-8 sequences for U+00C0 to U+017F start with 0xC3, 0xC4 or 0xC5 */
+		if (c < 0xC3 || c > 0xC5 || i + 1 >= k.length() || ((unsigned char)k[i + 1] & 0xC0) != 0x80) {
+			return false;
+		}
+		unsigned int codepoint = ((c & 0x1F) << 6) | ((unsigned char)k[++i] & 0x3F);
+		folded += latin_fold[codepoint - 0xC0];
+	}
+	return true;
+}
+
+uint64_t KeyFilter::Hash(const std::string &folded)
+{
+	/* std::hash is murmur based in libstdc++, run it through a splitmix64 finaliser so that every bit is usable */
+	uint64_t h = std::hash<std::string>()(folded);
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+bool KeyFilter::MightContain(const std::string &key)
+{
+	bloom* b = current.load(std::memory_order_acquire);
+	std::string folded;
+	if (!b || !Fold(key, folded)) {
+		return true;
+	}
+	if (b->test(Hash(folded))) {
+		return true;
+	}
+	rejected++;
+	return false;
+}
+
+void KeyFilter::Add(const std::string &key)
+{
+	std::string folded;
+	if (!Fold(key, folded)) {
+		return;
+	}
+	uint64_t h = Hash(folded);
+	/* Check building before current. CommitRebuild() changes them in the opposite order,
+	 * so if there is no rebuild by now, current is already the new filter.
+	 */
+	bloom* rebuild = building.load();
+	bloom* b = current.load();
+	if (rebuild) {
+		rebuild->add(h);
+	}
+	if (b && b != rebuild) {
+		b->add(h);
+	}
+}
+
+void KeyFilter::BeginRebuild(uint64_t expected_keys)
+{
+	std::lock_guard<std::mutex> lock(rebuild_mutex);
+	/* Leave headroom for keys learned before the next rebuild */
+	bloom* b = new bloom(expected_keys + expected_keys / 4);
+	abandoned.reset(building.exchange(b));
+}
+
+void KeyFilter::AddToRebuild(const std::string &key)
+{
+	std::string folded;
+	bloom* b = building.load(std::memory_order_acquire);
+	if (b && Fold(key, folded)) {
+		b->add(Hash(folded));
+	}
+}
+
+void KeyFilter::CommitRebuild()
+{
+	std::lock_guard<std::mutex> lock(rebuild_mutex);
+	bloom* b = building.load();
+	if (b) {
+		/* Make it current before it stops being the rebuild target, see Add() */
+		retired.reset(current.exchange(b));
+		building.store(nullptr);
+	}
+}
+
+void KeyFilter::AbortRebuild()
+{
+	std::lock_guard<std::mutex> lock(rebuild_mutex);
+	abandoned.reset(building.exchange(nullptr));
+}
+
+bool KeyFilter::IsReady()
+{
+	return current.load() != nullptr;
+}
+
+size_t KeyFilter::GetBytes()
+{
+	bloom* b = current.load();
+	return b ? b->bytes() : 0;
+}
+
+uint64_t KeyFilter::GetRejected()
+{
+	return rejected;
+}
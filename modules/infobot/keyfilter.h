@@ -0,0 +1,94 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+
+/**
+ * A blocked bloom filter holding every key_word in the infobot table, so that
+ * get_def() can answer "not found" for most chat lines without asking MySQL.
+ *
+ * The filter can say a key might exist when it doesn't (around 0.2% of the time)
+ * but never the opposite. Deleted keys stay in the filter until the next rebuild,
+ * which only costs a database lookup for them.
+ *
+ * Keys are folded before hashing so that accented Latin letters match their plain
+ * form, as utf8mb4_general_ci does. Keys containing anything else outside ASCII are
+ * never filtered and always go to the database.
+ */
+class KeyFilter {
+
+	/* One generation of the filter, 512 bit blocks with one bit set per 64 bit word */
+	struct bloom {
+		uint64_t blocks;
+		std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+		bloom(uint64_t expected_keys);
+		void add(uint64_t hash);
+		bool test(uint64_t hash) const;
+		size_t bytes() const;
+	};
+
+	/* Filter in use, null until the first build completes */
+	std::atomic<bloom*> current;
+	/* Filter being built, if a rebuild is running */
+	std::atomic<bloom*> building;
+	/* The filter replaced by the last rebuild. Kept until the next one, as a
+	 * lookup may still be reading it.
+	 */
+	std::unique_ptr<bloom> retired;
+	/* Same for a rebuild that was abandoned part way */
+	std::unique_ptr<bloom> abandoned;
+	std::mutex rebuild_mutex;
+
+	std::atomic<uint64_t> rejected;
+
+	/* Normalise and fold a key, returns false if it can't be filtered */
+	static bool Fold(const std::string &key, std::string &folded);
+	static uint64_t Hash(const std::string &folded);
+
+public:
+	KeyFilter();
+	~KeyFilter();
+
+	/* Returns false only if the key is definitely not in the table */
+	bool MightContain(const std::string &key);
+
+	/* Add a key to the filter, and to any rebuild in progress */
+	void Add(const std::string &key);
+
+	/* Start a rebuild. Keys from a scan of the table are then passed to AddToRebuild(),
+	 * followed by CommitRebuild() or AbortRebuild().
+	 */
+	void BeginRebuild(uint64_t expected_keys);
+	void AddToRebuild(const std::string &key);
+	void CommitRebuild();
+	void AbortRebuild();
+
+	bool IsReady();
+	size_t GetBytes();
+	uint64_t GetRejected();
+};
+
+/* The filter consulted by get_def() */
+extern KeyFilter keyfilter;
@@ -0,0 +1,303 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sporks/stringops.h>
+#include "backend.h"
+#include "keytrie.h"
+
+FactKeys factkeys;
+
+/* Matches gathered by Nearest() before it stops looking */
+static constexpr size_t max_nearest_candidates = 1000;
+
+KeyTrie::KeyTrie() : keys(0)
+{
+	NewNode(0, 0, false);
+}
+
+uint32_t KeyTrie::NewNode(uint32_t label, uint32_t length, bool terminal)
+{
+	node n;
+	n.label = label;
+	n.length = length;
+	n.terminal = terminal;
+	n.child = n.sibling = 0;
+	nodes.push_back(n);
+	return nodes.size() - 1;
+}
+
+unsigned char KeyTrie::First(uint32_t n) const
+{
+	return labels[nodes[n].label];
+}
+
+uint32_t KeyTrie::Child(uint32_t n, unsigned char c) const
+{
+	for (uint32_t child = nodes[n].child; child; child = nodes[child].sibling) {
+		if (First(child) == c) {
+			return child;
+		}
+		if (First(child) > c) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void KeyTrie::Insert(const std::string &k)
+{
+	std::string key = normalise_key(k);
+	uint32_t n = 0;
+	size_t i = 0;
+	while (i < key.length()) {
+		unsigned char c = key[i];
+		uint32_t previous = 0;
+		uint32_t child = nodes[n].child;
+		while (child && First(child) < c) {
+			previous = child;
+			child = nodes[child].sibling;
+		}
+		if (!child || First(child) != c) {
+			/* Nothing shares this prefix, the rest of the key is a new leaf */
+			uint32_t leaf = NewNode(labels.length(), key.length() - i, true);
+			labels.append(key, i, std::string::npos);
+			nodes[leaf].sibling = child;
+			if (previous) {
+				nodes[previous].sibling = leaf;
+			} else {
+				nodes[n].child = leaf;
+			}
+			keys++;
+			return;
+		}
+		uint32_t length = nodes[child].length;
+		uint32_t label = nodes[child].label;
+		uint32_t common = 0;
+		while (common < length && i + common < key.length() && labels[label + common] == key[i + common]) {
+			common++;
+		}
+		if (common < length) {
+			/* Split the edge. The new node takes the end of the label, the children and the key ending here */
+			uint32_t rest = NewNode(label + common, length - common, nodes[child].terminal);
+			nodes[rest].child = nodes[child].child;
+			nodes[child].length = common;
+			nodes[child].terminal = false;
+			nodes[child].child = rest;
+		}
+		n = child;
+		i += common;
+	}
+	if (!nodes[n].terminal && n != 0) {
+		nodes[n].terminal = true;
+		keys++;
+	}
+}
+
+void KeyTrie::Remove(const std::string &k)
+{
+	std::string key = normalise_key(k);
+	uint32_t n = 0;
+	size_t i = 0;
+	while (i < key.length()) {
+		n = Child(n, key[i]);
+		if (!n || nodes[n].length > key.length() - i || key.compare(i, nodes[n].length, labels, nodes[n].label, nodes[n].length) != 0) {
+			return;
+		}
+		i += nodes[n].length;
+	}
+	if (nodes[n].terminal) {
+		nodes[n].terminal = false;
+		keys--;
+	}
+}
+
+void KeyTrie::Collect(uint32_t n, std::string &key, size_t max_results, std::vector<std::string> &results) const
+{
+	if (nodes[n].terminal) {
+		results.push_back(key);
+	}
+	for (uint32_t child = nodes[n].child; child && results.size() < max_results; child = nodes[child].sibling) {
+		key.append(labels, nodes[child].label, nodes[child].length);
+		Collect(child, key, max_results, results);
+		key.resize(key.length() - nodes[child].length);
+	}
+}
+
+std::vector<std::string> KeyTrie::Complete(const std::string &p, size_t max_results) const
+{
+	std::vector<std::string> results;
+	std::string prefix = lowercase(p);
+	std::string key;
+	uint32_t n = 0;
+	while (key.length() < prefix.length()) {
+		n = Child(n, prefix[key.length()]);
+		if (!n) {
+			return results;
+		}
+		/* The prefix may end part way along this edge */
+		size_t compare = std::min<size_t>(nodes[n].length, prefix.length() - key.length());
+		if (prefix.compare(key.length(), compare, labels, nodes[n].label, compare) != 0) {
+			return results;
+		}
+		key.append(labels, nodes[n].label, nodes[n].length);
+	}
+	if (max_results) {
+		Collect(n, key, max_results, results);
+	}
+	return results;
+}
+
+/* Walk the trie keeping one row of the Levenshtein table per byte of the key so far, in
+ * rows, abandoning any branch where every entry in the row is over the limit. A key can't
+ * be longer than the word plus max_distance without going over it, so rows never runs out.
+ */
+void KeyTrie::Nearest(uint32_t n, std::string &key, const std::string &word, std::vector<uint32_t> &rows, uint32_t max_distance, std::vector<std::pair<uint32_t, std::string>> &results) const
+{
+	const size_t width = word.length() + 1;
+	const size_t depth = key.length();
+	for (uint32_t i = 0; i < nodes[n].length; ++i) {
+		const uint32_t* previous = &rows[(depth + i) * width];
+		uint32_t* current = &rows[(depth + i + 1) * width];
+		char c = labels[nodes[n].label + i];
+		current[0] = previous[0] + 1;
+		uint32_t lowest = current[0];
+		for (size_t j = 1; j < width; ++j) {
+			current[j] = std::min({previous[j] + 1, current[j - 1] + 1, previous[j - 1] + (word[j - 1] != c ? 1 : 0)});
+			lowest = std::min(lowest, current[j]);
+		}
+		if (lowest > max_distance) {
+			return;
+		}
+	}
+	key.append(labels, nodes[n].label, nodes[n].length);
+	uint32_t distance = rows[key.length() * width + width - 1];
+	if (nodes[n].terminal && distance <= max_distance) {
+		results.emplace_back(distance, key);
+	}
+	for (uint32_t child = nodes[n].child; child && results.size() < max_nearest_candidates; child = nodes[child].sibling) {
+		Nearest(child, key, word, rows, max_distance, results);
+	}
+	key.resize(depth);
+}
+
+std::vector<std::string> KeyTrie::Nearest(const std::string &w, uint32_t max_distance, size_t max_results) const
+{
+	std::string word = normalise_key(w);
+	const size_t width = word.length() + 1;
+	std::vector<uint32_t> rows((word.length() + max_distance + 2) * width);
+	for (size_t j = 0; j < width; ++j) {
+		rows[j] = j;
+	}
+	std::vector<std::pair<uint32_t, std::string>> found;
+	std::string key;
+	Nearest(0, key, word, rows, max_distance, found);
+	std::sort(found.begin(), found.end());
+	std::vector<std::string> results;
+	for (size_t i = 0; i < found.size() && results.size() < max_results; ++i) {
+		results.push_back(found[i].second);
+	}
+	return results;
+}
+
+size_t KeyTrie::GetBytes() const
+{
+	return nodes.capacity() * sizeof(node) + labels.capacity();
+}
+
+size_t KeyTrie::GetKeys() const
+{
+	return keys;
+}
+
+FactKeys::FactKeys() : tries(256 * 1024 * 1024, &FactKeys::Apply)
+{
+}
+
+void FactKeys::Apply(KeyTrie &trie, const change &c)
+{
+	if (c.second) {
+		trie.Insert(c.first);
+	} else {
+		trie.Remove(c.first);
+	}
+}
+
+void FactKeys::SetBudget(size_t bytes)
+{
+	tries.SetBudget(bytes);
+}
+
+size_t FactKeys::GetBudget()
+{
+	return tries.GetBudget();
+}
+
+void FactKeys::Put(const std::string &key)
+{
+	tries.Apply({key, true});
+}
+
+void FactKeys::Erase(const std::string &key)
+{
+	tries.Apply({key, false});
+}
+
+std::vector<std::string> FactKeys::Complete(const std::string &prefix, size_t max_results) const
+{
+	return tries.Read([&](const KeyTrie &trie) { return trie.Complete(prefix, max_results); }, std::vector<std::string>());
+}
+
+std::vector<std::string> FactKeys::Nearest(const std::string &word, uint32_t max_distance, size_t max_results) const
+{
+	return tries.Read([&](const KeyTrie &trie) { return trie.Nearest(word, max_distance, max_results); }, std::vector<std::string>());
+}
+
+bool FactKeys::IsReady() const
+{
+	return tries.IsReady();
+}
+
+size_t FactKeys::GetBytes() const
+{
+	return tries.GetBytes();
+}
+
+void FactKeys::BeginRebuild()
+{
+	tries.BeginRebuild();
+}
+
+bool FactKeys::AddToRebuild(const std::string &key)
+{
+	return tries.AddToRebuild({key, true});
+}
+
+void FactKeys::CommitRebuild()
+{
+	tries.CommitRebuild();
+}
+
+void FactKeys::AbortRebuild()
+{
+	tries.AbortRebuild();
+}
@@ -0,0 +1,116 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include "rebuildable.h"
+
+/**
+ * A radix trie of every fact key, for listing keys by prefix and for finding the keys
+ * nearest to a misspelt one.
+ *
+ * Nodes are 16 bytes each and held in one vector, addressed by index. Edge labels live
+ * in a single string arena, and splitting an edge only changes offsets, so no label is
+ * ever copied. Children of a node are a linked list sorted by their first byte, which
+ * makes enumeration come out in order. Removing a key only unmarks it; the space is
+ * reclaimed when the trie is next rebuilt.
+ */
+class KeyTrie {
+
+	struct node {
+		/* Offset and length of the edge label leading to this node */
+		uint32_t label;
+		uint32_t length : 31;
+		/* Set if a key ends here */
+		uint32_t terminal : 1;
+		/* First child and next sibling, 0 for none. Node 0 is the root and never a child */
+		uint32_t child;
+		uint32_t sibling;
+	};
+
+	std::vector<node> nodes;
+	std::string labels;
+	size_t keys;
+
+	uint32_t NewNode(uint32_t label, uint32_t length, bool terminal);
+	unsigned char First(uint32_t n) const;
+	/* Child of n whose label starts with c, 0 if none */
+	uint32_t Child(uint32_t n, unsigned char c) const;
+	void Collect(uint32_t n, std::string &key, size_t max_results, std::vector<std::string> &results) const;
+	void Nearest(uint32_t n, std::string &key, const std::string &word, std::vector<uint32_t> &rows, uint32_t max_distance, std::vector<std::pair<uint32_t, std::string>> &results) const;
+
+public:
+	KeyTrie();
+
+	/* Keys are passed through normalise_key() by all of these */
+	void Insert(const std::string &key);
+	void Remove(const std::string &key);
+
+	/* Up to max_results keys starting with prefix, in byte order */
+	std::vector<std::string> Complete(const std::string &prefix, size_t max_results) const;
+
+	/* Up to max_results keys within max_distance edits of word, nearest first */
+	std::vector<std::string> Nearest(const std::string &word, uint32_t max_distance, size_t max_results) const;
+
+	size_t GetBytes() const;
+	size_t GetKeys() const;
+};
+
+/**
+ * The key trie in use, and the rebuilding of it by the maintenance thread.
+ */
+class FactKeys {
+
+	/* A key added (true) or removed (false) */
+	typedef std::pair<std::string, bool> change;
+
+	static void Apply(KeyTrie &trie, const change &c);
+
+	RebuildableIndex<KeyTrie, change> tries;
+
+public:
+	FactKeys();
+
+	/* Largest size in bytes the trie may grow to, by a rebuild or by facts learned since */
+	void SetBudget(size_t bytes);
+	size_t GetBudget();
+
+	/* Add a key. The trie is dropped until the next rebuild if this takes it over budget */
+	void Put(const std::string &key);
+	void Erase(const std::string &key);
+
+	std::vector<std::string> Complete(const std::string &prefix, size_t max_results) const;
+	std::vector<std::string> Nearest(const std::string &word, uint32_t max_distance, size_t max_results) const;
+
+	bool IsReady() const;
+	size_t GetBytes() const;
+
+	void BeginRebuild();
+	/* Returns false once the trie being built is over budget */
+	bool AddToRebuild(const std::string &key);
+	void CommitRebuild();
+	void AbortRebuild();
+};
+
+extern FactKeys factkeys;
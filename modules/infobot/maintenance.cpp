@@ -0,0 +1,201 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <chrono>
+#include <thread>
+#include <sporks/bot.h>
+#include <sporks/database.h>
+#include <fmt/format.h>
+#include "infobot.h"
+#include "backend.h"
+#include "keyfilter.h"
+#include "factstore.h"
+#include "aliases.h"
+#include "factcount.h"
+#include "search.h"
+#include "keytrie.h"
+
+/* How often to rebuild indexes from scratch, and how soon to retry a failed rebuild */
+static constexpr time_t rebuild_interval = 6 * 60 * 60;
+static constexpr time_t rebuild_retry = 5 * 60;
+
+/* How often to replace the running fact count with an exact count */
+static constexpr time_t count_interval = 60 * 60;
+
+/* Snapshot mode: how often to merge the delta into a new snapshot, and to rebuild it from MySQL */
+static constexpr time_t snapshot_merge_interval = 15 * 60;
+static constexpr time_t snapshot_rebuild_interval = 24 * 60 * 60;
+
+/**
+ * Rebuild all in-memory indexes of the fact table with one scan of the table.
+ * Returns false if the scan failed or the module is unloading.
+ */
+bool InfobotModule::RebuildIndexes()
+{
+	auto start = std::chrono::steady_clock::now();
+	uint64_t expected = get_phrase_count();
+	uint64_t rows = 0;
+
+	keyfilter.BeginRebuild(expected);
+	aliases.BeginRebuild();
+
+	/* The search index needs every value. Without it only alias values are fetched, anything else would be wasted bandwidth */
+	bool searching = factsearch.GetBudget() > 0;
+	if (searching) {
+		factsearch.BeginRebuild();
+	}
+	bool listing = factkeys.GetBudget() > 0;
+	if (listing) {
+		factkeys.BeginRebuild();
+	}
+	std::string columns = searching ? "key_word, value" : "key_word, IF(value LIKE '%<alias>%', value, '') AS value";
+
+	bool complete = scan_facts(columns, [&](db::row &r) {
+		keyfilter.AddToRebuild(r["key_word"]);
+		aliases.AddToRebuild(r["key_word"], r["value"]);
+		if (searching && !factsearch.AddToRebuild(r["key_word"], r["value"])) {
+			bot->core->log(dpp::ll_warning, fmt::format("Search index passed its memory budget of {} after {} rows, not using it", dpp::utility::bytes(factsearch.GetBudget()), rows));
+			factsearch.AbortRebuild();
+			searching = false;
+		}
+		if (listing && !factkeys.AddToRebuild(r["key_word"])) {
+			bot->core->log(dpp::ll_warning, fmt::format("Key index passed its memory budget of {} after {} rows, not using it", dpp::utility::bytes(factkeys.GetBudget()), rows));
+			factkeys.AbortRebuild();
+			listing = false;
+		}
+		rows++;
+		return !terminating;
+	});
+
+	if (!complete) {
+		keyfilter.AbortRebuild();
+		aliases.AbortRebuild();
+		if (searching) {
+			factsearch.AbortRebuild();
+		}
+		if (listing) {
+			factkeys.AbortRebuild();
+		}
+		if (!terminating) {
+			bot->core->log(dpp::ll_warning, fmt::format("Fact index rebuild failed after {} rows: {}", rows, db::error()));
+		}
+		return false;
+	}
+
+	keyfilter.CommitRebuild();
+	aliases.CommitRebuild();
+	if (searching) {
+		factsearch.CommitRebuild();
+	}
+	if (listing) {
+		factkeys.CommitRebuild();
+	}
+
+	double secs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+	bot->core->log(dpp::ll_info, fmt::format("Fact indexes rebuilt from {} rows in {:.1f}s, key filter {}, {} aliases, search index {}, key index {}", rows, secs, dpp::utility::bytes(keyfilter.GetBytes()), aliases.GetCount(), dpp::utility::bytes(factsearch.GetBytes()), dpp::utility::bytes(factkeys.GetBytes())));
+
+	/* Report aliases which can never be answered, now rather than when someone asks */
+	std::vector<std::string> bad_aliases;
+	aliases.Audit([](const std::string &key) { return keyfilter.MightContain(key); }, 10, bad_aliases);
+	if (aliases.GetCyclic() || aliases.GetBroken()) {
+		bot->core->log(dpp::ll_warning, fmt::format("{} aliases loop and {} point at missing facts", aliases.GetCyclic(), aliases.GetBroken()));
+		for (auto & b : bad_aliases) {
+			bot->core->log(dpp::ll_debug, b);
+		}
+	}
+	return true;
+}
+
+/**
+ * Snapshot mode upkeep: build the first snapshot, fold the delta into a new snapshot
+ * regularly, and rebuild from MySQL daily to pick up changes made outside the bot.
+ */
+void InfobotModule::MaintainSnapshot(time_t &next_merge, time_t &next_snapshot_rebuild)
+{
+	time_t now = time(NULL);
+	if (next_snapshot_rebuild == 0) {
+		/* First run. A snapshot loaded at startup may be missing facts learned elsewhere since it was written */
+		if (factstore.IsActive() && now - factstore.GetSnapshotTime() < snapshot_rebuild_interval) {
+			if (!factstore.CatchUp()) {
+				bot->core->log(dpp::ll_warning, fmt::format("Could not load fact changes since the snapshot: {}", db::error()));
+			}
+			next_snapshot_rebuild = factstore.GetSnapshotTime() + snapshot_rebuild_interval;
+		} else {
+			next_snapshot_rebuild = now;
+		}
+		next_merge = now + snapshot_merge_interval;
+	}
+	if (!factstore.IsActive() && next_snapshot_rebuild > now + rebuild_retry) {
+		/* The store stops serving reads if it can't write its journal, only a new snapshot brings it back */
+		bot->core->log(dpp::ll_warning, "Fact snapshot is not in use, rebuilding it");
+		next_snapshot_rebuild = now;
+	}
+	if (now >= next_snapshot_rebuild) {
+		auto start = std::chrono::steady_clock::now();
+		if (factstore.Rebuild(terminating)) {
+			double secs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+			bot->core->log(dpp::ll_info, fmt::format("Fact snapshot rebuilt with {} facts in {:.1f}s", factstore.Count(), secs));
+			next_snapshot_rebuild = time(NULL) + snapshot_rebuild_interval;
+		} else {
+			if (!terminating) {
+				bot->core->log(dpp::ll_warning, "Fact snapshot rebuild failed, will retry");
+			}
+			next_snapshot_rebuild = time(NULL) + rebuild_retry;
+		}
+		next_merge = time(NULL) + snapshot_merge_interval;
+	} else if (now >= next_merge) {
+		size_t changes = factstore.GetDeltaSize();
+		if (factstore.Merge()) {
+			if (changes) {
+				bot->core->log(dpp::ll_debug, fmt::format("Merged {} fact changes into snapshot", changes));
+			}
+		} else {
+			bot->core->log(dpp::ll_warning, "Fact snapshot merge failed, changes remain in the journal");
+		}
+		next_merge = time(NULL) + snapshot_merge_interval;
+	}
+}
+
+void InfobotModule::MaintenanceThread()
+{
+	time_t next_rebuild = 0;
+	time_t next_merge = 0;
+	time_t next_snapshot_rebuild = 0;
+	time_t next_count = 0;
+	while (!terminating) {
+		if (time(NULL) >= next_count) {
+			auto start = std::chrono::steady_clock::now();
+			if (factcount.Reconcile(terminating)) {
+				double secs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+				bot->core->log(dpp::ll_debug, fmt::format("Counted {} facts in {:.1f}s", factcount.Get(), secs));
+				next_count = time(NULL) + count_interval;
+			} else {
+				next_count = time(NULL) + rebuild_retry;
+			}
+		}
+		if (time(NULL) >= next_rebuild) {
+			next_rebuild = time(NULL) + (RebuildIndexes() ? rebuild_interval : rebuild_retry);
+		}
+		if (factstore.IsEnabled() && !terminating) {
+			MaintainSnapshot(next_merge, next_snapshot_rebuild);
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+}
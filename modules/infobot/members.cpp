@@ -0,0 +1,200 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include "members.h"
+
+/* Smallest table, 16 slots */
+constexpr unsigned int min_bits = 4;
+
+MemberIndex::guild_members::guild_members() : slots(1 << min_bits, 0), bits(min_bits)
+{
+}
+
+size_t MemberIndex::guild_members::Home(uint64_t id) const
+{
+	/* Snowflakes differ most in their low bits, mix them into the top bits */
+	return ((id ^ (id >> 31)) * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+}
+
+size_t MemberIndex::guild_members::Find(uint64_t id) const
+{
+	size_t mask = slots.size() - 1;
+	size_t i = Home(id);
+	while (slots[i] && ids[slots[i] - 1] != id) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+void MemberIndex::guild_members::Rehash(unsigned int new_bits)
+{
+	bits = new_bits;
+	slots.assign(1 << bits, 0);
+	slots.shrink_to_fit();
+	for (size_t p = 0; p < ids.size(); ++p) {
+		slots[Find(ids[p])] = p + 1;
+	}
+}
+
+bool MemberIndex::guild_members::Add(uint64_t id)
+{
+	size_t i = Find(id);
+	if (slots[i]) {
+		return false;
+	}
+	ids.push_back(id);
+	slots[i] = ids.size();
+	/* Keep the table at most half full */
+	if (ids.size() * 2 > slots.size()) {
+		Rehash(bits + 1);
+	}
+	return true;
+}
+
+bool MemberIndex::guild_members::Remove(uint64_t id)
+{
+	size_t i = Find(id);
+	if (!slots[i]) {
+		return false;
+	}
+	size_t pos = slots[i] - 1;
+	size_t last = ids.size() - 1;
+	if (pos != last) {
+		slots[Find(ids[last])] = pos + 1;
+		ids[pos] = ids[last];
+	}
+	ids.pop_back();
+
+	/* Backward shift deletion: move up any later entries of the same run which could live in slot i */
+	size_t mask = slots.size() - 1;
+	for (size_t j = (i + 1) & mask; slots[j]; j = (j + 1) & mask) {
+		size_t home = Home(ids[slots[j] - 1]);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i] = 0;
+
+	if (bits > min_bits && ids.size() * 8 < slots.size()) {
+		Rehash(bits - 1);
+		ids.shrink_to_fit();
+	}
+	return true;
+}
+
+size_t MemberIndex::guild_members::GetBytes() const
+{
+	return sizeof(guild_members) + ids.capacity() * sizeof(uint64_t) + slots.capacity() * sizeof(uint32_t);
+}
+
+MemberIndex::MemberIndex() : total_members(0)
+{
+}
+
+void MemberIndex::Set(int64_t guild, const std::vector<uint64_t> &members)
+{
+	guild_members g;
+	g.ids.reserve(members.size());
+	for (uint64_t id : members) {
+		g.Add(id);
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	auto i = guilds.find(guild);
+	if (i != guilds.end()) {
+		total_members -= i->second.ids.size();
+	}
+	total_members += g.ids.size();
+	guilds[guild] = std::move(g);
+}
+
+void MemberIndex::Add(int64_t guild, uint64_t user)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (guilds[guild].Add(user)) {
+		total_members++;
+	}
+}
+
+void MemberIndex::Remove(int64_t guild, uint64_t user)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto i = guilds.find(guild);
+	if (i != guilds.end() && i->second.Remove(user)) {
+		total_members--;
+	}
+}
+
+void MemberIndex::Forget(int64_t guild)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto i = guilds.find(guild);
+	if (i != guilds.end()) {
+		total_members -= i->second.ids.size();
+		guilds.erase(i);
+	}
+}
+
+uint64_t MemberIndex::Pick(int64_t guild, uint64_t r) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto i = guilds.find(guild);
+	if (i == guilds.end() || i->second.ids.empty()) {
+		return 0;
+	}
+	return i->second.ids[r % i->second.ids.size()];
+}
+
+size_t MemberIndex::GetCount(int64_t guild) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto i = guilds.find(guild);
+	return i == guilds.end() ? 0 : i->second.ids.size();
+}
+
+uint64_t MemberIndex::GetCount() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return total_members;
+}
+
+size_t MemberIndex::GetGuilds() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return guilds.size();
+}
+
+size_t MemberIndex::GetBytes(int64_t guild) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto i = guilds.find(guild);
+	return i == guilds.end() ? 0 : i->second.GetBytes();
+}
+
+size_t MemberIndex::GetBytes() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	size_t bytes = 0;
+	for (auto & g : guilds) {
+		/* Key, value and the map's node pointer */
+		bytes += g.second.GetBytes() + sizeof(int64_t) + sizeof(void*);
+	}
+	return bytes;
+}
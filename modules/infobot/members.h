@@ -0,0 +1,80 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+/**
+ * The members of each guild, by user id, for choosing a random member for a reply.
+ *
+ * Only ids are stored. Names are looked up in the D++ user cache when a member is chosen,
+ * so they are always current and never copied once per guild. The index is kept up to
+ * date from guild create, member chunk, member add and member remove events.
+ */
+class MemberIndex {
+
+	/* Members of one guild. ids holds each member once, in no particular order, so that a
+	 * random member is one array index. slots is a linear probing hash table of positions
+	 * in ids (plus one, zero is empty) used to find a member so that it can be removed by
+	 * moving the last id into its place.
+	 */
+	struct guild_members {
+		std::vector<uint64_t> ids;
+		std::vector<uint32_t> slots;
+		unsigned int bits;
+
+		guild_members();
+		size_t Home(uint64_t id) const;
+		/* Slot holding id, or the empty slot where it would go */
+		size_t Find(uint64_t id) const;
+		void Rehash(unsigned int new_bits);
+		bool Add(uint64_t id);
+		bool Remove(uint64_t id);
+		size_t GetBytes() const;
+	};
+
+	mutable std::mutex mtx;
+	std::unordered_map<int64_t, guild_members> guilds;
+	uint64_t total_members;
+
+public:
+	MemberIndex();
+
+	/* Replace a guild's members, e.g. on guild create */
+	void Set(int64_t guild, const std::vector<uint64_t> &members);
+	void Add(int64_t guild, uint64_t user);
+	void Remove(int64_t guild, uint64_t user);
+	void Forget(int64_t guild);
+
+	/* Member of the guild at position r modulo its size, or 0 if the guild has no members */
+	uint64_t Pick(int64_t guild, uint64_t r) const;
+
+	size_t GetCount(int64_t guild) const;
+	uint64_t GetCount() const;
+	size_t GetGuilds() const;
+	/* Memory used for one guild, or for all of them */
+	size_t GetBytes(int64_t guild) const;
+	size_t GetBytes() const;
+};
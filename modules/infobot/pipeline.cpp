@@ -0,0 +1,146 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <sporks/bot.h>
+#include <fmt/format.h>
+#include "infobot.h"
+
+/* Most lines each worker will hold before dropping some */
+static constexpr size_t input_queue_limit = 256;
+
+/* Most replies the output stage will hold before dropping those nobody asked for */
+static constexpr size_t output_queue_limit = 1024;
+
+void InfobotModule::StartPipeline(size_t worker_count)
+{
+	for (size_t i = 0; i < worker_count; ++i) {
+		input_queues.push_back(std::make_unique<InputQueue>());
+	}
+	for (size_t i = 0; i < worker_count; ++i) {
+		workers.push_back(new std::thread(&InfobotModule::InputWorker, this, i));
+	}
+	output_thread = new std::thread(&InfobotModule::OutputThread, this);
+}
+
+void InfobotModule::StopPipeline()
+{
+	/* terminating is already set, wake everything so that it notices */
+	for (auto & q : input_queues) {
+		std::lock_guard<std::mutex> lock(q->mtx);
+		q->cv.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> lock(output_mutex);
+		output_cv.notify_all();
+	}
+	for (auto w : workers) {
+		bot->DisposeThread(w);
+	}
+	workers.clear();
+	bot->DisposeThread(output_thread);
+	output_thread = nullptr;
+}
+
+/**
+ * Queue a line for the worker which owns its channel. When that worker is full, lines
+ * which don't mention the bot are dropped first, oldest first. A line which mentions the
+ * bot is only dropped if the worker is full of other such lines. Lines that are kept are
+ * answered in the order they arrived, so that a question is never answered before a fact
+ * taught ahead of it in the same channel.
+ */
+void InfobotModule::Enqueue(const QueueItem &item)
+{
+	InputQueue &q = *input_queues[std::hash<int64_t>()(item.channelID) % input_queues.size()];
+	std::lock_guard<std::mutex> lock(q.mtx);
+	if (q.lines.size() >= input_queue_limit) {
+		auto unmentioned = std::find_if(q.lines.begin(), q.lines.end(), [](const QueueItem &i) { return !i.mentioned; });
+		if (unmentioned != q.lines.end()) {
+			q.lines.erase(unmentioned);
+		} else if (!item.mentioned) {
+			dropped_lines++;
+			return;
+		} else {
+			q.lines.pop_front();
+		}
+		dropped_lines++;
+	}
+	q.lines.push_back(item);
+	q.cv.notify_one();
+}
+
+void InfobotModule::InputWorker(size_t shard)
+{
+	InputQueue &q = *input_queues[shard];
+	while (!terminating) {
+		QueueItem item;
+		{
+			std::unique_lock<std::mutex> lock(q.mtx);
+			q.cv.wait(lock, [&]() { return terminating || !q.lines.empty(); });
+			if (terminating) {
+				break;
+			}
+			item = std::move(q.lines.front());
+			q.lines.pop_front();
+		}
+		try {
+			Input(item);
+		}
+		catch (const std::exception &e) {
+			bot->core->log(dpp::ll_error, fmt::format("Infobot worker {}: {}", shard, e.what()));
+		}
+	}
+}
+
+void InfobotModule::QueueOutput(const QueueItem &item)
+{
+	std::lock_guard<std::mutex> lock(output_mutex);
+	if (outputs.size() >= output_queue_limit && !item.mentioned) {
+		dropped_lines++;
+		return;
+	}
+	outputs.push_back(item);
+	output_cv.notify_one();
+}
+
+void InfobotModule::OutputThread()
+{
+	while (!terminating) {
+		QueueItem item;
+		{
+			std::unique_lock<std::mutex> lock(output_mutex);
+			output_cv.wait(lock, [&]() { return terminating || !outputs.empty(); });
+			if (terminating) {
+				break;
+			}
+			item = std::move(outputs.front());
+			outputs.pop_front();
+		}
+		try {
+			Output(item);
+		}
+		catch (const std::exception &e) {
+			bot->core->log(dpp::ll_error, fmt::format("Infobot output: {}", e.what()));
+		}
+	}
+}
@@ -22,6 +22,8 @@
 #include <string>
 #include <deque>
 #include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 #include <dpp/json_fwd.hpp>
 
 using json = nlohmann::json;
@@ -29,6 +31,10 @@ using json = nlohmann::json;
 struct QueueStats {
 	uint64_t users;
 	uint64_t guilds;
+	/* Lines waiting for an infobot worker, replies waiting to be sent, and lines dropped under overload */
+	uint64_t input;
+	uint64_t output;
+	uint64_t dropped;
 };
 
 /**
@@ -49,3 +55,14 @@ class QueueItem
 	bool mentioned;
 };
 
+
+/**
+ * Lines waiting for one infobot worker, answered in the order they arrived. Whether a
+ * line mentions the bot only matters when the queue is full and some must be dropped.
+ */
+struct InputQueue
+{
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<QueueItem> lines;
+};
@@ -0,0 +1,147 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+/**
+ * An in-memory index of the fact table which the maintenance thread rebuilds now and then,
+ * held to a memory budget. Changes made while a rebuild is running are applied to both the
+ * index in use and, once the scan has finished, the new one.
+ *
+ * Index needs a GetBytes() method, and Update is a change which apply() makes to an Index.
+ */
+template<typename Index, typename Update> class RebuildableIndex {
+
+	mutable std::shared_mutex mtx;
+	/* Null until the first build completes, or after passing the budget */
+	std::unique_ptr<Index> index;
+
+	/* Guards next and changes */
+	std::mutex rebuild_mtx;
+	std::unique_ptr<Index> next;
+	/* Changes made since the rebuild started, replayed over it before it is used */
+	std::vector<Update> changes;
+	size_t budget;
+	void (*apply)(Index&, const Update&);
+
+public:
+	RebuildableIndex(size_t default_budget, void (*apply_update)(Index&, const Update&)) : budget(default_budget), apply(apply_update)
+	{
+	}
+
+	/* Largest size in bytes the index may grow to, by a rebuild or by changes made since */
+	void SetBudget(size_t bytes)
+	{
+		budget = bytes;
+	}
+
+	size_t GetBudget() const
+	{
+		return budget;
+	}
+
+	/* Apply a change to the index in use. If that takes it over budget it is dropped until the next rebuild decides whether it fits */
+	void Apply(const Update &u)
+	{
+		{
+			std::lock_guard<std::mutex> lock(rebuild_mtx);
+			if (next) {
+				changes.push_back(u);
+			}
+		}
+		/* Declared first, so that it is freed after letting go of the lock */
+		std::unique_ptr<Index> dropped;
+		std::unique_lock<std::shared_mutex> lock(mtx);
+		if (index) {
+			apply(*index, u);
+			if (index->GetBytes() > budget) {
+				dropped = std::move(index);
+			}
+		}
+	}
+
+	/* Call read with the index in use, or return none if there isn't one */
+	template<typename R, typename F> R Read(F read, R none) const
+	{
+		std::shared_lock<std::shared_mutex> lock(mtx);
+		return index ? read(*index) : none;
+	}
+
+	bool IsReady() const
+	{
+		std::shared_lock<std::shared_mutex> lock(mtx);
+		return index != nullptr;
+	}
+
+	size_t GetBytes() const
+	{
+		std::shared_lock<std::shared_mutex> lock(mtx);
+		return index ? index->GetBytes() : 0;
+	}
+
+	void BeginRebuild()
+	{
+		std::lock_guard<std::mutex> lock(rebuild_mtx);
+		next = std::make_unique<Index>();
+		changes.clear();
+	}
+
+	/* Only the maintenance thread changes next, so the index being built is used without locking.
+	 * Returns false once it is over budget.
+	 */
+	bool AddToRebuild(const Update &u)
+	{
+		if (!next || next->GetBytes() > budget) {
+			return false;
+		}
+		apply(*next, u);
+		return true;
+	}
+
+	void CommitRebuild()
+	{
+		std::lock_guard<std::mutex> rebuild_lock(rebuild_mtx);
+		if (!next) {
+			return;
+		}
+		for (auto & u : changes) {
+			apply(*next, u);
+		}
+		changes.clear();
+		/* Free the old index after letting go of the lock, it can take a while */
+		std::unique_ptr<Index> old;
+		{
+			std::unique_lock<std::shared_mutex> lock(mtx);
+			index.swap(next);
+			old = std::move(next);
+		}
+	}
+
+	void AbortRebuild()
+	{
+		std::lock_guard<std::mutex> lock(rebuild_mtx);
+		next.reset();
+		changes.clear();
+	}
+};
@@ -0,0 +1,285 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <cstring>
+#include <sporks/rng.h>
+#include <sporks/stringops.h>
+#include "replies.h"
+
+/* Reply templates, indexed by reply_list */
+const reply_list_def reply_lists[rl_count] = {
+	/* rl_none */
+	{"", {}},
+	/* rl_replies */
+	{"", {"I heard %k %w %v", "They say %k %w %v", "%k %w %v... I think", "someone said %k %w %v", "%k %w like, %v", "%k %w %v", "%k %w %v, maybe?", "%s once said %k %w %v"}},
+	/* rl_dontknow */
+	{"<:wc_rs:667695516737470494>", {"Sorry %n I don't know what %k is.", "%k? no idea %n.", "I'm not a genius, %n...", "Its best to ask a real person about %k.", "Not a clue.", "Don't you know, %n?", "If i knew about %k i'd tell you.", "Never heard of %k", "%k isn't something im aware of", "%n, what are you jabbering about, fool?", "%n, i've not got any idea what %k is."}},
+	/* rl_notnew */
+	{"<:wc_rs:667695516737470494>", {"but %k %w %v :(", "fool, %k %w %v :p", "%k already %w %v...", "Are you sure, %n? I am sure that %k %w %v!", "NO! %k %w %v!!!"}},
+	/* rl_confirm */
+	{":white_check_mark:", {"Ok, %n", "Your wish is my command.", "Okay.", "Whatever...", "Gotcha.", "Ok.", "Right.", "If you say so.", "I understand", "Really? OK...", "Understood."}},
+	/* rl_locked */
+	{"<:wc_rs:667695516737470494>", {"You don't have the power, %n.", "No, I like that just the way it is.", "You can't edit that! The keyword '%k' has been locked against changes!"}},
+	/* rl_heard */
+	{":white_check_mark:", {"%s told me about %k on %d", "I learned that on %d, and i think it was %s that told me it.", "I think it was %s who said that, way back on %d...",  "%n: Back on %d, %s told me about %k"}},
+	/* rl_forgot */
+	{":white_check_mark:", {"I forgot %k", "%k is gone from my mind, %n", "As you wish.", "It's history.", "Done.", "%k is no more.", "Consider it gone.", "It's vanished." }}
+};
+
+namespace {
+	/* Letter after % for each reply_slot */
+	const char slot_letters[rs_count] = { 'k', 'w', 'n', 'm', 'd', 's', 'l', 'v' };
+
+	const ReplyTemplate empty_template("");
+
+	/* Tags which may appear in fact values, other than <list:...> */
+	const struct {
+		const char* text;
+		size_t length;
+	} tag_names[] = {
+		{ "", 0 },
+		{ "<me>", 4 },
+		{ "<who>", 5 },
+		{ "<random>", 8 },
+		{ "<date>", 6 },
+		{ "<now>", 5 },
+	};
+
+	const std::string list_tag = "<list:";
+
+	/* The same whitespace as \s in PCRE */
+	bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+	}
+
+	bool starts_with_nocase(const std::string &s, size_t pos, const std::string &prefix)
+	{
+		return s.length() - pos >= prefix.length() && lowercase(s.substr(pos, prefix.length())) == prefix;
+	}
+};
+
+ReplyTemplate::ReplyTemplate(const std::string &text)
+{
+	std::string literal;
+	for (size_t pos = 0; pos < text.length(); ++pos) {
+		reply_slot found = rs_none;
+		if (text[pos] == '%' && pos + 1 < text.length()) {
+			for (int s = 0; s < rs_count; ++s) {
+				if (text[pos + 1] == slot_letters[s]) {
+					found = static_cast<reply_slot>(s);
+					break;
+				}
+			}
+		}
+		if (found == rs_none) {
+			literal += text[pos];
+		} else {
+			parts.emplace_back(literal, found);
+			literal.clear();
+			pos++;
+		}
+	}
+	if (!literal.empty()) {
+		parts.emplace_back(literal, rs_none);
+	}
+}
+
+ReplyTemplate::ReplyTemplate(const char* text) : ReplyTemplate(std::string(text))
+{
+}
+
+std::string ReplyTemplate::Render(const std::string* values) const
+{
+	std::string out;
+	for (auto & p : parts) {
+		out += p.first;
+		if (p.second != rs_none) {
+			out += values[p.second];
+		}
+	}
+	return out;
+}
+
+const ReplyTemplate& pick_reply(reply_list list)
+{
+	const std::vector<ReplyTemplate> &templates = reply_lists[list].templates;
+	if (templates.empty()) {
+		return empty_template;
+	}
+	return templates[rng::below(templates.size())];
+}
+
+ReplyText::ReplyText() : uses_time(false)
+{
+}
+
+ReplyText::ReplyText(const std::string &text, bool lists) : uses_time(false)
+{
+	Parse(text, lists);
+}
+
+ReplyText::tag ReplyText::TagAt(const std::string &text, size_t pos, size_t &length)
+{
+	for (int t = tag_me; t <= tag_now; ++t) {
+		/* Case insensitive, as ReplaceString() was when tags were substituted on every reply */
+		if (text.length() - pos >= tag_names[t].length && stringkernels::iequals(text.data() + pos, tag_names[t].length, tag_names[t].text, tag_names[t].length)) {
+			length = tag_names[t].length;
+			return static_cast<tag>(t);
+		}
+	}
+	return tag_none;
+}
+
+void ReplyText::Parse(const std::string &text, bool lists)
+{
+	std::string literal;
+	size_t pos = 0;
+	while (pos < text.length()) {
+		size_t length = 0;
+		tag t = text[pos] == '<' ? TagAt(text, pos, length) : tag_none;
+		if (t != tag_none) {
+			parts.push_back({literal, t, {}});
+			literal.clear();
+			uses_time = uses_time || t == tag_date || t == tag_now;
+			pos += length;
+			continue;
+		}
+		if (lists && text[pos] == '<' && starts_with_nocase(text, pos, list_tag)) {
+			/* The list ends at the first '>' which doesn't close one of the other tags */
+			size_t end = pos + list_tag.length();
+			while (end < text.length() && text[end] != '>') {
+				size_t inner = 0;
+				end += (text[end] == '<' && TagAt(text, end, inner) != tag_none) ? inner : 1;
+			}
+			size_t start = pos + list_tag.length();
+			if (end < text.length() && end > start) {
+				part p = {literal, tag_list, {}};
+				for (auto & c : split_choices(text.substr(start, end - start), ',')) {
+					p.choices.emplace_back(c, false);
+					uses_time = uses_time || p.choices.back().uses_time;
+				}
+				parts.push_back(std::move(p));
+				literal.clear();
+				pos = end + 1;
+				continue;
+			}
+		}
+		literal += text[pos++];
+	}
+	if (!literal.empty()) {
+		parts.push_back({literal, tag_none, {}});
+	}
+}
+
+std::string ReplyText::Render(const std::string &nick, time_t timeval, const std::string &mynick, const std::string &randuser) const
+{
+	char timestr[256] = "";
+	char currentstr[256] = "";
+	if (uses_time) {
+		tm _tm;
+		time_t now = time(NULL);
+		gmtime_r(&timeval, &_tm);
+		strftime(timestr, 255, "%c", &_tm);
+		localtime_r(&now, &_tm);
+		strftime(currentstr, 255, "%c", &_tm);
+	}
+
+	std::string out;
+	for (auto & p : parts) {
+		out += p.literal;
+		switch (p.t) {
+			case tag_me: out += mynick; break;
+			case tag_who: out += nick; break;
+			case tag_random: out += randuser; break;
+			case tag_date: out += timestr; break;
+			case tag_now: out += currentstr; break;
+			case tag_list:
+				if (!p.choices.empty()) {
+					out += p.choices[rng::below(p.choices.size())].Render(nick, timeval, mynick, randuser);
+				}
+			break;
+			default: break;
+		}
+	}
+
+	if (out == "%v") {
+		return "";
+	}
+	return out;
+}
+
+std::vector<std::string> split_choices(const std::string &s, char delim)
+{
+	std::vector<std::string> v;
+	size_t start = 0, pos;
+	while ((pos = s.find(delim, start)) != std::string::npos) {
+		v.push_back(s.substr(start, pos - start));
+		start = pos + 1;
+	}
+	if (v.empty() || start < s.length()) {
+		v.push_back(s.substr(start));
+	}
+	return v;
+}
+
+std::shared_ptr<const parsed_value> parse_value(const std::string &value)
+{
+	auto parsed = std::make_shared<parsed_value>();
+	for (auto & text : split_choices(value, '|')) {
+		value_choice c = {text, vk_plain, "", ReplyText()};
+		const struct {
+			const char* tag;
+			value_kind kind;
+		} kinds[] = { { "<reply>", vk_reply }, { "<action>", vk_action }, { "<embed>", vk_embed } };
+		for (auto & k : kinds) {
+			if (starts_with_nocase(text, 0, k.tag)) {
+				size_t start = strlen(k.tag);
+				while (start < text.length() && is_space(text[start])) {
+					start++;
+				}
+				c.kind = k.kind;
+				c.body = text.substr(start);
+				c.expanded = ReplyText(c.body);
+				break;
+			}
+		}
+		parsed->choices.push_back(std::move(c));
+	}
+	return parsed;
+}
+
+std::shared_ptr<const parsed_value> parsed_value_of(infodef &def)
+{
+	if (!def.parsed) {
+		def.parsed = parse_value(def.value);
+	}
+	return def.parsed;
+}
+
+const value_choice& parsed_value::Pick() const
+{
+	return choices[rng::below(choices.size())];
+}
+
+std::string expand(const std::string &str, const std::string &nick, time_t timeval, const std::string &mynick, const std::string &randuser)
+{
+	return ReplyText(str).Render(nick, timeval, mynick, randuser);
+}
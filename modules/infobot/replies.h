@@ -0,0 +1,145 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <ctime>
+#include "backend.h"
+
+/* The lists of reply templates, see reply_lists[] */
+enum reply_list {
+	rl_none = 0,
+	rl_replies,	/* Positive replies to question: Response found */
+	rl_dontknow,	/* Negative replies to question: No response found */
+	rl_notnew,	/* Negative replies: Response found, but refusing to overwrite it */
+	rl_confirm,	/* Confirmation that the bot has learned a phrase */
+	rl_locked,	/* Rejection of a new phrase due to the existing phrase being locked */
+	rl_heard,	/* Plaintext version of the "who told you about" embed for talkative mode */
+	rl_forgot,	/* Confirmation that the bot has deleted a phrase */
+	rl_count
+};
+
+/* The %-placeholders in a reply template, in the order ReplyTemplate::Render() takes their values */
+enum reply_slot {
+	rs_key = 0,	/* %k */
+	rs_word,	/* %w */
+	rs_nick,	/* %n */
+	rs_mynick,	/* %m */
+	rs_date,	/* %d */
+	rs_setby,	/* %s */
+	rs_locked,	/* %l */
+	rs_value,	/* %v */
+	rs_count,
+	rs_none = rs_count
+};
+
+/**
+ * A reply template split at its %-placeholders. Renders in one pass, so text substituted
+ * for one placeholder is never searched for another.
+ */
+class ReplyTemplate {
+	std::vector<std::pair<std::string, reply_slot>> parts;
+public:
+	ReplyTemplate(const std::string &text);
+	ReplyTemplate(const char* text);
+	std::string Render(const std::string* values) const;
+};
+
+struct reply_list_def {
+	/* Shown before the reply when it is sent as an embed */
+	std::string emoji;
+	std::vector<ReplyTemplate> templates;
+};
+
+extern const reply_list_def reply_lists[rl_count];
+
+/* A random template from a reply list */
+const ReplyTemplate& pick_reply(reply_list list);
+
+/**
+ * Text containing <me>, <who>, <random>, <date> and <now> tags and <list:a,b,c> choices,
+ * parsed once so that it can be expanded in one pass.
+ */
+class ReplyText {
+	enum tag {
+		tag_none,
+		tag_me,
+		tag_who,
+		tag_random,
+		tag_date,
+		tag_now,
+		tag_list
+	};
+	struct part {
+		std::string literal;
+		tag t;
+		/* For tag_list */
+		std::vector<ReplyText> choices;
+	};
+	std::vector<part> parts;
+	bool uses_time;
+
+	static tag TagAt(const std::string &text, size_t pos, size_t &length);
+	void Parse(const std::string &text, bool lists);
+public:
+	ReplyText();
+	explicit ReplyText(const std::string &text, bool lists = true);
+	std::string Render(const std::string &nick, time_t timeval, const std::string &mynick, const std::string &randuser) const;
+};
+
+/* How a fact value is to be sent */
+enum value_kind {
+	vk_plain,
+	vk_reply,	/* <reply>text: sent as is */
+	vk_action,	/* <action>text: sent in italics */
+	vk_embed	/* <embed>json: sent as an embed */
+};
+
+/* One of the '|' separated alternatives of a fact value */
+struct value_choice {
+	std::string text;
+	value_kind kind;
+	/* For kinds other than vk_plain, the text after the tag */
+	std::string body;
+	ReplyText expanded;
+};
+
+/**
+ * A fact value split into its alternatives. Parsed once when a fact is cached, and
+ * carried in infodef::parsed from then on.
+ */
+struct parsed_value {
+	std::vector<value_choice> choices;
+	const value_choice& Pick() const;
+};
+
+std::shared_ptr<const parsed_value> parse_value(const std::string &value);
+
+/* The parsed value of a fact, parsing it now if it wasn't cached */
+std::shared_ptr<const parsed_value> parsed_value_of(infodef &def);
+
+/* Split s at each delim. A trailing empty part is dropped, as in "a|b|" */
+std::vector<std::string> split_choices(const std::string &s, char delim);
+
+/* Expand tags and choose from lists in text, see ReplyText */
+std::string expand(const std::string &str, const std::string &nick, time_t timeval, const std::string &mynick, const std::string &randuser);
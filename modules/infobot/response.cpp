@@ -25,6 +25,7 @@
 #include <string>
 #include <sstream>
 #include <sporks/bot.h>
+#include <sporks/outbound.h>
 #include <sporks/regex.h>
 #include "queue.h"
 #include <sporks/config.h>
@@ -73,10 +74,8 @@ void InfobotModule::Output(QueueItem &done) {
 			message = ReplaceString(message, "<s>", "|");
 			bot->core->log(dpp::ll_info, fmt::format("<{}> {}", done.original_username, done.original_message));
 			bot->core->log(dpp::ll_info, fmt::format("<{} ({}/{})> {}", bot->user.username, done.serverID, done.channelID, message));
-			if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == done.serverID) {
-				bot->core->message_create(dpp::message(done.channelID, message));
-				bot->sent_messages++;
-			}
+			/* Several answers for a busy channel can go out as one message */
+			bot->outbound->Send(dpp::message(done.channelID, message), done.serverID, true);
 		}
 		catch (const std::exception &e) {
 			bot->core->log(dpp::ll_error, fmt::format("Can't send message to channel id {}, (talkative={},mentioned={}), error is: {}", done.channelID, settings::IsTalkative(channel_settings), done.mentioned, e.what()));
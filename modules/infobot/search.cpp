@@ -0,0 +1,310 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+#include "backend.h"
+#include "search.h"
+
+FactSearch factsearch;
+
+/* Longest word indexed, anything longer is likely a URL or noise */
+static constexpr size_t max_word_length = 32;
+
+/* Posting lists longer than this are skipped when looking for partial matches, so
+ * that a query of common words can't take long
+ */
+static constexpr uint32_t partial_match_limit = 100000;
+
+/* Candidates examined for ranking before giving up on finding better ones */
+static constexpr size_t max_ranked = 2000;
+
+/* Words too common to be worth indexing */
+static const std::unordered_set<std::string> stopwords = {
+	"a", "an", "and", "are", "as", "at", "be", "by", "do", "for", "from", "has", "have", "he", "her", "his",
+	"i", "if", "in", "is", "it", "its", "me", "my", "no", "not", "of", "on", "or", "so", "that", "the",
+	"their", "them", "they", "this", "to", "was", "we", "what", "when", "where", "who", "will", "with", "you", "your"
+};
+
+SearchIndex::SearchIndex() : bytes(0)
+{
+}
+
+std::vector<std::string> SearchIndex::Tokenise(const std::string &text)
+{
+	std::vector<std::string> words;
+	std::string word;
+	for (size_t i = 0; i <= text.length(); ++i) {
+		unsigned char c = i < text.length() ? text[i] : ' ';
+		/* Bytes of UTF-8 multibyte sequences count as letters, so that non-English words survive */
+		if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) {
+			word += c;
+		} else if (c >= 'A' && c <= 'Z') {
+			word += c | 0x20;
+		} else if (!word.empty()) {
+			if (word.length() <= max_word_length && stopwords.find(word) == stopwords.end()) {
+				words.push_back(word);
+			}
+			word.clear();
+		}
+	}
+	std::sort(words.begin(), words.end());
+	words.erase(std::unique(words.begin(), words.end()), words.end());
+	return words;
+}
+
+void SearchIndex::Append(postings &p, uint32_t document)
+{
+	uint32_t gap = p.count ? document - p.last : document;
+	while (gap >= 0x80) {
+		p.data += (char)((gap & 0x7F) | 0x80);
+		gap >>= 7;
+	}
+	p.data += (char)gap;
+	p.last = document;
+	p.count++;
+}
+
+/* Decode a posting list, stopping after the first document above up_to */
+std::vector<uint32_t> SearchIndex::Decode(const postings &p, uint32_t up_to)
+{
+	std::vector<uint32_t> documents;
+	documents.reserve(p.count);
+	const unsigned char* d = (const unsigned char*)p.data.data();
+	const unsigned char* end = d + p.data.length();
+	uint32_t document = 0;
+	while (d < end) {
+		uint32_t gap = 0;
+		int shift = 0;
+		while (d < end && (*d & 0x80)) {
+			gap |= (uint32_t)(*d++ & 0x7F) << shift;
+			shift += 7;
+		}
+		if (d < end) {
+			gap |= (uint32_t)(*d++) << shift;
+		}
+		document = documents.empty() ? gap : document + gap;
+		documents.push_back(document);
+		if (document > up_to) {
+			break;
+		}
+	}
+	return documents;
+}
+
+void SearchIndex::Add(const std::string &key, const std::string &value)
+{
+	std::string normalised = normalise_key(key);
+	Remove(normalised);
+
+	uint32_t document = keys.size();
+	keys.push_back(key);
+	documents[normalised] = document;
+	bytes += key.length() + normalised.length() + sizeof(std::string) + 64;
+
+	for (auto & word : Tokenise(key + " " + value)) {
+		auto t = terms.find(word);
+		if (t == terms.end()) {
+			t = terms.emplace(word, postings()).first;
+			bytes += word.length() + sizeof(postings) + 64;
+		}
+		size_t capacity = t->second.data.capacity();
+		Append(t->second, document);
+		bytes += t->second.data.capacity() - capacity;
+	}
+}
+
+void SearchIndex::Remove(const std::string &key)
+{
+	auto d = documents.find(normalise_key(key));
+	if (d == documents.end()) {
+		return;
+	}
+	std::string &k = keys[d->second];
+	bytes -= std::min(bytes, k.length() + d->first.length() + 64);
+	std::string().swap(k);
+	documents.erase(d);
+}
+
+std::vector<std::string> SearchIndex::Search(const std::string &query, size_t max_results) const
+{
+	std::vector<std::string> results;
+	std::vector<std::string> words = Tokenise(query);
+	std::vector<const postings*> lists;
+	for (auto & w : words) {
+		auto t = terms.find(w);
+		if (t != terms.end()) {
+			lists.push_back(&t->second);
+		}
+	}
+	if (lists.empty() || max_results == 0) {
+		return results;
+	}
+	std::sort(lists.begin(), lists.end(), [](const postings* a, const postings* b) { return a->count < b->count; });
+
+	/* Documents with the number of query words each contains */
+	std::vector<std::pair<uint32_t, size_t>> candidates;
+	if (lists.size() == words.size()) {
+		/* Intersect, shortest list first, so later lists only need decoding as far as the last candidate */
+		std::vector<uint32_t> matching = Decode(*lists[0], UINT32_MAX);
+		for (size_t i = 1; i < lists.size() && !matching.empty(); ++i) {
+			std::vector<uint32_t> other = Decode(*lists[i], matching.back());
+			std::vector<uint32_t> both;
+			std::set_intersection(matching.begin(), matching.end(), other.begin(), other.end(), std::back_inserter(both));
+			matching.swap(both);
+		}
+		for (auto d : matching) {
+			candidates.emplace_back(d, words.size());
+		}
+	}
+	if (candidates.empty() && words.size() > 1) {
+		/* No fact has every word, settle for those with at least half of them */
+		std::unordered_map<uint32_t, size_t> counts;
+		for (auto l : lists) {
+			if (l->count <= partial_match_limit) {
+				for (auto d : Decode(*l, UINT32_MAX)) {
+					counts[d]++;
+				}
+			}
+		}
+		size_t needed = std::max<size_t>(1, words.size() / 2);
+		for (auto & c : counts) {
+			if (c.second >= needed) {
+				candidates.emplace_back(c.first, c.second);
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
+	}
+
+	/* Newest facts first, then rank by words matched, counting words in the key twice */
+	struct ranked {
+		uint32_t document;
+		size_t score;
+	};
+	std::vector<ranked> ranking;
+	for (auto c = candidates.rbegin(); c != candidates.rend() && ranking.size() < max_ranked; ++c) {
+		const std::string &key = keys[c->first];
+		if (key.empty()) {
+			continue;
+		}
+		size_t in_key = 0;
+		for (auto & kw : Tokenise(key)) {
+			if (std::binary_search(words.begin(), words.end(), kw)) {
+				in_key++;
+			}
+		}
+		ranking.push_back({c->first, c->second + in_key});
+	}
+	std::stable_sort(ranking.begin(), ranking.end(), [](const ranked &a, const ranked &b) { return a.score > b.score; });
+	for (size_t i = 0; i < ranking.size() && results.size() < max_results; ++i) {
+		results.push_back(keys[ranking[i].document]);
+	}
+	return results;
+}
+
+size_t SearchIndex::GetBytes() const
+{
+	return bytes + keys.capacity() * sizeof(std::string);
+}
+
+size_t SearchIndex::GetTerms() const
+{
+	return terms.size();
+}
+
+size_t SearchIndex::GetKeys() const
+{
+	return documents.size();
+}
+
+FactSearch::FactSearch() : indexes(512 * 1024 * 1024, &FactSearch::Apply)
+{
+}
+
+void FactSearch::Apply(SearchIndex &index, const change &c)
+{
+	if (c.deleted) {
+		index.Remove(c.key);
+	} else {
+		index.Add(c.key, c.value);
+	}
+}
+
+void FactSearch::SetBudget(size_t bytes)
+{
+	indexes.SetBudget(bytes);
+}
+
+size_t FactSearch::GetBudget()
+{
+	return indexes.GetBudget();
+}
+
+void FactSearch::Put(const std::string &key, const std::string &value)
+{
+	indexes.Apply({key, value, false});
+}
+
+void FactSearch::Erase(const std::string &key)
+{
+	indexes.Apply({key, "", true});
+}
+
+std::vector<std::string> FactSearch::Search(const std::string &query, size_t max_results) const
+{
+	return indexes.Read([&](const SearchIndex &index) { return index.Search(query, max_results); }, std::vector<std::string>());
+}
+
+bool FactSearch::IsReady() const
+{
+	return indexes.IsReady();
+}
+
+size_t FactSearch::GetBytes() const
+{
+	return indexes.GetBytes();
+}
+
+size_t FactSearch::GetTerms() const
+{
+	return indexes.Read([](const SearchIndex &index) { return index.GetTerms(); }, (size_t)0);
+}
+
+void FactSearch::BeginRebuild()
+{
+	indexes.BeginRebuild();
+}
+
+bool FactSearch::AddToRebuild(const std::string &key, const std::string &value)
+{
+	return indexes.AddToRebuild({key, value, false});
+}
+
+void FactSearch::CommitRebuild()
+{
+	indexes.CommitRebuild();
+}
+
+void FactSearch::AbortRebuild()
+{
+	indexes.AbortRebuild();
+}
@@ -0,0 +1,117 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include "rebuildable.h"
+
+/**
+ * An inverted index of the words in every fact's key and value, so that facts can be
+ * found by what they say rather than only by their exact key.
+ *
+ * Each fact gets a document number when it is added. A fact which changes gets a new
+ * number and its old one is marked removed, so numbers only ever grow and every posting
+ * list stays sorted by appending. Posting lists are stored as the varint encoded gaps
+ * between document numbers, which is one byte for most entries.
+ */
+class SearchIndex {
+
+	struct postings {
+		std::string data;
+		uint32_t last = 0;
+		uint32_t count = 0;
+	};
+
+	/* Document number to the fact's key, empty once removed */
+	std::vector<std::string> keys;
+	/* normalise_key() of a fact's key to its current document number */
+	std::unordered_map<std::string, uint32_t> documents;
+	std::unordered_map<std::string, postings> terms;
+	size_t bytes;
+
+	static void Append(postings &p, uint32_t document);
+	static std::vector<uint32_t> Decode(const postings &p, uint32_t up_to);
+
+public:
+	SearchIndex();
+
+	/* Split text into lowercase words, without duplicates */
+	static std::vector<std::string> Tokenise(const std::string &text);
+
+	/* Add or replace a fact */
+	void Add(const std::string &key, const std::string &value);
+	void Remove(const std::string &key);
+
+	/* Keys of facts containing all of the words in the query, or if there are none, the
+	 * facts containing the most of them. Facts whose key has the words come first.
+	 */
+	std::vector<std::string> Search(const std::string &query, size_t max_results) const;
+
+	/* Approximate heap use */
+	size_t GetBytes() const;
+	size_t GetTerms() const;
+	size_t GetKeys() const;
+};
+
+/**
+ * The search index in use, and the rebuilding of it by the maintenance thread.
+ */
+class FactSearch {
+
+	struct change {
+		std::string key;
+		std::string value;
+		bool deleted;
+	};
+
+	static void Apply(SearchIndex &index, const change &c);
+
+	RebuildableIndex<SearchIndex, change> indexes;
+
+public:
+	FactSearch();
+
+	/* Largest size in bytes the index may grow to, by a rebuild or by facts learned since */
+	void SetBudget(size_t bytes);
+	size_t GetBudget();
+
+	/* Add or replace a fact. The index is dropped until the next rebuild if this takes it over budget */
+	void Put(const std::string &key, const std::string &value);
+	void Erase(const std::string &key);
+
+	std::vector<std::string> Search(const std::string &query, size_t max_results) const;
+
+	bool IsReady() const;
+	size_t GetBytes() const;
+	size_t GetTerms() const;
+
+	void BeginRebuild();
+	/* Returns false once the index being built is over budget */
+	bool AddToRebuild(const std::string &key, const std::string &value);
+	void CommitRebuild();
+	void AbortRebuild();
+};
+
+extern FactSearch factsearch;
@@ -0,0 +1,83 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <unordered_map>
+#include <future>
+#include <mutex>
+#include <atomic>
+
+/**
+ * Collapses concurrent calls for the same key into one. The first caller for a key
+ * runs the function, and anyone asking for the same key while it runs waits for and
+ * shares its result (or exception) instead of running it again.
+ */
+template<typename Key, typename Value> class SingleFlight {
+	std::mutex mtx;
+	std::unordered_map<Key, std::shared_future<Value>> in_flight;
+	std::atomic<uint64_t> executed;
+	std::atomic<uint64_t> collapsed;
+
+	void Done(const Key &key) {
+		std::lock_guard<std::mutex> lock(mtx);
+		in_flight.erase(key);
+	}
+
+public:
+	SingleFlight() : executed(0), collapsed(0) {
+	}
+
+	template<typename Function> Value Do(const Key &key, Function fn) {
+		std::promise<Value> promise;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			auto i = in_flight.find(key);
+			if (i != in_flight.end()) {
+				std::shared_future<Value> result = i->second;
+				lock.unlock();
+				collapsed++;
+				return result.get();
+			}
+			in_flight.emplace(key, promise.get_future().share());
+		}
+		executed++;
+		try {
+			Value v = fn();
+			Done(key);
+			promise.set_value(v);
+			return v;
+		}
+		catch (...) {
+			Done(key);
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+	}
+
+	/* Number of calls which ran the function */
+	uint64_t GetExecuted() {
+		return executed;
+	}
+
+	/* Number of calls which shared another call's result */
+	uint64_t GetCollapsed() {
+		return collapsed;
+	}
+};
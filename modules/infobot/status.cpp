@@ -22,12 +22,17 @@
 #include <iostream>
 #include <ctime>
 #include <sporks/bot.h>
+#include <sporks/embeds.h>
 #include <sporks/regex.h>
 #include <sporks/stringops.h>
 #include <sporks/statusfield.h>
 #include <fmt/format.h>
 #include <dpp/nlohmann/json.hpp>
 #include "infobot.h"
+#include "factcache.h"
+#include "factcount.h"
+#include "search.h"
+#include "keytrie.h"
 
 using json = nlohmann::json;
 
@@ -35,8 +40,6 @@ using json = nlohmann::json;
  * Report status to discord as a pretty embed
  */
 void InfobotModule::ShowStatus(int days, int hours, int minutes, int seconds, uint64_t db_changes, uint64_t questions, uint64_t facts, time_t startup, int64_t channelID) {
-	std::stringstream s;
-
 	uint64_t servers = dpp::get_guild_cache()->count();
 	uint64_t users = dpp::get_user_cache()->count();
 	uint64_t members = 0;
@@ -54,55 +57,46 @@ void InfobotModule::ShowStatus(int days, int hours, int minutes, int seconds, ui
 	gmtime_r(&startup, &_tm);
 	strftime(startstr, 255, "%c", &_tm);
 
+	uint64_t cache_hits = factcache.GetHits();
+	uint64_t cache_lookups = cache_hits + factcache.GetMisses();
+	char hitrate[32];
+	snprintf(hitrate, 32, "%.1f%%", cache_lookups ? (double)cache_hits * 100.0 / (double)cache_lookups : 0.0);
+
+	dpp::channel* c = dpp::find_channel(channelID);
+	int64_t guild_id = c ? (int64_t)c->guild_id : 0;
+
 	const statusfield statusfields[] = {
 		statusfield("Database Changes", Comma(db_changes)),
 		statusfield("Connected Since", startstr),
 		statusfield("Questions", Comma(questions)),
-		statusfield("Approx. Fact Count", Comma(facts)),
+		statusfield(factcount.IsExact() ? "Fact Count" : "Approx. Fact Count", Comma(facts)),
 		statusfield("Total Servers", Comma(servers)),
 		statusfield("Unique Users", Comma(users)),
 		statusfield("Members", Comma(members)),
-		statusfield("Queue State", "U:"+Comma(qs.users)+", G:"+Comma(qs.guilds)),
+		statusfield("Queue State", "U:"+Comma(qs.users)+", G:"+Comma(qs.guilds)+", I:"+Comma(qs.input)+", O:"+Comma(qs.output)+", D:"+Comma(qs.dropped)),
+		statusfield("Fact Cache", std::string(hitrate) + " of " + Comma(cache_lookups) + " (" + Comma(factcache.GetSize()) + " keys)"),
+		statusfield("Search Index", factsearch.IsReady() ? Comma(factsearch.GetTerms()) + " words, " + dpp::utility::bytes(factsearch.GetBytes()) + " of " + dpp::utility::bytes(factsearch.GetBudget()) : "Not built"),
+		statusfield("Member Index", Comma(this->members.GetCount()) + " in " + dpp::utility::bytes(this->members.GetBytes()) + ", this server " + Comma(this->members.GetCount(guild_id)) + " in " + dpp::utility::bytes(this->members.GetBytes(guild_id))),
+		statusfield("Key Index", factkeys.IsReady() ? dpp::utility::bytes(factkeys.GetBytes()) + " of " + dpp::utility::bytes(factkeys.GetBudget()) : "Not built"),
+		statusfield("Collapsed Lookups", Comma(factlookups.GetCollapsed()) + " of " + Comma(factlookups.GetExecuted() + factlookups.GetCollapsed())),
 		statusfield("Uptime", std::string(uptime)),
 		statusfield("Shards", Comma(bot->core->get_shards().size())),
 		statusfield("Test Mode", bot->IsTestMode() ? ":white_check_mark: Yes" : "<:wc_rs:667695516737470494> No"),
 		statusfield("Developer Mode", bot->IsDevMode() ? ":white_check_mark: Yes" : "<:wc_rs:667695516737470494> No"),
 		statusfield("Member Intent", bot->HasMemberIntents() ? ":white_check_mark: Yes" : "<:wc_rs:667695516737470494> No"),
 		statusfield("Bot Version", "4.0"),
-		statusfield("Library", "<:D_:830553370792165376> [" + std::string(DPP_VERSION_TEXT) + "](https://github.com/brainboxdotcc/DPP)"),
-		statusfield("","")
+		statusfield("Library", "<:D_:830553370792165376> [" + std::string(DPP_VERSION_TEXT) + "](https://github.com/brainboxdotcc/DPP)")
 	};
 
-	s << "{\"title\":\"" << bot->user.username;
-	s << " status";
-	s << "\",\"color\":16767488,\"url\":\"https:\\/\\/sporks.gg\\/\\/\",\"image\":{\"url\":\"https:\\/\\/sporks.gg\\/graphs\\/daylearned.php?now=" << time(NULL);
-	s << "\"},\"footer\":{\"link\":\"https;\\/\\/sporks.gg\\/\",\"text\":\"Powered by Sporks!\",\"icon_url\":\"https:\\/\\/sporks.gg\\/images\\/sporks_2020.png\"},\"fields\":[";
-	for (int i = 0; statusfields[i].name != ""; ++i) {
-		s << "{\"name\":\"" +  statusfields[i].name + "\",\"value\":\"" + statusfields[i].value + "\", \"inline\": true}";
-		if (statusfields[i + 1].name != "") {
-			s << ",";
-		}
-	}
-	s << "],\"description\":\"\"}";
-
-	json embed_json;
-	try {
-		embed_json = json::parse(s.str());
-	}
-	catch (const std::exception &e) {
-		bot->core->log(dpp::ll_error, fmt::format("Malformed json created when reporting status: {}", s.str()));
+	EmbedBuilder embed;
+	embed.Title(bot->user.username + " status")
+		.Url("https://sporks.gg/")
+		.Image("https://sporks.gg/graphs/daylearned.php?now=" + std::to_string(time(NULL)))
+		.Footer();
+	for (auto & f : statusfields) {
+		embed.Field(f.name, f.value, true);
 	}
-	dpp::channel* channel = dpp::find_channel(channelID);
-	if (channel) {
-		if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-			dpp::message m;
-			m.channel_id = channelID;
-			m.embeds.push_back(&embed_json);
-			bot->core->message_create(m, [this](const dpp::confirmation_callback_t & state) {
-			});
-			bot->sent_messages++;
-		}
-	} else {
+	if (!embed.Send(bot, channelID)) {
 		bot->core->log(dpp::ll_error, fmt::format("Invalid channel id for status: {}", channelID));
 	}
 }
@@ -0,0 +1,100 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "bytecode.h"
+#include "duktape.h"
+
+/* Largest script we expect to read back; anything bigger is treated as a damaged file */
+const uint64_t max_bytecode = 16 * 1024 * 1024;
+
+struct bytecode_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t hash;
+	uint64_t length;
+};
+
+BytecodeCache::BytecodeCache(const std::string &cache_dir) : dir(cache_dir)
+{
+	if (!dir.empty()) {
+		mkdir(dir.c_str(), 0700);
+	}
+}
+
+uint64_t BytecodeCache::Hash(const std::string &source)
+{
+	/* 64 bit FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (unsigned char c : source) {
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+std::string BytecodeCache::Filename(uint64_t channel_id) const
+{
+	return dir + "/" + std::to_string(channel_id) + ".dbc";
+}
+
+bool BytecodeCache::Load(uint64_t channel_id, uint64_t hash, std::string &bytecode) const
+{
+	if (dir.empty()) {
+		return false;
+	}
+	FILE* f = fopen(Filename(channel_id).c_str(), "rb");
+	if (!f) {
+		return false;
+	}
+	bytecode_header h;
+	bool valid = (fread(&h, sizeof(h), 1, f) == 1 && std::string(h.magic, 4) == "SPJB" && h.version == DUK_VERSION && h.hash == hash && h.length > 0 && h.length <= max_bytecode);
+	if (valid) {
+		bytecode.resize(h.length);
+		valid = (fread(&bytecode[0], h.length, 1, f) == 1 && fgetc(f) == EOF);
+	}
+	fclose(f);
+	if (!valid) {
+		bytecode.clear();
+	}
+	return valid;
+}
+
+bool BytecodeCache::Save(uint64_t channel_id, uint64_t hash, const std::string &bytecode) const
+{
+	if (dir.empty() || bytecode.empty()) {
+		return false;
+	}
+	std::string filename = Filename(channel_id);
+	FILE* f = fopen((filename + ".tmp").c_str(), "wb");
+	if (!f) {
+		return false;
+	}
+	bytecode_header h = { {'S', 'P', 'J', 'B'}, DUK_VERSION, hash, bytecode.length() };
+	bool written = (fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(bytecode.data(), bytecode.length(), 1, f) == 1);
+	written = (fclose(f) == 0) && written;
+	if (!written || rename((filename + ".tmp").c_str(), filename.c_str()) != 0) {
+		remove((filename + ".tmp").c_str());
+		return false;
+	}
+	return true;
+}
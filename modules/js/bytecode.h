@@ -0,0 +1,50 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <cstdint>
+
+/**
+ * Compiled scripts, saved to disk as Duktape bytecode so that a restart doesn't have to
+ * compile every channel's script again.
+ *
+ * Each channel has one file in the cache directory, named after the channel id. Its header
+ * holds the Duktape version which made it and a hash of the source it was compiled from,
+ * and a file is only used when both still match. Bytecode isn't checked by Duktape when it
+ * is loaded, so nothing but this cache should ever write to the directory.
+ */
+class BytecodeCache {
+	std::string dir;
+
+	std::string Filename(uint64_t channel_id) const;
+public:
+	/* Use dir as the cache directory, creating it if needed. An empty dir disables the cache */
+	BytecodeCache(const std::string &cache_dir);
+
+	/* Hash of a script's source, used to tell if cached bytecode is still current */
+	static uint64_t Hash(const std::string &source);
+
+	/* Fill bytecode with the cached copy for this channel and hash, returns false if there isn't one */
+	bool Load(uint64_t channel_id, uint64_t hash, std::string &bytecode) const;
+
+	/* Save bytecode for this channel and hash, replacing any previous copy */
+	bool Save(uint64_t channel_id, uint64_t hash, const std::string &bytecode) const;
+};
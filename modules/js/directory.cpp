@@ -0,0 +1,188 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <dpp/dpp.h>
+#include <fmt/format.h>
+#include <sporks/bot.h>
+#include <sporks/database.h>
+#include <sporks/stringops.h>
+#include <sporks/config.h>
+#include "directory.h"
+#include "triggers.h"
+
+/* How long a vote boosts a guild owner's script quotas */
+const time_t vote_lifetime = 60 * 60 * 24;
+
+ScriptDirectory::ScriptDirectory(Bot* _bot, time_t _interval) : bot(_bot), interval(_interval), last_version(0), triggers_warned(false), terminating(false), refresher(nullptr)
+{
+	RefreshChannels();
+	RefreshVotes();
+	refresher = new std::thread(&ScriptDirectory::Refresher, this);
+}
+
+ScriptDirectory::~ScriptDirectory()
+{
+	{
+		std::lock_guard<std::mutex> lock(wait_mutex);
+		terminating = true;
+	}
+	wait_cv.notify_all();
+	bot->DisposeThread(refresher);
+}
+
+bool ScriptDirectory::RefreshChannels()
+{
+	db::resultset rs = db::query("SELECT id, dirty, updated, triggers FROM infobot_discord_javascript", {});
+	if (!db::error().empty()) {
+		/* Databases without the triggers column (see mysql-schema/upgrade.sql) run every script for every message */
+		std::string error = db::error();
+		rs = db::query("SELECT id, dirty, updated, '' AS triggers FROM infobot_discord_javascript", {});
+		if (!db::error().empty()) {
+			bot->core->log(dpp::ll_error, fmt::format("Can't refresh scripted channels: {}", db::error()));
+			return false;
+		}
+		if (!triggers_warned) {
+			bot->core->log(dpp::ll_warning, fmt::format("Script triggers are disabled, can't read the triggers column: {}", error));
+			triggers_warned = true;
+		}
+	}
+
+	std::unordered_map<uint64_t, channel_entry> found;
+	std::vector<db::row> dirty;
+	std::vector<std::pair<uint64_t, std::string>> errors;
+	{
+		std::shared_lock<std::shared_mutex> lock(mtx);
+		for (auto & row : rs) {
+			uint64_t id = from_string<uint64_t>(row["id"], std::dec);
+			auto existing = channels.find(id);
+			channel_entry entry;
+			if (existing != channels.end()) {
+				entry = existing->second;
+			} else {
+				/* Versions are never reused, so a script deleted and added again isn't mistaken for the old one */
+				entry.version = ++last_version;
+			}
+			if (row["dirty"] == "1") {
+				entry.version = ++last_version;
+				dirty.push_back(row);
+			}
+			/* Filters are only built again when their configuration changes */
+			if (existing == channels.end() || entry.triggers != row["triggers"]) {
+				entry.triggers = row["triggers"];
+				entry.filter = nullptr;
+				if (!trim(entry.triggers).empty()) {
+					try {
+						entry.filter = std::make_shared<const TriggerFilter>(entry.triggers);
+					}
+					catch (regex_exception* e) {
+						errors.push_back(std::make_pair(id, "Invalid trigger regex: " + e->message));
+						delete e;
+					}
+					catch (const std::exception &e) {
+						errors.push_back(std::make_pair(id, std::string("Invalid triggers: ") + e.what()));
+					}
+				}
+			}
+			found[id] = entry;
+		}
+	}
+	{
+		std::unique_lock<std::shared_mutex> lock(mtx);
+		channels.swap(found);
+	}
+
+	/* Only clear the flag if the row hasn't changed since it was read. If it has, it is seen
+	 * as dirty again next time, and reloaded once more.
+	 */
+	for (auto & row : dirty) {
+		db::query("UPDATE infobot_discord_javascript SET dirty = 0 WHERE id = ? AND updated = '?'", {row["id"], row["updated"]});
+	}
+	/* A script with broken triggers runs for every message, rather than silently never running */
+	for (auto & error : errors) {
+		bot->core->log(dpp::ll_warning, fmt::format("Channel {}: {}", error.first, error.second));
+		settings::setJSConfig(error.first, "last_error", error.second);
+	}
+	return true;
+}
+
+bool ScriptDirectory::RefreshVotes()
+{
+	db::resultset rs = db::query("SELECT snowflake_id, UNIX_TIMESTAMP(MAX(vote_time)) AS vote_time FROM infobot_votes WHERE vote_time > now() - INTERVAL 1 DAY GROUP BY snowflake_id", {});
+	if (!db::error().empty()) {
+		bot->core->log(dpp::ll_error, fmt::format("Can't refresh votes: {}", db::error()));
+		return false;
+	}
+
+	std::unordered_map<uint64_t, time_t> found;
+	for (auto & row : rs) {
+		found[from_string<uint64_t>(row["snowflake_id"], std::dec)] = from_string<time_t>(row["vote_time"], std::dec);
+	}
+	std::unique_lock<std::shared_mutex> lock(mtx);
+	voters.swap(found);
+	return true;
+}
+
+void ScriptDirectory::Refresher()
+{
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(wait_mutex);
+			wait_cv.wait_for(lock, std::chrono::seconds(interval), [this]() { return terminating; });
+			if (terminating) {
+				break;
+			}
+		}
+		RefreshChannels();
+		RefreshVotes();
+	}
+}
+
+bool ScriptDirectory::HasScript(uint64_t channel_id) const
+{
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	return channels.find(channel_id) != channels.end();
+}
+
+uint64_t ScriptDirectory::GetVersion(uint64_t channel_id) const
+{
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	auto i = channels.find(channel_id);
+	return i == channels.end() ? 0 : i->second.version;
+}
+
+std::shared_ptr<const TriggerFilter> ScriptDirectory::GetFilter(uint64_t channel_id) const
+{
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	auto i = channels.find(channel_id);
+	return i == channels.end() ? nullptr : i->second.filter;
+}
+
+bool ScriptDirectory::HasVoted(uint64_t user_id) const
+{
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	auto i = voters.find(user_id);
+	return i != voters.end() && i->second + vote_lifetime > time(nullptr);
+}
+
+size_t ScriptDirectory::GetChannelCount() const
+{
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	return channels.size();
+}
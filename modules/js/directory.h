@@ -0,0 +1,92 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <ctime>
+#include <cstdint>
+
+class Bot;
+class TriggerFilter;
+
+/**
+ * Which channels have scripts, which scripts need reloading and which guild owners have
+ * voted, kept in memory so that a message in a channel without a script costs only a
+ * hash lookup.
+ *
+ * A background thread refreshes it every few seconds. When it finds a script with
+ * `dirty` set, it bumps that channel's version and clears the flag, so JS::run() knows to
+ * load the script again without asking the database on every message.
+ */
+class ScriptDirectory {
+	Bot* bot;
+	time_t interval;
+
+	struct channel_entry {
+		/* Changes whenever the script must be reloaded */
+		uint64_t version;
+		/* Text of the triggers column, and the filter built from it, or nullptr to run for every message */
+		std::string triggers;
+		std::shared_ptr<const TriggerFilter> filter;
+	};
+
+	mutable std::shared_mutex mtx;
+	/* Scripted channels */
+	std::unordered_map<uint64_t, channel_entry> channels;
+	/* Users with a vote in the last day, and the time of their latest vote */
+	std::unordered_map<uint64_t, time_t> voters;
+	/* Last version given to a script, only used by RefreshChannels() */
+	uint64_t last_version;
+	/* True once a missing triggers column has been logged */
+	bool triggers_warned;
+
+	std::mutex wait_mutex;
+	std::condition_variable wait_cv;
+	bool terminating;
+	std::thread* refresher;
+
+	bool RefreshChannels();
+	bool RefreshVotes();
+	void Refresher();
+
+public:
+	/* Loads everything before returning, then refreshes every interval seconds */
+	ScriptDirectory(Bot* bot, time_t interval);
+	~ScriptDirectory();
+
+	bool HasScript(uint64_t channel_id) const;
+
+	/* Version of a channel's script, which changes whenever it must be reloaded. 0 if it has none */
+	uint64_t GetVersion(uint64_t channel_id) const;
+
+	/* Filter for the messages a channel's script runs for, nullptr if it runs for all of them */
+	std::shared_ptr<const TriggerFilter> GetFilter(uint64_t channel_id) const;
+
+	/* True if the user has voted in the last day */
+	bool HasVoted(uint64_t user_id) const;
+
+	size_t GetChannelCount() const;
+};
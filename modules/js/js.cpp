@@ -19,10 +19,19 @@
  ************************************************************************************/
 
 #include "js.h"
+#include "sandbox.h"
+#include "bytecode.h"
+#include "marshal.h"
+#include "directory.h"
+#include "triggers.h"
+#include "kvstore.h"
+#include "stats.h"
+#include "webrequest.h"
 #include <dpp/dpp.h>
 #include <fmt/format.h>
 #include <dpp/nlohmann/json.hpp>
 #include <sporks/bot.h>
+#include <sporks/outbound.h>
 #include <sporks/config.h>
 #include <sporks/stringops.h>
 #include <sporks/database.h>
@@ -36,14 +45,12 @@
 #include <stdlib.h>
 #include <sys/time.h>
 
-extern int interrupt;
-int64_t current_context;
-dpp::guild* current_guild;
 static dpp::cluster* c_apis_suck;
 std::unordered_map<int64_t, duk_context*> emptyref;
 std::unordered_map<int64_t, duk_context*> &contexts = emptyref;
-std::unordered_map<int64_t, size_t> total_allocated;
 static Bot* botref;
+static KVStore* kvstore;
+static WebRequests* webrequests;
 
 
 
@@ -54,39 +61,40 @@ const uint64_t timeout_voted = 20;
 
 
 
-uint64_t timeout = timeout_unvoted;
 const uint32_t message_limit = 5;
 
-uint32_t message_total = 0;
-extern timeval t_script_start;
-extern timeval t_script_now;
+/* Longest key name the infobot_javascript_kv table can hold */
+const size_t max_keyname = 100;
+
+/* Messages sent by the last script run on this thread, for JS::hasReplied() */
+static thread_local uint32_t last_message_total = 0;
 
-void sandbox_fatal(void *udata, const char *msg);
-void sandbox_free(void *udata, void *ptr);
-void *sandbox_alloc(void *udata, duk_size_t size);
-static void *sandbox_realloc(void *udata, void *ptr, duk_size_t size);
 std::string Sanitise(const std::string &s);
 
 struct program
 {
+	/* Held for the whole of a run, so that each channel runs one script at a time */
+	std::mutex mtx;
+	bool loaded = false;
+	/* Version from the ScriptDirectory when the source was loaded */
+	uint64_t version = 0;
 	std::string name;
 	std::string source;
+	/* Hash of the compiled text, and the bytecode compiled from it once known */
+	uint64_t hash;
+	std::string bytecode;
+	/* Set if the source doesn't compile, so it isn't compiled again on every message */
+	std::string compile_error;
 };
 
-std::unordered_map<int64_t, program> code;
-
-struct alloc_hdr {
-	/* The double value in the union is there to ensure alignment is
-	 * good for IEEE doubles too.  In many 32-bit environments 4 bytes
-	 * would be sufficiently aligned and the double value is unnecessary.
-	 */
-	union {
-		size_t sz;
-		double d;
-	} u;
-};
+/* Put in front of every script, on the same line so that line numbers in errors are unchanged.
+ * Web request callbacks set WCB_CALLBACK, and then run only the callback.
+ */
+const std::string script_prelude = "if (typeof WCB_CALLBACK !== 'undefined') { eval(WCB_CALLBACK + '(WCB_CONTENT)'); exit(0); }";
 
-static size_t max_allocated = max_allocated_unvoted;  /* 256kB sandbox */
+/* Guards code, but not the programs in it */
+std::mutex code_mutex;
+std::unordered_map<int64_t, std::shared_ptr<program>> code;
 
 
 class ExitException : public std::exception {
@@ -113,6 +121,14 @@ static void define_string(duk_context* ctx, const std::string &name, const std::
 	duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE);
 }
 
+/* State of the run a native function was called from */
+static sandbox_heap* current(duk_context* cx)
+{
+	duk_memory_functions funcs;
+	duk_get_memory_functions(cx, &funcs);
+	return (sandbox_heap*)funcs.udata;
+}
+
 static duk_ret_t js_print(duk_context *cx)
 {
 	int argc = duk_get_top(cx);
@@ -142,6 +158,7 @@ static void duk_build_object(duk_context* cx, const std::map<std::string, std::s
 
 static duk_ret_t js_create_message(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc < 2)
@@ -157,16 +174,13 @@ static duk_ret_t js_create_message(duk_context *cx)
 			output.append(duk_to_string(cx, i - argc)).append(" ");
 		}
 		std::string message = trim(output);
-		if (message_total >= message_limit) {
+		if (heap->message_total >= message_limit) {
 			duk_push_error_object(cx, DUK_ERR_RANGE_ERROR, "Message limit reached");
 			return duk_throw(cx);
 		}
-		if (!botref->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == c->guild_id) {
-			c_apis_suck->message_create(dpp::message(c->id, Sanitise(message)));
-			botref->sent_messages++;
-		}
-		message_total++;
-		c_apis_suck->log(dpp::ll_debug, fmt::format("JS create_message() on guild={}/channel={}: {}", current_guild->id, id, message));
+		botref->outbound->Send(dpp::message(c->id, Sanitise(message)), c->guild_id);
+		heap->message_total++;
+		c_apis_suck->log(dpp::ll_debug, fmt::format("JS create_message() on guild={}/channel={}: {}", heap->guild->id, id, message));
 	} else {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS create_message(): invalid channel id: {}", id));
 	}
@@ -175,6 +189,7 @@ static duk_ret_t js_create_message(duk_context *cx)
 
 static duk_ret_t js_add_reaction(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc < 3)
@@ -199,7 +214,7 @@ static duk_ret_t js_add_reaction(duk_context *cx)
                 dpp::message m;
                 m.id = from_string<int64_t>(message_id, std::dec);
                 c_apis_suck->message_add_reaction(m, trim(emoji));
-		c_apis_suck->log(dpp::ll_debug, fmt::format("JS add_reaction() on guild={}/channel={}: msg id={} emoji={}", current_guild->id, id, message_id, emoji));
+		c_apis_suck->log(dpp::ll_debug, fmt::format("JS add_reaction() on guild={}/channel={}: msg id={} emoji={}", heap->guild->id, id, message_id, emoji));
 	} else {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS add_reaction(): invalid channel id: {}", id));
 	}
@@ -208,6 +223,7 @@ static duk_ret_t js_add_reaction(duk_context *cx)
 
 static duk_ret_t js_delete_reaction(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc < 3)
@@ -232,7 +248,7 @@ static duk_ret_t js_delete_reaction(duk_context *cx)
 		dpp::message m;
 		m.id = from_string<int64_t>(message_id, std::dec);
 		c_apis_suck->message_delete_own_reaction(m, trim(emoji));
-		c_apis_suck->log(dpp::ll_debug, fmt::format("JS delete_reaction() on guild={}/channel={}: msg_id={} emoji={}", current_guild->id, id, message_id, emoji));
+		c_apis_suck->log(dpp::ll_debug, fmt::format("JS delete_reaction() on guild={}/channel={}: msg_id={} emoji={}", heap->guild->id, id, message_id, emoji));
 	} else {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS delete_reaction(): invalid channel id: {}", id));
 	}
@@ -245,6 +261,7 @@ std::string Sanitise(const std::string &s) {
 
 static duk_ret_t js_create_embed(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc != 2)
@@ -264,19 +281,16 @@ static duk_ret_t js_create_embed(duk_context *cx)
 		json embed;
 		try {
 			embed = json::parse(Sanitise(j));
-			if (message_total >= message_limit) {
+			if (heap->message_total >= message_limit) {
 				duk_push_error_object(cx, DUK_ERR_RANGE_ERROR, "Message limit reached");
 				return duk_throw(cx);
 			}
-			if (!botref->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == c->guild_id) {
-				dpp::message m;
-				m.channel_id = c->id;
-				m.embeds.push_back(dpp::embed(&embed));
-				c_apis_suck->message_create(m);
-				botref->sent_messages++;
-			}
-			message_total++;
-			c_apis_suck->log(dpp::ll_debug, fmt::format("JS create_embed() on guild={}/channel={}: {}", current_guild->id, id, j));
+			dpp::message m;
+			m.channel_id = c->id;
+			m.embeds.push_back(dpp::embed(&embed));
+			botref->outbound->Send(m, c->guild_id);
+			heap->message_total++;
+			c_apis_suck->log(dpp::ll_debug, fmt::format("JS create_embed() on guild={}/channel={}: {}", heap->guild->id, id, j));
 		} catch (const std::exception &e) {
 			c_apis_suck->log(dpp::ll_error, fmt::format("JS create_embed() JSON parse exception {}", e.what()));
 		}
@@ -286,23 +300,19 @@ static duk_ret_t js_create_embed(duk_context *cx)
 	return 0;
 }
 
-void do_web_request(const std::string &reqtype, const std::string &url, const std::string &callback, const std::string &postdata = "")
+void do_web_request(sandbox_heap* heap, const std::string &reqtype, const std::string &url, const std::string &callback, const std::string &postdata = "")
 {
-	
-	db::resultset rs = db::query("SELECT count(guild_id) AS count1 FROM infobot_web_requests WHERE guild_id = ?", {std::to_string(current_guild->id)});
-	if (rs[0]["count1"] == "0") {
-		db::resultset rs = db::query("SELECT count(channel_id) AS count2 FROM infobot_web_requests WHERE guild_id = ?", {std::to_string(current_context)});
-		if (rs[0]["count2"] == "0") {
-			c_apis_suck->log(dpp::ll_debug, fmt::format("JS web request created on guild={}/channel={}: {}", current_guild->id, current_context, url));
-			db::query("INSERT INTO infobot_web_requests (channel_id, guild_id, url, type, postdata, callback) VALUES('?','?','?','?','?','?')",
-				{std::to_string(current_context), std::to_string(current_guild->id), url, reqtype, postdata, callback});
-		}
+	if (webrequests->Submit({heap->guild->id, heap->channel_id, reqtype, url, postdata, callback})) {
+		c_apis_suck->log(dpp::ll_debug, fmt::format("JS web request created on guild={}/channel={}: {}", heap->guild->id, heap->channel_id, url));
+	} else {
+		c_apis_suck->log(dpp::ll_debug, fmt::format("JS web request on guild={}/channel={} dropped, the guild already has one in flight: {}", heap->guild->id, heap->channel_id, url));
 	}
 }
 
 static duk_ret_t js_get(duk_context *cx)
 {
 	/* url, callback */
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 2) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS get(): incorrect number of parameters: {}", argc));
@@ -314,12 +324,13 @@ static duk_ret_t js_get(duk_context *cx)
 	}
 	std::string url = duk_get_string(cx, 0);
 	std::string callback = duk_get_string(cx, -1);
-	do_web_request("GET", url, callback);
+	do_web_request(heap, "GET", url, callback);
 	return 0;
 }
 
 static duk_ret_t js_post(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 3) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS post(): incorrect number of parameters: {}", argc));
@@ -332,12 +343,13 @@ static duk_ret_t js_post(duk_context *cx)
 	std::string url = duk_get_string(cx, 0);
 	std::string postdata = duk_get_string(cx, -1);
 	std::string callback = duk_get_string(cx, -2);
-	do_web_request("POST", url, callback, postdata);
+	do_web_request(heap, "POST", url, callback, postdata);
 	return 0;
 }
 
 static duk_ret_t js_find_user(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS find_user(): incorrect number of parameters: {}", argc));
@@ -348,8 +360,8 @@ static duk_ret_t js_find_user(duk_context *cx)
 		return 0;
 	}
 	std::string id = duk_get_string(cx, -1);
-	auto i = current_guild->members.find(from_string<uint64_t>(id, std::dec));
-	if (i != current_guild->members.end()) {
+	auto i = heap->guild->members.find(from_string<uint64_t>(id, std::dec));
+	if (i != heap->guild->members.end()) {
 		dpp::user* u = dpp::find_user(i->second.user_id);
 		if (u) {
 			std::string nickname = i->second.nickname;
@@ -372,6 +384,7 @@ static duk_ret_t js_find_user(duk_context *cx)
 
 static duk_ret_t js_find_username(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS find_username(): incorrect number of parameters: {}", argc));
@@ -381,10 +394,10 @@ static duk_ret_t js_find_username(duk_context *cx)
 		c_apis_suck->log(dpp::ll_warning, "JS find_username(): parameter is not a string");
 		return 0;
 	}
-	std::string username = lowercase(std::string(duk_get_string(cx, -1)));
-	for (auto u = current_guild->members.begin(); u != current_guild->members.end(); ++u) {
+	std::string username = duk_get_string(cx, -1);
+	for (auto u = heap->guild->members.begin(); u != heap->guild->members.end(); ++u) {
 		dpp::user* us = dpp::find_user(u->second.user_id);
-		if (us && lowercase(us->username) == username) {
+		if (us && iequals(us->username, username)) {
 			std::string nickname = u->second.nickname;
 			duk_build_object(cx, {
 				{ "id", std::to_string(us->id) },
@@ -432,6 +445,7 @@ static duk_ret_t js_find_channel(duk_context *cx)
 
 static duk_ret_t js_load(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS load(): incorrect number of parameters: {}", argc));
@@ -442,10 +456,9 @@ static duk_ret_t js_load(duk_context *cx)
 		return 0;
 	}
 	std::string keyname = duk_get_string(cx, -1);
-	std::string guild_id = std::to_string(current_guild->id);
-	db::resultset rs = db::query("SELECT value FROM infobot_javascript_kv WHERE guild_id = ? AND keyname = '?'", {guild_id, keyname});
-	if (rs.size() == 1 && rs[0].find("value") != rs[0].end()) {
-		duk_push_string(cx, rs[0].find("value")->second.c_str());
+	std::string value;
+	if (kvstore->Get(heap->guild->id, keyname, value)) {
+		duk_push_lstring(cx, value.data(), value.length());
 		return 1;
 	} else {
 		return 0;
@@ -454,6 +467,7 @@ static duk_ret_t js_load(duk_context *cx)
 
 static duk_ret_t js_delete(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS delete(): incorrect number of parameters: {}", argc));
@@ -464,13 +478,13 @@ static duk_ret_t js_delete(duk_context *cx)
 		return 0;
 	}
 	std::string keyname = duk_get_string(cx, -1);
-	std::string guild_id = std::to_string(current_guild->id);
-	db::query("DELETE FROM infobot_javascript_kv WHERE guild_id = ? AND keyname = '?'", {guild_id, keyname});
+	kvstore->Delete(heap->guild->id, keyname);
 	return 0;
 }
 
 static duk_ret_t js_save(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 2) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS save(): incorrect number of parameters: {}", argc));
@@ -486,8 +500,15 @@ static duk_ret_t js_save(duk_context *cx)
 	}
 	std::string keyname = duk_get_string(cx, 0);
 	std::string value = duk_get_string(cx, -1);
-	std::string guild_id = std::to_string(current_guild->id);
-	db::query("INSERT INTO infobot_javascript_kv (guild_id, keyname, value) VALUES(?,'?','?') ON DUPLICATE KEY UPDATE value ='?'", {guild_id, keyname, value, value});
+	/* The column's limit is in characters, not bytes */
+	if (duk_get_length(cx, 0) > max_keyname) {
+		duk_push_error_object(cx, DUK_ERR_RANGE_ERROR, "Key name longer than %d characters", (int)max_keyname);
+		return duk_throw(cx);
+	}
+	if (!kvstore->Set(heap->guild->id, keyname, value)) {
+		duk_push_error_object(cx, DUK_ERR_RANGE_ERROR, "Key/value storage is full or unavailable");
+		return duk_throw(cx);
+	}
 	return 0;
 }
 
@@ -502,6 +523,7 @@ static duk_ret_t js_exit(duk_context *cx)
 
 static duk_ret_t js_find_channelname(duk_context *cx)
 {
+	sandbox_heap* heap = current(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
 		c_apis_suck->log(dpp::ll_warning, fmt::format("JS find_channelname(): incorrect number of parameters: {}", argc));
@@ -511,10 +533,10 @@ static duk_ret_t js_find_channelname(duk_context *cx)
 		c_apis_suck->log(dpp::ll_warning, "JS find_channelname(): parameter is not a string");
 		return 0;
 	}
-	std::string channelname = lowercase(std::string(duk_get_string(cx, -1)));
-	for (auto c = current_guild->channels.begin(); c != current_guild->channels.end(); ++c) {
+	std::string channelname = duk_get_string(cx, -1);
+	for (auto c = heap->guild->channels.begin(); c != heap->guild->channels.end(); ++c) {
 		dpp::channel * ch = dpp::find_channel(*c);
-		if (ch && lowercase(ch->name) == channelname) {
+		if (ch && iequals(ch->name, channelname)) {
 			duk_build_object(cx, {
 				{ "id", std::to_string(ch->id) },
 				{ "name", ch->name },
@@ -530,60 +552,152 @@ static duk_ret_t js_find_channelname(duk_context *cx)
 	return 0;
 }
 
-JS::JS(dpp::cluster* _core, Bot* thisbot) : core(_core), bot(thisbot)
+static duk_ret_t load_bytecode(duk_context* ctx, void* udata)
+{
+	duk_load_function(ctx);
+	return 1;
+}
+
+/* Copy a compiled function's bytecode into the std::string at udata, leaving the function on the stack */
+static duk_ret_t dump_bytecode(duk_context* ctx, void* udata)
+{
+	duk_dump_function(ctx);
+	duk_size_t length = 0;
+	const char* buffer = (const char*)duk_get_buffer(ctx, -1, &length);
+	((std::string*)udata)->assign(buffer, length);
+	duk_load_function(ctx);
+	return 1;
+}
+
+/* Globals and native functions which are the same for every script */
+static void install_bindings(duk_context* ctx)
+{
+	duk_push_global_object(ctx);
+	define_string(ctx, "BOT_ID", std::to_string(botref->getID()));
+	define_func(ctx, "debuglog", js_print, DUK_VARARGS);
+	define_func(ctx, "find_user", js_find_user, 1);
+	define_func(ctx, "find_channel", js_find_channel, 1);
+	define_func(ctx, "create_message", js_create_message, DUK_VARARGS);
+	define_func(ctx, "create_embed", js_create_embed, 2);
+	define_func(ctx, "find_username", js_find_username, 1);
+	define_func(ctx, "find_channelname", js_find_channelname, 1);
+	define_func(ctx, "save", js_save, 2);
+	define_func(ctx, "load", js_load, 1);
+	define_func(ctx, "delete", js_delete, 1);
+	define_func(ctx, "get", js_get, 2);
+	define_func(ctx, "post", js_post, 3);
+	define_func(ctx, "exit", js_exit, 1);
+	define_func(ctx, "add_reaction", js_add_reaction, 3);
+	define_func(ctx, "delete_reaction", js_delete_reaction, 3);
+	duk_pop(ctx);
+}
+
+JS::JS(dpp::cluster* _core, Bot* thisbot) : core(_core), bot(thisbot), triggered(0), skipped(0)
 {
 	terminate = false;
-	web_request_watcher = new std::thread(&JS::WebRequestWatch, this);
+	c_apis_suck = core;
+	botref = bot;
+	heaps = new HeapPool(core, install_bindings, max_allocated_unvoted,
+		from_string<size_t>(Bot::GetConfig("js_heap_pool", "4"), std::dec),
+		from_string<size_t>(Bot::GetConfig("js_heap_pool_memory_kb", "1024"), std::dec) * 1024,
+		max_allocated_voted * 2);
+	bytecodes = new BytecodeCache(Bot::GetConfig("js_bytecode_cache", "../jscache"));
+	directory = new ScriptDirectory(bot, from_string<time_t>(Bot::GetConfig("js_refresh_secs", "5"), std::dec));
+	kvstore = new KVStore(bot, from_string<size_t>(Bot::GetConfig("js_kv_guild_kb", "256"), std::dec) * 1024,
+		std::chrono::milliseconds(from_string<uint64_t>(Bot::GetConfig("js_kv_flush_ms", "1000"), std::dec)));
+	stats = new ScriptStats(bot, from_string<time_t>(Bot::GetConfig("js_stats_flush_secs", "10"), std::dec));
+	size_t worker_count = std::max<size_t>(1, from_string<size_t>(Bot::GetConfig("js_workers", "4"), std::dec));
+	for (size_t i = 0; i < worker_count; ++i) {
+		workers.push_back(new std::thread(&JS::CallbackWorker, this));
+	}
+	webrequests = new WebRequests(bot, from_string<size_t>(Bot::GetConfig("js_web_workers", "4"), std::dec),
+		[this](const WebRequests::request &r, const WebRequests::response &res) {
+			std::lock_guard<std::mutex> lock(callback_mutex);
+			callbacks.push_back({r.channel_id, r.callback, res.body});
+			callback_cv.notify_one();
+		});
 }
 
-void JS::WebRequestWatch()
+void JS::CallbackWorker()
 {
-	while (!this->terminate)
-	{
-		db::resultset rs = db::query("SELECT * FROM infobot_web_requests WHERE statuscode != '000'", {});
-		for (auto i = rs.begin(); i != rs.end(); ++i) {
-			c_apis_suck->log(dpp::ll_debug, fmt::format("JS web request response received for url {}", (*i)["url"]));
-			run(from_string<int64_t>((*i)["channel_id"], std::dec), {}, (*i)["callback"], (*i)["returndata"]);
-			db::query("DELETE FROM infobot_web_requests WHERE channel_id = ?", {(*i)["channel_id"]});
+	while (!terminate) {
+		web_callback cb;
+		{
+			std::unique_lock<std::mutex> lock(callback_mutex);
+			callback_cv.wait(lock, [this]() { return terminate || !callbacks.empty(); });
+			if (terminate) {
+				break;
+			}
+			cb = std::move(callbacks.front());
+			callbacks.pop_front();
+		}
+		try {
+			run(cb.channel_id, nullptr, {}, cb.callback, cb.content);
+		}
+		catch (const std::exception &e) {
+			core->log(dpp::ll_error, fmt::format("JS callback worker: {}", e.what()));
 		}
-		std::this_thread::sleep_for(std::chrono::seconds(1));
 	}
 }
 
 JS::~JS()
 {
-	terminate = true;
-	if (web_request_watcher->joinable()) {
-		web_request_watcher->join();
+	/* Stopped first, as it hands responses to the callback workers */
+	delete webrequests;
+	webrequests = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(callback_mutex);
+		terminate = true;
+		callback_cv.notify_all();
+	}
+	for (auto w : workers) {
+		bot->DisposeThread(w);
 	}
-	delete web_request_watcher;
+	delete directory;
+	/* Writes everything scripts have saved but which isn't in the database yet */
+	delete kvstore;
+	kvstore = nullptr;
+	delete stats;
+	delete heaps;
+	delete bytecodes;
 }
 
 bool JS::channelHasJS(int64_t channel_id)
 {
-	db::resultset r = db::query("SELECT id FROM infobot_discord_javascript WHERE id = ?", {std::to_string(channel_id)});
-	/* No javascript configuration for this channel */
-	if (r.size() == 0) {
-		return false;
+	return directory->HasScript(channel_id);
+}
+
+bool JS::isTriggered(const dpp::message &msg, bool mentioned)
+{
+	std::shared_ptr<const TriggerFilter> filter = directory->GetFilter(msg.channel_id);
+	bool matched = (!filter || filter->Matches(msg, mentioned));
+	if (matched) {
+		++triggered;
 	} else {
-		return true;
+		++skipped;
 	}
+	return matched;
+}
+
+void JS::LogCounters()
+{
+	core->log(dpp::ll_debug, fmt::format("JS: {} channels, {} run and {} skipped by triggers, heap pool {} hits/{} misses, kv {} guilds {} written/{} failed, web {} completed/{} failed",
+		directory->GetChannelCount(), triggered.load(), skipped.load(), heaps->GetHits(), heaps->GetMisses(),
+		kvstore->GetGuildCount(), kvstore->GetWritten(), kvstore->GetFailed(), webrequests->GetCompleted(), webrequests->GetFailed()));
 }
 
 bool JS::hasReplied()
 {
-	return message_total > 0;
+	return last_message_total > 0;
 }
 
 std::string CleanErrorMessage(const std::string &error) {
 	return ReplaceString(error, "    at [anon] (duk_js_var.c:1234) internal\n", "");
 }
 
-bool JS::run(uint64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn, const std::string &callback_content)
+bool JS::run(uint64_t channel_id, const dpp::message* msg, const std::vector<std::string> &mentions, const std::string &callback_fn, const std::string &callback_content)
 {
-	std::lock_guard<std::mutex> input_lock(this->jsmutex);
-	duk_int_t ret;
-	int i;
+	last_message_total = 0;
 
 	dpp::channel* c = dpp::find_channel(channel_id);
 	if (!c) {
@@ -591,16 +705,36 @@ bool JS::run(uint64_t channel_id, const std::unordered_map<std::string, json> &v
 		return false;
 	}
 
-	current_guild = dpp::find_guild(c->guild_id);
+	dpp::guild* g = dpp::find_guild(c->guild_id);
 
-	if (current_guild == nullptr) {
+	if (g == nullptr) {
 		core->log(dpp::ll_error, fmt::format("JS::run() Can't find guild {}", c->guild_id));
 		return false;
 	}
 
+	uint64_t version = directory->GetVersion(channel_id);
+	if (!version) {
+		/* No javascript configuration for this channel */
+		return false;
+	}
+
+	std::shared_ptr<program> script;
+	{
+		std::lock_guard<std::mutex> code_lock(code_mutex);
+		std::shared_ptr<program> &p = code[channel_id];
+		if (!p) {
+			p = std::make_shared<program>();
+		}
+		script = p;
+	}
+	/* Scripts for other channels carry on running while this one waits */
+	std::lock_guard<std::mutex> channel_lock(script->mtx);
+	program &v = *script;
+
 	/* Check if a user has a current vote in the system that is valid for the past day. If they do, boost their quotas for cpu time and ram usage. */
-	db::resultset vrs = db::query("SELECT * FROM `infobot_votes` WHERE vote_time > now() - INTERVAL 1 DAY AND snowflake_id = '?'", {std::to_string(current_guild->owner_id)});
-	if (vrs.size() > 0) {
+	size_t max_allocated;
+	uint64_t timeout;
+	if (directory->HasVoted(g->owner_id)) {
 		/* User has voted, increase their allowances */
 		timeout = timeout_voted;
 		max_allocated = max_allocated_voted;
@@ -610,100 +744,111 @@ bool JS::run(uint64_t channel_id, const std::unordered_map<std::string, json> &v
 		max_allocated = max_allocated_unvoted;
 	}
 
-	auto iter = code.find(channel_id);
-	duk_context* ctx;
-	program v;
-
-	c_apis_suck = core;
-	botref = bot;
-
-	if (iter == code.end() || settings::getJSConfig(channel_id, "dirty") == "1") {
+	if (!v.loaded || v.version != version) {
 
 		core->log(dpp::ll_info, fmt::format("create new context for channel {} due to reload request", channel_id));
-		std::string source = settings::getJSConfig(channel_id, "script");
-		std::string name = std::to_string(channel_id) + ".js";
-		v.name = name;
-		v.source = source;
-
-		code[channel_id] = v;
+		v.name = std::to_string(channel_id) + ".js";
+		v.source = settings::getJSConfig(channel_id, "script");
+		v.hash = BytecodeCache::Hash(v.name + "\n" + script_prelude + v.source);
+		v.compile_error.clear();
+		if (!bytecodes->Load(channel_id, v.hash, v.bytecode)) {
+			v.bytecode.clear();
+		}
+		v.loaded = true;
+		v.version = version;
+	}
 
-		settings::setJSConfig(channel_id, "dirty", "0");
+	if (!v.compile_error.empty()) {
+		/* Already reported in last_error when it was compiled */
+		return false;
+	}
 
-	} else {
-		v = code[channel_id];
+	sandbox_heap* heap = heaps->Acquire(max_allocated);
+	if (!heap) {
+		core->log(dpp::ll_error, fmt::format("JS::run() Can't create a heap for channel {}", channel_id));
+		return false;
 	}
+	heap->channel_id = channel_id;
+	heap->guild = g;
+	heap->message_total = 0;
+	heap->message = msg;
+	heap->clock.timeout = timeout;
+	gettimeofday(&heap->clock.start, nullptr);
 
-	current_context = channel_id;
-	total_allocated[channel_id] = 0;
-	message_total = 0;
+	bool result = execute(v, heap, mentions, callback_fn, callback_content);
 
-	auto t_start = std::chrono::high_resolution_clock::now();	
-	ctx = duk_create_heap(sandbox_alloc, sandbox_realloc, sandbox_free, NULL, sandbox_fatal);
+	last_message_total = heap->message_total;
+	heaps->Release(heap);
+	return result;
+}
+
+bool JS::execute(program &v, sandbox_heap* heap, const std::vector<std::string> &mentions, const std::string &callback_fn, const std::string &callback_content)
+{
+	duk_context* ctx = heap->ctx;
+	uint64_t channel_id = heap->channel_id;
+	std::string lasterror;
+	duk_int_t ret;
 
 	duk_push_global_object(ctx);
 	define_string(ctx, "CHANNEL_ID", std::to_string(channel_id));
-	define_string(ctx, "GUILD_ID", std::to_string(current_guild->id));
-	define_string(ctx, "BOT_ID", std::to_string(bot->getID()));
-	define_func(ctx, "debuglog", js_print, DUK_VARARGS);
-	define_func(ctx, "find_user", js_find_user, 1);
-	define_func(ctx, "find_channel", js_find_channel, 1);
-	define_func(ctx, "create_message", js_create_message, DUK_VARARGS);
-	define_func(ctx, "create_embed", js_create_embed, 2);
-	define_func(ctx, "find_username", js_find_username, 1);
-	define_func(ctx, "find_channelname", js_find_channelname, 1);
-	define_func(ctx, "save", js_save, 2);
-	define_func(ctx, "load", js_load, 1);
-	define_func(ctx, "delete", js_delete, 1);
-	define_func(ctx, "get", js_get, 2);
-	define_func(ctx, "post", js_post, 3);
-	define_func(ctx, "exit", js_exit, 1);
-	define_func(ctx, "add_reaction", js_add_reaction, 3);
-	define_func(ctx, "delete_reaction", js_delete_reaction, 3);
-	if (!callback_content.empty()) {
+	define_string(ctx, "GUILD_ID", std::to_string(heap->guild->id));
+	if (!callback_fn.empty()) {
+		define_string(ctx, "WCB_CALLBACK", callback_fn);
 		define_string(ctx, "WCB_CONTENT", callback_content);
 	}
+	if (heap->message) {
+		push_message_globals(ctx, heap, *heap->message, mentions);
+	}
 	duk_pop(ctx);
 
-	duk_push_string(ctx, v.name.c_str());
-	std::string source;
-	for (auto i = vars.begin(); i != vars.end(); ++i) {
-		source += i->first + "=" + i->second.dump() + ";";
+	if (!v.bytecode.empty()) {
+		void* buffer = duk_push_fixed_buffer(ctx, v.bytecode.length());
+		memcpy(buffer, v.bytecode.data(), v.bytecode.length());
+		if (duk_safe_call(ctx, load_bytecode, nullptr, 1, 1) != DUK_EXEC_SUCCESS) {
+			core->log(dpp::ll_warning, fmt::format("Can't load bytecode for channel {}, compiling it again: {}", channel_id, duk_safe_to_string(ctx, -1)));
+			duk_pop(ctx);
+			v.bytecode.clear();
+		}
 	}
 
-	if (!callback_fn.empty()) {
-		source += ";" + callback_fn + "(WCB_CONTENT);exit(0);" + v.source;
-	} else {
-		source += ";" + v.source;
-	}
+	if (v.bytecode.empty()) {
+		auto t_compile = std::chrono::high_resolution_clock::now();
+		duk_push_string(ctx, v.name.c_str());
+		if (duk_pcompile_string_filename(ctx, 0, (script_prelude + v.source).c_str()) != 0) {
+			lasterror = duk_safe_to_string(ctx, -1);
+			core->log(dpp::ll_error, fmt::format("couldnt compile: {}", lasterror));
+			auto t_end = std::chrono::high_resolution_clock::now();
+			stats->RecordCompile(channel_id, std::chrono::duration<double, std::milli>(t_end-t_compile).count());
+			stats->RecordError(channel_id, CleanErrorMessage(lasterror));
+			v.compile_error = lasterror;
+			return false;
+		}
 
-	if (duk_pcompile_string_filename(ctx, 0, source.c_str()) != 0) {
-		lasterror = duk_safe_to_string(ctx, -1);
-		core->log(dpp::ll_error, fmt::format("couldnt compile: {}", lasterror));
-		settings::setJSConfig(channel_id, "last_error", CleanErrorMessage(lasterror));
 		auto t_end = std::chrono::high_resolution_clock::now();
-		double compile_time_ms = std::chrono::duration<double, std::milli>(t_end-t_start).count();
-		settings::setJSConfig(channel_id, "last_compile_ms", std::to_string(compile_time_ms));
-		duk_destroy_heap(ctx);
-		return false;
-	}
+		stats->RecordCompile(channel_id, std::chrono::duration<double, std::milli>(t_end-t_compile).count());
 
-	auto t_end = std::chrono::high_resolution_clock::now();
-	double compile_time_ms = std::chrono::duration<double, std::milli>(t_end-t_start).count();
-	settings::setJSConfig(channel_id, "last_compile_ms", std::to_string(compile_time_ms));
+		if (duk_safe_call(ctx, dump_bytecode, &v.bytecode, 1, 1) != DUK_EXEC_SUCCESS) {
+			lasterror = duk_safe_to_string(ctx, -1);
+			core->log(dpp::ll_error, fmt::format("JS::run() Can't dump bytecode for channel {}: {}", channel_id, lasterror));
+			v.bytecode.clear();
+			return false;
+		}
+		if (!bytecodes->Save(channel_id, v.hash, v.bytecode)) {
+			core->log(dpp::ll_debug, fmt::format("Bytecode for channel {} not saved to disk", channel_id));
+		}
+	}
 
 	if (!duk_is_function(ctx, -1)) {
 		lasterror = "Top of stack is not a function";
 		core->log(dpp::ll_error, fmt::format("JS error: {}", lasterror));
-		settings::setJSConfig(channel_id, "last_error", CleanErrorMessage(lasterror));
-		duk_destroy_heap(ctx);
+		stats->RecordError(channel_id, CleanErrorMessage(lasterror));
 		return false;
 	}
 
-	interrupt = 0;
 	ret = DUK_EXEC_SUCCESS;
 	bool exited = false;
 	try {
-		gettimeofday(&t_script_start, nullptr);
+		gettimeofday(&heap->clock.start, nullptr);
 		ret = duk_pcall(ctx, 0);
 	}
 	catch (const ExitException &e) {
@@ -711,9 +856,9 @@ bool JS::run(uint64_t channel_id, const std::unordered_map<std::string, json> &v
 		ret = DUK_EXEC_SUCCESS;
 		exited = true;
 	}
-	double exec_time_ms = (double)((t_script_now.tv_sec - t_script_start.tv_sec) * 1000000 + t_script_now.tv_usec - t_script_start.tv_usec) / 1000;
-	settings::setJSConfig(channel_id, "last_exec_ms", std::to_string(exec_time_ms));
-	settings::setJSConfig(channel_id, "last_memory_max", std::to_string(total_allocated[channel_id]));
+	gettimeofday(&heap->clock.now, nullptr);
+	double exec_time_ms = (double)((heap->clock.now.tv_sec - heap->clock.start.tv_sec) * 1000000 + heap->clock.now.tv_usec - heap->clock.start.tv_usec) / 1000;
+	stats->RecordRun(channel_id, exec_time_ms, heap->allocated);
 
 	if (ret != DUK_EXEC_SUCCESS) {
 		if (duk_is_error(ctx, -1)) {
@@ -724,120 +869,20 @@ bool JS::run(uint64_t channel_id, const std::unordered_map<std::string, json> &v
 			lasterror = duk_safe_to_string(ctx, -1);
 		}
 		core->log(dpp::ll_error, fmt::format("JS error: {}", lasterror));
-		settings::setJSConfig(channel_id, "last_error", CleanErrorMessage(lasterror));
-		duk_destroy_heap(ctx);
+		stats->RecordError(channel_id, CleanErrorMessage(lasterror));
 		return false;
 	} else {
-		settings::setJSConfig(channel_id, "last_error", "");
+		stats->RecordError(channel_id, "");
 	}
 	if (!exited) {
 		duk_pop(ctx);
 	}
-	duk_destroy_heap(ctx);
 	return true;
 }
 
-void sandbox_fatal(void *udata, const char *msg) {
-	// Yeah, according to the docs a fatal can never return. Technically, it doesnt.
-	// At this point we should probably destroy the duk context as bad.
-	std::string error = msg;
-	total_allocated[current_context] = 0;
-	throw std::runtime_error("JS error: " + error);
-}
-
-void sandbox_free(void *udata, void *ptr) {
-	alloc_hdr *hdr;
-
-	if (!ptr) {
-		return;
-	}
-	hdr = (alloc_hdr *) (((char *) ptr) - sizeof(alloc_hdr));
-	auto iter = total_allocated.find(current_context);
-	iter->second -= hdr->u.sz;
-	free((void *) hdr);
-}
-
-void *sandbox_alloc(void *udata, duk_size_t size) {
-	alloc_hdr *hdr;
-
-	if (size == 0) {
-		return NULL;
-	}
-
-	auto iter = total_allocated.find(current_context);
-
-	if (iter->second + size > max_allocated) {
-		c_apis_suck->log(dpp::ll_error, fmt::format("Sandbox maximum allocation size reached, {} requested in sandbox_alloc", (long) size));
-		return NULL;
-	}
-
-	hdr = (alloc_hdr *) malloc(size + sizeof(alloc_hdr));
-	if (!hdr) {
-		return NULL;
-	}
-	hdr->u.sz = size;
-	iter->second += size;
-	return (void *) (hdr + 1);
-}
-
-static void *sandbox_realloc(void *udata, void *ptr, duk_size_t size) {
-	alloc_hdr *hdr;
-
-	auto iter = total_allocated.find(current_context);
-
-	/* Handle the ptr-NULL vs. size-zero cases explicitly to minimize
-	 * platform assumptions.  You can get away with much less in specific
-	 * well-behaving environments.
-	 */
-
-	if (ptr) {
-		hdr = (alloc_hdr *) (((char *) ptr) - sizeof(alloc_hdr));
-		size_t old_size = hdr->u.sz;
-
-		if (size == 0) {
-			iter->second -= old_size;
-			free((void *) hdr);
-			return NULL;
-		} else {
-			if (iter->second - old_size + size > max_allocated) {
-				c_apis_suck->log(dpp::ll_error, fmt::format("Sandbox maximum allocation size reached, {} requested in sandbox_realloc", (long) size));
-				return NULL;
-			}
-
-			void* t = realloc((void *) hdr, size + sizeof(alloc_hdr));
-
-			if (!t) {
-				return NULL;
-			}
-			hdr = (alloc_hdr *) t;
-			iter->second -= old_size;
-			iter->second += size;
-			hdr->u.sz = size;
-			return (void *) (hdr + 1);
-		}
-	} else {
-		if (size == 0) {
-			return NULL;
-		} else {
-			if (iter->second + size > max_allocated) {
-				c_apis_suck->log(dpp::ll_error, fmt::format("Sandbox maximum allocation size reached, {} requested in sandbox_realloc", (long) size));
-				return NULL;
-			}
-
-			hdr = (alloc_hdr *) malloc(size + sizeof(alloc_hdr));
-			if (!hdr) {
-				return NULL;
-			}
-			hdr->u.sz = size;
-			iter->second += size;
-			return (void *) (hdr + 1);
-		}
-	}
-}
-
 JSModule::JSModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml)
 {
-	ml->Attach({ I_OnMessage }, this);
+	ml->Attach({ I_OnMessage, I_OnPresenceUpdate }, this);
 	js = new JS(bot->core, bot);
 }
 
@@ -849,10 +894,16 @@ JSModule::~JSModule()
 std::string JSModule::GetVersion()
 {
 	/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-	std::string version = "$ModVer 23$";
+	std::string version = "$ModVer 41$";
 	return "1.0." + version.substr(8,version.length() - 9);
 }
 
+bool JSModule::OnPresenceUpdate()
+{
+	js->LogCounters();
+	return true;
+}
+
 std::string JSModule::GetDescription()
 {
 	return "JavaScript Per-Channel Custom Events";
@@ -860,36 +911,15 @@ std::string JSModule::GetDescription()
 
 bool JSModule::OnMessage(const dpp::message_create_t &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions)
 {
-	std::unordered_map<std::string, json> jsonstore;
-	dpp::message msg = *(message.msg);
+	const dpp::message &msg = *(message.msg);
 
 	if (js->channelHasJS(msg.channel_id)) {
-
-		json chan;
-		dpp::channel* c = dpp::find_channel(msg.channel_id);
-		chan["name"] = c->name;
-		chan["nsfw"] = c->is_nsfw();
-		chan["dm"] = c->is_dm();
-		json guild;
-		dpp::guild* g = dpp::find_guild(msg.guild_id);
-		if (g) {
-			guild["name"] = g->name;
-			guild["owner"] = std::to_string(g->owner_id);
-			guild["id"] = std::to_string(msg.guild_id);
-			guild["member_count"] = g->members.size();
-			jsonstore["guild"] = guild;
+		if (!js->isTriggered(msg, mentioned)) {
+			/* Not a message the script wants, so don't start it at all */
+			return true;
 		}
-		jsonstore["channel"] = chan;
-		jsonstore["message"] = json::parse(msg.build_json(true));
-		jsonstore["message"]["id"] = std::to_string(msg.id);
-		jsonstore["message"]["nonce"] = msg.nonce;
-		jsonstore["mentions"] = stringmentions;
-		jsonstore["channel"]["id"] = std::to_string(c->id);
-		jsonstore["channel"]["guild_id"] = std::to_string(msg.guild_id);
-		jsonstore["author"]["id"] = std::to_string(msg.author->id);
-		jsonstore["author"]["guild_id"] = jsonstore["channel"]["guild_id"];
-
-		js->run(c->id, jsonstore);
+		/* The message, author, channel, guild and mentions globals are built from msg in the sandbox */
+		js->run(msg.channel_id, &msg, stringmentions);
 		return !js->hasReplied();
 	}
 	return true;
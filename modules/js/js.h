@@ -26,25 +26,58 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
 #include "duktape.h"
 #include <sporks/modules.h>
 
 using json = nlohmann::json; 
 
+struct program;
+struct sandbox_heap;
+
 class JS {
-	std::string lasterror;
+	/* A web request response whose callback is waiting to run */
+	struct web_callback {
+		uint64_t channel_id;
+		std::string callback;
+		std::string content;
+	};
+
 	dpp::cluster* core;
 	class Bot* bot;
-	std::thread* web_request_watcher;
-	std::mutex jsmutex;
+	class HeapPool* heaps;
+	class BytecodeCache* bytecodes;
+	class ScriptDirectory* directory;
+	class ScriptStats* stats;
 	bool terminate;
+
+	/* Messages in scripted channels which did and didn't match the script's triggers */
+	std::atomic<uint64_t> triggered;
+	std::atomic<uint64_t> skipped;
+
+	/* Web request callbacks are run by a pool of workers, so that channels don't wait for each other */
+	std::mutex callback_mutex;
+	std::condition_variable callback_cv;
+	std::deque<web_callback> callbacks;
+	std::vector<std::thread*> workers;
+
+	bool execute(program &v, sandbox_heap* heap, const std::vector<std::string> &mentions, const std::string &callback_fn, const std::string &callback_content);
 public:
 	JS(class dpp::cluster* _core, class Bot* bot);
 	~JS();
-	bool run(uint64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn = "", const std::string &callback_content = "");
-	void WebRequestWatch();
+	/* Run a channel's script on the calling thread, for msg or for a web request callback if msg is nullptr.
+	 * Scripts for different channels may run at the same time.
+	 */
+	bool run(uint64_t channel_id, const dpp::message* msg, const std::vector<std::string> &mentions, const std::string &callback_fn = "", const std::string &callback_content = "");
+	void CallbackWorker();
 	bool hasReplied();
 	bool channelHasJS(int64_t channel_id);
+	/* True if the triggers of the channel's script match msg, so that it should run */
+	bool isTriggered(const dpp::message &msg, bool mentioned);
+	/* Log this module's statistics at debug level, called from the presence timer */
+	void LogCounters();
 };
 
 class JSModule : public Module
@@ -55,6 +88,7 @@ public:
         virtual ~JSModule();
         virtual std::string GetVersion();
         virtual std::string GetDescription();
+        virtual bool OnPresenceUpdate();
         virtual bool OnMessage(const dpp::message_create_t &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions);
 };
 
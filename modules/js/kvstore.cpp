@@ -0,0 +1,333 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <dpp/dpp.h>
+#include <fmt/format.h>
+#include <sporks/bot.h>
+#include <sporks/database.h>
+#include <sporks/stringops.h>
+#include <vector>
+#include <unordered_set>
+#include "kvstore.h"
+
+/* Most changes written by one statement */
+const size_t batch_size = 100;
+
+/* Queued changes which wake the writer early */
+const size_t eager_write = 500;
+
+/* Seconds a guild's keys stay in memory after a script last used them */
+const time_t guild_idle_time = 60 * 15;
+
+KVStore::KVStore(Bot* _bot, size_t _quota, std::chrono::milliseconds _interval) : bot(_bot), quota(_quota), interval(_interval), terminating(false), writer(nullptr), written(0), failed(0)
+{
+	writer = new std::thread(&KVStore::Writer, this);
+}
+
+KVStore::~KVStore()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		terminating = true;
+	}
+	cv.notify_all();
+	bot->DisposeThread(writer);
+	/* Anything saved since the writer's last pass */
+	Flush();
+}
+
+std::string KVStore::Fold(const std::string &keyname)
+{
+	return general_ci_fold(keyname);
+}
+
+bool KVStore::Fetch(uint64_t guild_id, std::unique_lock<std::mutex> &lock)
+{
+	auto g = guilds.find(guild_id);
+	if (g != guilds.end()) {
+		g->second.last_used = time(nullptr);
+		return true;
+	}
+
+	/* A guild that isn't in memory has no queued changes, so the database is up to date */
+	lock.unlock();
+	db::resultset rs = db::query("SELECT keyname, value FROM infobot_javascript_kv WHERE guild_id = ?", {guild_id});
+	std::string error = db::error();
+	lock.lock();
+	if (!error.empty()) {
+		bot->core->log(dpp::ll_error, fmt::format("Can't load javascript keys for guild {}: {}", guild_id, error));
+		return false;
+	}
+
+	/* Another script in this guild may have got there first, and changed things since */
+	auto inserted = guilds.emplace(guild_id, guild_store());
+	guild_store &store = inserted.first->second;
+	if (inserted.second) {
+		for (auto & row : rs) {
+			store.bytes += row["keyname"].length() + row["value"].length();
+			store.entries[Fold(row["keyname"])] = std::make_pair(row["keyname"], row["value"]);
+		}
+	}
+	store.last_used = time(nullptr);
+	return true;
+}
+
+bool KVStore::Get(uint64_t guild_id, const std::string &keyname, std::string &value)
+{
+	if (!general_ci_exact(keyname)) {
+		db::resultset rs = db::query("SELECT value FROM infobot_javascript_kv WHERE guild_id = ? AND keyname = '?'", {guild_id, keyname});
+		if (rs.empty()) {
+			return false;
+		}
+		value = rs[0]["value"];
+		return true;
+	}
+	std::unique_lock<std::mutex> lock(mtx);
+	if (!Fetch(guild_id, lock)) {
+		return false;
+	}
+	guild_store &store = guilds[guild_id];
+	auto e = store.entries.find(Fold(keyname));
+	if (e == store.entries.end()) {
+		return false;
+	}
+	value = e->second.second;
+	return true;
+}
+
+bool KVStore::Set(uint64_t guild_id, const std::string &keyname, const std::string &value)
+{
+	if (!general_ci_exact(keyname)) {
+		return WriteDirect(guild_id, {keyname, value, false});
+	}
+	std::string folded = Fold(keyname);
+	size_t queued;
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if (!Fetch(guild_id, lock)) {
+			return false;
+		}
+		guild_store &store = guilds[guild_id];
+		auto e = store.entries.find(folded);
+		size_t old_bytes = (e == store.entries.end() ? 0 : e->second.first.length() + e->second.second.length());
+		const std::string &stored_name = (e == store.entries.end() ? keyname : e->second.first);
+		size_t new_bytes = stored_name.length() + value.length();
+		if (new_bytes > old_bytes && store.bytes - old_bytes + new_bytes > quota) {
+			return false;
+		}
+		store.bytes = store.bytes - old_bytes + new_bytes;
+		store.entries[folded] = std::make_pair(stored_name, value);
+
+		auto c = changes.find(std::make_pair(guild_id, folded));
+		if (c == changes.end()) {
+			store.pending++;
+			changes[std::make_pair(guild_id, folded)] = {keyname, value, false};
+		} else {
+			c->second = {keyname, value, false};
+		}
+		queued = changes.size();
+	}
+	if (queued >= eager_write) {
+		cv.notify_one();
+	}
+	return true;
+}
+
+void KVStore::Delete(uint64_t guild_id, const std::string &keyname)
+{
+	if (!general_ci_exact(keyname)) {
+		WriteDirect(guild_id, {keyname, "", true});
+		return;
+	}
+	std::string folded = Fold(keyname);
+	std::unique_lock<std::mutex> lock(mtx);
+	if (!Fetch(guild_id, lock)) {
+		return;
+	}
+	guild_store &store = guilds[guild_id];
+	auto e = store.entries.find(folded);
+	auto c = changes.find(std::make_pair(guild_id, folded));
+	if (e == store.entries.end() && c == changes.end()) {
+		/* All of the guild's keys are in memory, so it isn't in the database either */
+		return;
+	}
+	if (e != store.entries.end()) {
+		store.bytes -= e->second.first.length() + e->second.second.length();
+		store.entries.erase(e);
+	}
+	if (c == changes.end()) {
+		store.pending++;
+		changes[std::make_pair(guild_id, folded)] = {keyname, "", true};
+	} else {
+		c->second = {keyname, "", true};
+	}
+}
+
+bool KVStore::WriteDirect(uint64_t guild_id, const change &c)
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if (!Fetch(guild_id, lock)) {
+			return false;
+		}
+		/* Which stored key MySQL will match isn't known here, so count this one as new */
+		guild_store &store = guilds[guild_id];
+		size_t new_bytes = c.deleted ? 0 : c.keyname.length() + c.value.length();
+		if (store.bytes + new_bytes > quota) {
+			return false;
+		}
+		store.bytes += new_bytes;
+	}
+	bool ok = WriteChanges({std::make_pair(guild_id, c)});
+	if (!ok) {
+		bot->core->log(dpp::ll_warning, fmt::format("Can't save javascript key '{}' for guild {}: {}", c.keyname, guild_id, db::error()));
+	}
+	/* The memory copy no longer matches the database, so it is read again once nothing is queued for it */
+	std::lock_guard<std::mutex> lock(mtx);
+	auto g = guilds.find(guild_id);
+	if (g != guilds.end()) {
+		g->second.stale = true;
+	}
+	return ok;
+}
+
+bool KVStore::WriteChanges(const std::vector<std::pair<uint64_t, change>> &batch)
+{
+	std::string upsert;
+	std::string remove;
+	db::paramlist upsert_params;
+	db::paramlist remove_params;
+	for (auto & c : batch) {
+		if (c.second.deleted) {
+			remove += std::string(remove.empty() ? "" : ",") + "(?,'?')";
+			remove_params.push_back(c.first);
+			remove_params.push_back(c.second.keyname);
+		} else {
+			upsert += std::string(upsert.empty() ? "" : ",") + "(?,'?','?')";
+			upsert_params.push_back(c.first);
+			upsert_params.push_back(c.second.keyname);
+			upsert_params.push_back(c.second.value);
+		}
+	}
+	bool ok = true;
+	if (!upsert.empty()) {
+		db::query("INSERT INTO infobot_javascript_kv (guild_id, keyname, value) VALUES " + upsert + " ON DUPLICATE KEY UPDATE value = VALUES(value)", upsert_params);
+		ok = db::error().empty();
+	}
+	if (!remove.empty()) {
+		db::query("DELETE FROM infobot_javascript_kv WHERE (guild_id, keyname) IN (" + remove + ")", remove_params);
+		ok = ok && db::error().empty();
+	}
+	return ok;
+}
+
+void KVStore::Flush()
+{
+	std::map<std::pair<uint64_t, std::string>, change> writing;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		writing.swap(changes);
+	}
+
+	std::vector<std::pair<uint64_t, change>> batch;
+	std::unordered_set<uint64_t> failed_guilds;
+	for (auto c = writing.begin(); c != writing.end(); ++c) {
+		batch.push_back(std::make_pair(c->first.first, c->second));
+		if (batch.size() == batch_size || std::next(c) == writing.end()) {
+			if (WriteChanges(batch)) {
+				written += batch.size();
+			} else {
+				/* One guild's bad row (over the database's own limit, say) mustn't lose the rest of the batch */
+				for (auto & single : batch) {
+					if (WriteChanges({single})) {
+						written++;
+					} else {
+						failed++;
+						failed_guilds.insert(single.first);
+						bot->core->log(dpp::ll_warning, fmt::format("Can't save javascript key '{}' for guild {}: {}", single.second.keyname, single.first, db::error()));
+					}
+				}
+			}
+			batch.clear();
+		}
+	}
+
+	/* Only now are the written guilds' database rows current, so only now can they be forgotten */
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto & c : writing) {
+		auto g = guilds.find(c.first.first);
+		if (g != guilds.end() && g->second.pending) {
+			g->second.pending--;
+		}
+	}
+	/* The memory copy of a guild with a failed write no longer matches the database. It is
+	 * dropped once nothing else is queued for it, and read again when it is next used.
+	 */
+	for (uint64_t guild_id : failed_guilds) {
+		auto g = guilds.find(guild_id);
+		if (g != guilds.end()) {
+			g->second.stale = true;
+		}
+	}
+	time_t now = time(nullptr);
+	for (auto g = guilds.begin(); g != guilds.end();) {
+		if (!g->second.pending && (g->second.stale || now - g->second.last_used > guild_idle_time)) {
+			g = guilds.erase(g);
+		} else {
+			++g;
+		}
+	}
+}
+
+void KVStore::Writer()
+{
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait_for(lock, interval, [this]() { return terminating || changes.size() >= eager_write; });
+			if (terminating) {
+				break;
+			}
+		}
+		Flush();
+	}
+}
+
+uint64_t KVStore::GetWritten()
+{
+	return written;
+}
+
+uint64_t KVStore::GetFailed()
+{
+	return failed;
+}
+
+size_t KVStore::GetPending()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return changes.size();
+}
+
+size_t KVStore::GetGuildCount()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return guilds.size();
+}
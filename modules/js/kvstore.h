@@ -0,0 +1,117 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+
+class Bot;
+
+/**
+ * Write-behind cache of infobot_javascript_kv for the save(), load() and delete() script functions.
+ *
+ * The first time a script in a guild uses a key, all of that guild's keys are read into memory,
+ * and load() is served from there after that. save() and delete() change the memory copy at once
+ * and queue the change, and a background thread writes queued changes in batches: one multi-row
+ * upsert and one multi-row delete per batch. Only the last change to each key is written.
+ *
+ * Key names compare the way MySQL compares them, see general_ci_fold(). Keys which can't be
+ * folded exactly, such as those in non-Latin scripts, are read and written in the database
+ * straight away instead, as MySQL is the only judge of which stored key they match.
+ * Each guild may hold a limited number of bytes, counting key names and values.
+ * Everything still queued is written when the store is destroyed. A guild with a change which
+ * couldn't be written is read from the database again the next time it is used.
+ */
+class KVStore {
+	struct guild_store {
+		/* Values by folded key name, each with the key name as the script first gave it */
+		std::unordered_map<std::string, std::pair<std::string, std::string>> entries;
+		size_t bytes = 0;
+		/* Changes for this guild waiting to be written */
+		size_t pending = 0;
+		time_t last_used = 0;
+		/* A write failed, so entries may not match the database */
+		bool stale = false;
+	};
+
+	struct change {
+		std::string keyname;
+		std::string value;
+		bool deleted;
+	};
+
+	Bot* bot;
+	size_t quota;
+	std::chrono::milliseconds interval;
+
+	std::mutex mtx;
+	std::unordered_map<uint64_t, guild_store> guilds;
+	/* Queued changes by guild and folded key name */
+	std::map<std::pair<uint64_t, std::string>, change> changes;
+
+	std::condition_variable cv;
+	bool terminating;
+	std::thread* writer;
+
+	std::atomic<uint64_t> written;
+	std::atomic<uint64_t> failed;
+
+	static std::string Fold(const std::string &keyname);
+
+	/* Make sure a guild's keys are in memory, reading them from the database if they aren't.
+	 * lock must hold mtx. It is released while the database is read, and held again on return,
+	 * so the guild can't be forgotten before the caller uses it. Returns false if the read failed.
+	 */
+	bool Fetch(uint64_t guild_id, std::unique_lock<std::mutex> &lock);
+
+	/* Write all queued changes, then forget guilds which have been idle for a while */
+	void Flush();
+	bool WriteChanges(const std::vector<std::pair<uint64_t, change>> &batch);
+	/* Write a change to a key which can't be folded exactly, without queueing it */
+	bool WriteDirect(uint64_t guild_id, const change &c);
+	void Writer();
+
+public:
+	/* Each guild may store up to quota bytes. Changes are written every interval */
+	KVStore(Bot* bot, size_t quota, std::chrono::milliseconds interval);
+	~KVStore();
+
+	/* Fetch a value into value, returns false if the key doesn't exist */
+	bool Get(uint64_t guild_id, const std::string &keyname, std::string &value);
+
+	/* Store a value. Returns false, changing nothing, if it would take the guild over its quota
+	 * or the guild's keys can't be read
+	 */
+	bool Set(uint64_t guild_id, const std::string &keyname, const std::string &value);
+
+	void Delete(uint64_t guild_id, const std::string &keyname);
+
+	uint64_t GetWritten();
+	uint64_t GetFailed();
+	size_t GetPending();
+	size_t GetGuildCount();
+};
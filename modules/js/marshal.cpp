@@ -0,0 +1,134 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <dpp/nlohmann/json.hpp>
+#include "marshal.h"
+#include "sandbox.h"
+
+using json = nlohmann::json;
+
+/* Fields of build_json() which aren't pushed directly. Each is a getter on the message object */
+static const char* lazy_message_fields[] = {
+	"embeds", "attachments", "components", "message_reference", "allowed_mentions", "sticker_ids", "stickers", nullptr
+};
+
+static void put_string(duk_context* ctx, const char* key, const std::string &value)
+{
+	duk_push_lstring(ctx, value.data(), value.length());
+	duk_put_prop_string(ctx, -2, key);
+}
+
+static void put_bool(duk_context* ctx, const char* key, bool value)
+{
+	duk_push_boolean(ctx, value);
+	duk_put_prop_string(ctx, -2, key);
+}
+
+static void put_number(duk_context* ctx, const char* key, double value)
+{
+	duk_push_number(ctx, value);
+	duk_put_prop_string(ctx, -2, key);
+}
+
+/* Getter for one of lazy_message_fields, the field name is the getter's "key" property */
+static duk_ret_t get_lazy_field(duk_context* ctx)
+{
+	duk_memory_functions funcs;
+	duk_get_memory_functions(ctx, &funcs);
+	sandbox_heap* heap = (sandbox_heap*)funcs.udata;
+	if (!heap->message) {
+		return 0;
+	}
+
+	/* The serialised message is parsed once, then kept in the stash for the other getters */
+	duk_push_heap_stash(ctx);
+	if (!duk_get_prop_string(ctx, -1, "message_json")) {
+		duk_pop(ctx);
+		std::string j = heap->message->build_json(true);
+		duk_push_lstring(ctx, j.data(), j.length());
+		duk_json_decode(ctx, -1);
+		duk_dup(ctx, -1);
+		duk_put_prop_string(ctx, -3, "message_json");
+	}
+	duk_push_current_function(ctx);
+	duk_get_prop_string(ctx, -1, "key");
+	duk_get_prop(ctx, -3);
+	return 1;
+}
+
+void push_message_globals(duk_context* ctx, sandbox_heap* heap, const dpp::message &msg, const std::vector<std::string> &mentions)
+{
+	std::string guild_id = std::to_string(msg.guild_id);
+
+	dpp::channel* c = dpp::find_channel(msg.channel_id);
+	if (c) {
+		duk_push_object(ctx);
+		put_string(ctx, "name", c->name);
+		put_bool(ctx, "nsfw", c->is_nsfw());
+		put_bool(ctx, "dm", c->is_dm());
+		put_string(ctx, "id", std::to_string(c->id));
+		put_string(ctx, "guild_id", guild_id);
+		duk_put_prop_string(ctx, -2, "channel");
+	}
+
+	dpp::guild* g = dpp::find_guild(msg.guild_id);
+	if (g) {
+		duk_push_object(ctx);
+		put_string(ctx, "name", g->name);
+		put_string(ctx, "owner", std::to_string(g->owner_id));
+		put_string(ctx, "id", guild_id);
+		put_number(ctx, "member_count", g->members.size());
+		duk_put_prop_string(ctx, -2, "guild");
+	}
+
+	duk_push_object(ctx);
+	put_string(ctx, "id", std::to_string(msg.id));
+	/* Scripts have always had the channel id as a number, the exact value is in channel_id_str */
+	put_number(ctx, "channel_id", msg.channel_id);
+	put_string(ctx, "channel_id_str", std::to_string(msg.channel_id));
+	put_string(ctx, "guild_id", guild_id);
+	put_string(ctx, "content", msg.content);
+	put_string(ctx, "nonce", msg.nonce);
+	put_bool(ctx, "tts", msg.tts);
+	put_bool(ctx, "mention_everyone", msg.mention_everyone);
+	put_bool(ctx, "pinned", msg.pinned);
+	put_number(ctx, "flags", (uint32_t)msg.flags);
+	put_number(ctx, "type", (uint32_t)msg.type);
+	for (const char** field = lazy_message_fields; *field; ++field) {
+		duk_push_string(ctx, *field);
+		duk_push_c_function(ctx, get_lazy_field, 0);
+		duk_push_string(ctx, *field);
+		duk_put_prop_string(ctx, -2, "key");
+		duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_GETTER | DUK_DEFPROP_SET_ENUMERABLE | DUK_DEFPROP_SET_CONFIGURABLE);
+	}
+	duk_put_prop_string(ctx, -2, "message");
+
+	duk_push_object(ctx);
+	put_string(ctx, "id", msg.author ? std::to_string(msg.author->id) : "0");
+	put_string(ctx, "guild_id", guild_id);
+	duk_put_prop_string(ctx, -2, "author");
+
+	duk_idx_t arr = duk_push_array(ctx);
+	for (size_t i = 0; i < mentions.size(); ++i) {
+		duk_push_lstring(ctx, mentions[i].data(), mentions[i].length());
+		duk_put_prop_index(ctx, arr, i);
+	}
+	duk_put_prop_string(ctx, -2, "mentions");
+}
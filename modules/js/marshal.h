@@ -0,0 +1,38 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <dpp/dpp.h>
+#include <string>
+#include <vector>
+#include "duktape.h"
+
+struct sandbox_heap;
+
+/**
+ * Define the message, author, channel, guild and mentions globals for a script, built
+ * straight from the D++ cache objects. The object at the top of the stack receives them,
+ * normally the global object.
+ *
+ * Message fields which are rarely read (embeds, attachments, components and so on) are
+ * getters which serialise the message the first time one of them is used. The heap's
+ * message pointer must stay valid for as long as the script runs.
+ */
+void push_message_globals(duk_context* ctx, sandbox_heap* heap, const dpp::message &msg, const std::vector<std::string> &mentions);
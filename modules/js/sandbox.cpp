@@ -0,0 +1,373 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <fmt/format.h>
+#include <stdexcept>
+#include <cstddef>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "sandbox.h"
+
+static_assert(offsetof(sandbox_heap, clock) == 0, "exec_clock must be the first member of sandbox_heap");
+
+struct alloc_hdr {
+	/* The double value in the union is there to ensure alignment is
+	 * good for IEEE doubles too.  In many 32-bit environments 4 bytes
+	 * would be sufficiently aligned and the double value is unnecessary.
+	 */
+	union {
+		size_t sz;
+		double d;
+	} u;
+};
+
+/* Most mappings kept for reuse by the next heaps built */
+const size_t max_spare_arenas = 16;
+
+/**
+ * Size class for a block of n bytes, header included, setting block to the size of
+ * that class. Classes go up in 16 byte steps to 128 bytes, then in four steps per
+ * power of two up to arena_max_block.
+ */
+static inline size_t size_class(size_t n, size_t &block)
+{
+	if (n <= 128) {
+		size_t index = (n + 15) / 16;
+		block = index * 16;
+		return index - 1;
+	}
+	size_t shift = 63 - __builtin_clzl(n - 1);
+	size_t step = (size_t)1 << (shift - 2);
+	block = (n + step - 1) & ~(step - 1);
+	return 8 + (shift - 7) * 4 + (block - ((size_t)1 << shift)) / step - 1;
+}
+
+static inline bool in_arena(const sandbox_arena &arena, const void* ptr)
+{
+	return (const char*)ptr >= arena.base && (const char*)ptr < arena.base + arena.size;
+}
+
+/* Allocate a block with room for a header and size bytes, from the arena if it can */
+static alloc_hdr* block_alloc(sandbox_arena &arena, size_t size)
+{
+	size_t n = size + sizeof(alloc_hdr);
+	if (n <= arena_max_block && arena.base) {
+		size_t block;
+		size_t index = size_class(n, block);
+		void* b = arena.free_lists[index];
+		if (b) {
+			arena.free_lists[index] = *(void**)b;
+			return (alloc_hdr*)b;
+		}
+		if (arena.used + block <= arena.size) {
+			b = arena.base + arena.used;
+			arena.used += block;
+			return (alloc_hdr*)b;
+		}
+	}
+	return (alloc_hdr*)malloc(n);
+}
+
+static void block_free(sandbox_arena &arena, alloc_hdr* hdr)
+{
+	if (in_arena(arena, hdr)) {
+		size_t block;
+		size_t index = size_class(hdr->u.sz + sizeof(alloc_hdr), block);
+		*(void**)hdr = arena.free_lists[index];
+		arena.free_lists[index] = hdr;
+	} else {
+		free((void *) hdr);
+	}
+}
+
+void sandbox_fatal(void *udata, const char *msg) {
+	// Yeah, according to the docs a fatal can never return. Technically, it doesnt.
+	// At this point we should probably destroy the duk context as bad.
+	std::string error = msg;
+	throw std::runtime_error("JS error: " + error);
+}
+
+void sandbox_free(void *udata, void *ptr) {
+	sandbox_heap* heap = (sandbox_heap*)udata;
+	alloc_hdr *hdr;
+
+	if (!ptr) {
+		return;
+	}
+	hdr = (alloc_hdr *) (((char *) ptr) - sizeof(alloc_hdr));
+	heap->allocated -= hdr->u.sz;
+	block_free(heap->arena, hdr);
+}
+
+void *sandbox_alloc(void *udata, duk_size_t size) {
+	sandbox_heap* heap = (sandbox_heap*)udata;
+	alloc_hdr *hdr;
+
+	if (size == 0) {
+		return NULL;
+	}
+
+	if (heap->allocated + size > heap->limit) {
+		heap->core->log(dpp::ll_error, fmt::format("Sandbox maximum allocation size reached, {} requested in sandbox_alloc", (long) size));
+		return NULL;
+	}
+
+	hdr = block_alloc(heap->arena, size);
+	if (!hdr) {
+		return NULL;
+	}
+	hdr->u.sz = size;
+	heap->allocated += size;
+	return (void *) (hdr + 1);
+}
+
+void *sandbox_realloc(void *udata, void *ptr, duk_size_t size) {
+	sandbox_heap* heap = (sandbox_heap*)udata;
+	alloc_hdr *hdr;
+
+	/* Handle the ptr-NULL vs. size-zero cases explicitly to minimize
+	 * platform assumptions.  You can get away with much less in specific
+	 * well-behaving environments.
+	 */
+
+	if (ptr) {
+		hdr = (alloc_hdr *) (((char *) ptr) - sizeof(alloc_hdr));
+		size_t old_size = hdr->u.sz;
+
+		if (size == 0) {
+			heap->allocated -= old_size;
+			block_free(heap->arena, hdr);
+			return NULL;
+		} else {
+			if (heap->allocated - old_size + size > heap->limit) {
+				heap->core->log(dpp::ll_error, fmt::format("Sandbox maximum allocation size reached, {} requested in sandbox_realloc", (long) size));
+				return NULL;
+			}
+
+			if (in_arena(heap->arena, hdr)) {
+				size_t old_block, new_block;
+				size_t new_n = size + sizeof(alloc_hdr);
+				/* Still fits the same size class, so it can stay where it is */
+				if (new_n <= arena_max_block && size_class(old_size + sizeof(alloc_hdr), old_block) == size_class(new_n, new_block)) {
+					heap->allocated -= old_size;
+					heap->allocated += size;
+					hdr->u.sz = size;
+					return ptr;
+				}
+				alloc_hdr* moved = block_alloc(heap->arena, size);
+				if (!moved) {
+					return NULL;
+				}
+				memcpy(moved + 1, ptr, std::min<size_t>(old_size, size));
+				block_free(heap->arena, hdr);
+				hdr = moved;
+			} else if (size + sizeof(alloc_hdr) > arena_max_block) {
+				void* t = realloc((void *) hdr, size + sizeof(alloc_hdr));
+
+				if (!t) {
+					return NULL;
+				}
+				hdr = (alloc_hdr *) t;
+			} else {
+				/* Shrinking out of malloc into a size class */
+				alloc_hdr* moved = block_alloc(heap->arena, size);
+				if (!moved) {
+					return NULL;
+				}
+				memcpy(moved + 1, ptr, std::min<size_t>(old_size, size));
+				free((void *) hdr);
+				hdr = moved;
+			}
+			heap->allocated -= old_size;
+			heap->allocated += size;
+			hdr->u.sz = size;
+			return (void *) (hdr + 1);
+		}
+	} else {
+		return sandbox_alloc(udata, size);
+	}
+}
+
+HeapPool::HeapPool(dpp::cluster* cluster, heap_initialiser init, size_t _build_limit, size_t heaps, size_t _budget, size_t _arena_size) : core(cluster), initialiser(init), build_limit(_build_limit), target(heaps), budget(_budget), arena_size(_arena_size), ready_bytes(0), heap_bytes(0), terminating(false), builder(nullptr), hits(0), misses(0)
+{
+	if (target) {
+		builder = new std::thread(&HeapPool::Builder, this);
+	}
+}
+
+HeapPool::~HeapPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		terminating = true;
+	}
+	cv.notify_all();
+	if (builder) {
+		builder->join();
+		delete builder;
+	}
+	for (sandbox_heap* heap : ready) {
+		Destroy(heap);
+	}
+	for (sandbox_heap* heap : retired) {
+		Destroy(heap);
+	}
+	for (char* base : spare_arenas) {
+		munmap(base, arena_size);
+	}
+}
+
+sandbox_heap* HeapPool::Create()
+{
+	sandbox_heap* heap = new sandbox_heap();
+	heap->clock.timeout = 0;
+	heap->core = core;
+	heap->allocated = 0;
+	heap->limit = build_limit;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!spare_arenas.empty()) {
+			heap->arena.base = spare_arenas.back();
+			spare_arenas.pop_back();
+		}
+	}
+	if (!heap->arena.base) {
+		/* Only address space is reserved here, pages are committed as the heap touches them */
+		void* base = mmap(nullptr, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		heap->arena.base = (base == MAP_FAILED ? nullptr : (char*)base);
+	}
+	heap->arena.size = heap->arena.base ? arena_size : 0;
+	heap->ctx = duk_create_heap(sandbox_alloc, sandbox_realloc, sandbox_free, heap, sandbox_fatal);
+	if (!heap->ctx) {
+		Destroy(heap);
+		return nullptr;
+	}
+	initialiser(heap->ctx);
+	return heap;
+}
+
+void HeapPool::Destroy(sandbox_heap* heap)
+{
+	if (heap->ctx) {
+		duk_destroy_heap(heap->ctx);
+	}
+	/* Arena blocks are never given back one at a time, the whole mapping is reused or unmapped.
+	 * Touched pages are released before the mapping is kept as a spare, so that idle spares
+	 * don't hold memory outside the pool's budget.
+	 */
+	if (heap->arena.base) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		madvise(heap->arena.base, std::min(heap->arena.size, (heap->arena.used + page - 1) / page * page), MADV_DONTNEED);
+		std::lock_guard<std::mutex> lock(mtx);
+		if (spare_arenas.size() < max_spare_arenas) {
+			spare_arenas.push_back(heap->arena.base);
+		} else {
+			munmap(heap->arena.base, heap->arena.size);
+		}
+	}
+	delete heap;
+}
+
+bool HeapPool::CanGrow() const
+{
+	return ready.size() < target && ready_bytes + heap_bytes <= budget;
+}
+
+void HeapPool::Builder()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	while (!terminating) {
+		cv.wait(lock, [this] { return terminating || !retired.empty() || CanGrow(); });
+		if (terminating) {
+			break;
+		}
+		if (!retired.empty()) {
+			sandbox_heap* heap = retired.front();
+			retired.pop_front();
+			lock.unlock();
+			Destroy(heap);
+			lock.lock();
+		} else {
+			lock.unlock();
+			sandbox_heap* heap = Create();
+			lock.lock();
+			if (!heap) {
+				core->log(dpp::ll_error, "Can't create a javascript heap for the pool");
+				/* Don't spin, wait for something to be given back */
+				cv.wait_for(lock, std::chrono::seconds(5));
+				continue;
+			}
+			heap_bytes = heap->allocated;
+			ready_bytes += heap->allocated;
+			ready.push_back(heap);
+		}
+	}
+}
+
+sandbox_heap* HeapPool::Acquire(size_t limit)
+{
+	sandbox_heap* heap = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!ready.empty()) {
+			heap = ready.front();
+			ready.pop_front();
+			ready_bytes -= heap->allocated;
+		}
+	}
+	if (heap) {
+		hits++;
+		cv.notify_one();
+	} else {
+		misses++;
+		heap = Create();
+		if (!heap) {
+			return nullptr;
+		}
+	}
+	heap->limit = limit;
+	return heap;
+}
+
+void HeapPool::Release(sandbox_heap* heap)
+{
+	if (!builder) {
+		Destroy(heap);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		retired.push_back(heap);
+	}
+	cv.notify_one();
+}
+
+uint64_t HeapPool::GetHits()
+{
+	return hits;
+}
+
+uint64_t HeapPool::GetMisses()
+{
+	return misses;
+}
@@ -0,0 +1,135 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <dpp/dpp.h>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "duktape.h"
+#include "timeout.h"
+
+
+/* Number of arena size classes. Blocks over arena_max_block bytes come from malloc */
+const size_t arena_classes = 28;
+const size_t arena_max_block = 4096;
+
+/**
+ * Memory for one heap. Blocks are cut from one mapping by bumping a pointer and recycled
+ * through a free list per size class, so most of Duktape's allocations never reach malloc
+ * and everything goes back in one step once the heap is destroyed. Allocations too big for
+ * a size class, or made once the mapping is used up, fall back to malloc.
+ */
+struct sandbox_arena {
+	char* base;
+	size_t size;
+	size_t used;
+	void* free_lists[arena_classes];
+};
+
+/**
+ * A Duktape heap and the state of the run it is used for, given to its allocator, fatal
+ * handler and timeout check as udata. Native functions find it with duk_get_memory_functions().
+ * Nothing here is shared between heaps, so scripts can run on any number of threads.
+ */
+struct sandbox_heap {
+	/* Must stay first, check_exec_timeout() sees the udata as an exec_clock */
+	exec_clock clock;
+	duk_context* ctx;
+	dpp::cluster* core;
+	sandbox_arena arena;
+	/* Bytes currently allocated by this heap, and the most it may allocate */
+	size_t allocated;
+	size_t limit;
+	/* The channel and guild the script is running for, and messages it has sent so far */
+	uint64_t channel_id;
+	dpp::guild* guild;
+	uint32_t message_total;
+	/* The message which triggered the script, if any */
+	const dpp::message* message;
+};
+
+void sandbox_fatal(void *udata, const char *msg);
+void sandbox_free(void *udata, void *ptr);
+void *sandbox_alloc(void *udata, duk_size_t size);
+void *sandbox_realloc(void *udata, void *ptr, duk_size_t size);
+
+/* Installs the globals and native functions every heap starts with */
+typedef void (*heap_initialiser)(duk_context* ctx);
+
+/**
+ * A pool of heaps which are created, with their builtins and native bindings,
+ * before they are needed.
+ *
+ * Duktape can't put a used heap back to a clean state, and a script may have changed
+ * anything in it, so a heap is only used once. A background thread builds heaps to keep
+ * the pool full and destroys used ones, so neither happens while a message waits.
+ * The pool is limited both in heaps and in the memory its idle heaps use.
+ */
+class HeapPool {
+	dpp::cluster* core;
+	heap_initialiser initialiser;
+	/* Quota while a heap is built, before it is given out */
+	size_t build_limit;
+	size_t target;
+	size_t budget;
+	size_t arena_size;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<sandbox_heap*> ready;
+	std::deque<sandbox_heap*> retired;
+	/* Memory used by the heaps in ready */
+	size_t ready_bytes;
+	/* Memory used by the most recently built heap, to tell if another one fits the budget */
+	size_t heap_bytes;
+	bool terminating;
+	std::thread* builder;
+	/* Mappings of destroyed heaps, kept to give to new heaps without another mmap() */
+	std::vector<char*> spare_arenas;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+
+	sandbox_heap* Create();
+	void Destroy(sandbox_heap* heap);
+	bool CanGrow() const;
+	void Builder();
+
+public:
+	/* Keep up to heaps idle heaps using no more than budget bytes between them. Builtins and
+	 * anything init installs must fit in build_limit bytes. Each heap reserves arena_size bytes
+	 * of address space, which should allow for size class rounding on top of the largest quota.
+	 */
+	HeapPool(dpp::cluster* cluster, heap_initialiser init, size_t build_limit, size_t heaps, size_t budget, size_t arena_size);
+	~HeapPool();
+
+	/* A fresh heap allowed to allocate up to limit bytes. Returns nullptr if a heap can't be created */
+	sandbox_heap* Acquire(size_t limit);
+
+	/* Give back a heap from Acquire(). It is destroyed in the background */
+	void Release(sandbox_heap* heap);
+
+	uint64_t GetHits();
+	uint64_t GetMisses();
+};
@@ -0,0 +1,224 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <dpp/dpp.h>
+#include <fmt/format.h>
+#include <sporks/bot.h>
+#include <sporks/database.h>
+#include <algorithm>
+#include "stats.h"
+
+/* Most channels written by one statement */
+const size_t stats_batch = 100;
+
+struct stats_row {
+	uint64_t id;
+	uint64_t runs;
+	uint64_t errors;
+	bool ran;
+	double last_exec_ms;
+	size_t last_memory;
+	bool compiled;
+	double last_compile_ms;
+	bool error_set;
+	std::string last_error;
+	std::vector<float> recent;
+};
+
+/* Build "column = CASE id WHEN ? THEN ? ... ELSE column END" for the rows selected by include */
+template<typename F, typename V> static void add_case(std::string &sets, db::paramlist &params, const char* column, const std::vector<stats_row> &rows, F include, V value, bool quoted)
+{
+	std::string cases;
+	for (auto & r : rows) {
+		if (include(r)) {
+			cases += quoted ? " WHEN ? THEN '?'" : " WHEN ? THEN ?";
+			params.push_back(r.id);
+			params.push_back(value(r));
+		}
+	}
+	if (!cases.empty()) {
+		sets += std::string(sets.empty() ? "" : ", ") + "`" + column + "` = CASE id" + cases + " ELSE `" + column + "` END";
+	}
+}
+
+static double percentile(const std::vector<float> &sorted, double p)
+{
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5))];
+}
+
+ScriptStats::ScriptStats(Bot* _bot, time_t _interval) : bot(_bot), interval(_interval), totals_columns(true), terminating(false), writer(nullptr)
+{
+	writer = new std::thread(&ScriptStats::Writer, this);
+}
+
+ScriptStats::~ScriptStats()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		terminating = true;
+	}
+	cv.notify_all();
+	bot->DisposeThread(writer);
+	Flush();
+}
+
+ScriptStats::channel_stats& ScriptStats::Get(uint64_t channel_id)
+{
+	channel_stats &s = channels[channel_id];
+	s.dirty = true;
+	return s;
+}
+
+void ScriptStats::RecordCompile(uint64_t channel_id, double compile_ms)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	channel_stats &s = Get(channel_id);
+	s.compiled = true;
+	s.last_compile_ms = compile_ms;
+}
+
+void ScriptStats::RecordRun(uint64_t channel_id, double exec_ms, size_t memory)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	channel_stats &s = Get(channel_id);
+	s.runs++;
+	s.ran = true;
+	s.last_exec_ms = exec_ms;
+	s.last_memory = memory;
+	if (s.recent.size() < stats_window) {
+		s.recent.push_back(exec_ms);
+	} else {
+		s.recent[s.next] = exec_ms;
+		s.next = (s.next + 1) % stats_window;
+	}
+}
+
+void ScriptStats::RecordError(uint64_t channel_id, const std::string &error)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	channel_stats &s = Get(channel_id);
+	if (!error.empty()) {
+		s.errors++;
+	}
+	s.error_set = true;
+	s.last_error = error;
+}
+
+void ScriptStats::Flush()
+{
+	std::vector<stats_row> rows;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto & c : channels) {
+			channel_stats &s = c.second;
+			if (!s.dirty) {
+				continue;
+			}
+			rows.push_back({c.first, s.runs, s.errors, s.ran, s.last_exec_ms, s.last_memory, s.compiled, s.last_compile_ms, s.error_set, s.last_error, s.recent});
+			s.runs = s.errors = 0;
+			s.ran = s.compiled = s.error_set = s.dirty = false;
+		}
+	}
+
+	for (size_t start = 0; start < rows.size(); start += stats_batch) {
+		std::vector<stats_row> batch(rows.begin() + start, rows.begin() + std::min(rows.size(), start + stats_batch));
+		std::string sets;
+		db::paramlist params;
+		auto ran = [](const stats_row &r) { return r.ran; };
+
+		add_case(sets, params, "last_compile_ms", batch, [](const stats_row &r) { return r.compiled; }, [](const stats_row &r) { return r.last_compile_ms; }, false);
+		add_case(sets, params, "last_exec_ms", batch, ran, [](const stats_row &r) { return r.last_exec_ms; }, false);
+		add_case(sets, params, "last_memory_max", batch, ran, [](const stats_row &r) { return (uint64_t)r.last_memory; }, false);
+		add_case(sets, params, "last_error", batch, [](const stats_row &r) { return r.error_set; }, [](const stats_row &r) { return r.last_error; }, true);
+
+		/* Columns added by mysql-schema/upgrade.sql, which older databases may not have */
+		std::string totals;
+		db::paramlist totals_params;
+
+		/* Totals are added to, so the column is its own ELSE */
+		std::string cases;
+		for (auto & r : batch) {
+			cases += " WHEN ? THEN ?";
+			totals_params.push_back(r.id);
+			totals_params.push_back(r.runs);
+		}
+		totals += ", `runs` = `runs` + CASE id" + cases + " ELSE 0 END";
+		cases.clear();
+		for (auto & r : batch) {
+			cases += " WHEN ? THEN ?";
+			totals_params.push_back(r.id);
+			totals_params.push_back(r.errors);
+		}
+		totals += ", `errors` = `errors` + CASE id" + cases + " ELSE 0 END";
+
+		for (auto & r : batch) {
+			std::sort(r.recent.begin(), r.recent.end());
+		}
+		auto timed = [](const stats_row &r) { return !r.recent.empty(); };
+		add_case(totals, totals_params, "exec_ms_min", batch, timed, [](const stats_row &r) { return (double)r.recent.front(); }, false);
+		add_case(totals, totals_params, "exec_ms_max", batch, timed, [](const stats_row &r) { return (double)r.recent.back(); }, false);
+		add_case(totals, totals_params, "exec_ms_p50", batch, timed, [](const stats_row &r) { return percentile(r.recent, 0.5); }, false);
+		add_case(totals, totals_params, "exec_ms_p95", batch, timed, [](const stats_row &r) { return percentile(r.recent, 0.95); }, false);
+
+		std::string ids;
+		db::paramlist id_params;
+		for (auto & r : batch) {
+			ids += std::string(ids.empty() ? "" : ",") + "?";
+			id_params.push_back(r.id);
+		}
+
+		/* An UPDATE, so that stats for a script deleted meanwhile don't bring its row back. Keeping
+		 * `updated` as it was stops statistics looking like an edit to the script.
+		 */
+		if (totals_columns) {
+			db::paramlist all_params = params;
+			all_params.insert(all_params.end(), totals_params.begin(), totals_params.end());
+			all_params.insert(all_params.end(), id_params.begin(), id_params.end());
+			db::query("UPDATE infobot_discord_javascript SET " + sets + totals + ", `updated` = `updated` WHERE id IN (" + ids + ")", all_params);
+			if (db::error().empty()) {
+				continue;
+			}
+		}
+		std::string error = db::error();
+		params.insert(params.end(), id_params.begin(), id_params.end());
+		db::query("UPDATE infobot_discord_javascript SET " + sets + ", `updated` = `updated` WHERE id IN (" + ids + ")", params);
+		if (!db::error().empty()) {
+			bot->core->log(dpp::ll_warning, fmt::format("Can't write javascript statistics for {} channels: {}", batch.size(), db::error()));
+		} else if (totals_columns) {
+			/* Only the newer columns were the problem, so stop writing them until the bot is restarted */
+			bot->core->log(dpp::ll_warning, fmt::format("Can't write javascript run totals and timings, apply mysql-schema/upgrade.sql and restart: {}", error));
+			totals_columns = false;
+		}
+	}
+}
+
+void ScriptStats::Writer()
+{
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait_for(lock, std::chrono::seconds(interval), [this]() { return terminating; });
+			if (terminating) {
+				break;
+			}
+		}
+		Flush();
+	}
+}
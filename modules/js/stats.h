@@ -0,0 +1,87 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+class Bot;
+
+/* Number of recent runs per channel that min, max and percentile execution times are taken over */
+const size_t stats_window = 128;
+
+/**
+ * Execution statistics for channel scripts, kept in memory and written to
+ * infobot_discord_javascript by a background thread, one UPDATE for many channels at a time,
+ * instead of several UPDATEs after every run.
+ *
+ * Alongside the last compile time, execution time, memory use and error, each channel's row
+ * gets counts of runs and errors, and the min, max, median and 95th percentile execution time
+ * over its last stats_window runs.
+ */
+class ScriptStats {
+	struct channel_stats {
+		/* Runs and errors since the last write, added to the totals in the database */
+		uint64_t runs = 0;
+		uint64_t errors = 0;
+		bool ran = false;
+		double last_exec_ms = 0;
+		size_t last_memory = 0;
+		bool compiled = false;
+		double last_compile_ms = 0;
+		bool error_set = false;
+		std::string last_error;
+		/* Ring of recent execution times */
+		std::vector<float> recent;
+		size_t next = 0;
+		bool dirty = false;
+	};
+
+	Bot* bot;
+	time_t interval;
+
+	std::mutex mtx;
+	std::unordered_map<uint64_t, channel_stats> channels;
+	/* False if the database lacks the runs, errors and exec_ms_* columns. Only used by Flush() */
+	bool totals_columns;
+
+	std::condition_variable cv;
+	bool terminating;
+	std::thread* writer;
+
+	channel_stats& Get(uint64_t channel_id);
+	void Flush();
+	void Writer();
+
+public:
+	/* Write changed statistics every interval seconds */
+	ScriptStats(Bot* bot, time_t interval);
+	~ScriptStats();
+
+	void RecordCompile(uint64_t channel_id, double compile_ms);
+	void RecordRun(uint64_t channel_id, double exec_ms, size_t memory);
+	/* Record the outcome of a run or compile, an empty error meaning success */
+	void RecordError(uint64_t channel_id, const std::string &error);
+};
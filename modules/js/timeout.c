@@ -19,19 +19,19 @@
  ************************************************************************************/
 
 #include "duktape.h"
+#include "timeout.h"
 #include <sys/time.h>
 
-int interrupt = 0;
-struct timeval t_script_start;
-struct timeval t_script_now;
-
-extern uint64_t timeout;
-
 duk_bool_t check_exec_timeout(void *udata)
 {
-	gettimeofday(&t_script_now, NULL);
-	uint64_t microsecs = (t_script_now.tv_sec - t_script_start.tv_sec) * 1000000 + t_script_now.tv_usec - t_script_start.tv_usec;
+	struct exec_clock* clock = (struct exec_clock*)udata;
+	if (!clock || !clock->timeout) {
+		return 0;
+	}
+
+	gettimeofday(&clock->now, NULL);
+	uint64_t microsecs = (clock->now.tv_sec - clock->start.tv_sec) * 1000000 + clock->now.tv_usec - clock->start.tv_usec;
 
-        return (microsecs > (timeout * 1000) ? 1 : 0);
+        return (microsecs > (clock->timeout * 1000) ? 1 : 0);
 }
 
@@ -0,0 +1,34 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <sys/time.h>
+
+/**
+ * Time limit for one script run. This is the first member of each heap's udata, which
+ * Duktape passes to check_exec_timeout(), so that every heap is timed on its own.
+ */
+struct exec_clock {
+	struct timeval start;
+	struct timeval now;
+	/* Milliseconds the script may run for, 0 for no limit */
+	uint64_t timeout;
+};
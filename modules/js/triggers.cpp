@@ -0,0 +1,92 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <dpp/nlohmann/json.hpp>
+#include <fmt/format.h>
+#include <stdexcept>
+#include <sporks/stringops.h>
+#include "triggers.h"
+
+using json = nlohmann::json;
+
+TriggerFilter::TriggerFilter(const std::string &config) : mentioned(false)
+{
+	json j = json::parse(config);
+	if (j.find("prefixes") != j.end()) {
+		for (auto & p : j["prefixes"]) {
+			if (!p.get<std::string>().empty()) {
+				prefixes.push_back(p.get<std::string>());
+			}
+		}
+	}
+	if (j.find("regex") != j.end()) {
+		for (auto & r : j["regex"]) {
+			std::string pattern = r.get<std::string>();
+			if (pattern.length() > max_trigger_regex) {
+				throw std::length_error(fmt::format("regex is longer than {} characters", max_trigger_regex));
+			}
+			patterns.push_back(std::make_unique<PCRE>(pattern));
+			/* Patterns run on the shard threads for every message in the channel */
+			patterns.back()->SetMatchLimit(trigger_match_limit, trigger_recursion_limit);
+		}
+	}
+	if (j.find("mentioned") != j.end()) {
+		mentioned = j["mentioned"].get<bool>();
+	}
+	if (j.find("allow") != j.end()) {
+		for (auto & a : j["allow"]) {
+			allow.insert(from_string<uint64_t>(a.get<std::string>(), std::dec));
+		}
+	}
+	if (j.find("deny") != j.end()) {
+		for (auto & d : j["deny"]) {
+			deny.insert(from_string<uint64_t>(d.get<std::string>(), std::dec));
+		}
+	}
+}
+
+bool TriggerFilter::Matches(const dpp::message &msg, bool is_mentioned) const
+{
+	uint64_t author_id = msg.author ? (uint64_t)msg.author->id : 0;
+	if (deny.find(author_id) != deny.end()) {
+		return false;
+	}
+	if (!allow.empty() && allow.find(author_id) == allow.end()) {
+		return false;
+	}
+
+	if (prefixes.empty() && patterns.empty() && !mentioned) {
+		return true;
+	}
+	if (mentioned && is_mentioned) {
+		return true;
+	}
+	for (auto & prefix : prefixes) {
+		if (msg.content.compare(0, prefix.length(), prefix) == 0) {
+			return true;
+		}
+	}
+	for (auto & pattern : patterns) {
+		if (pattern->Match(msg.content)) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,58 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <dpp/dpp.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_set>
+#include <sporks/regex.h>
+
+/* Longest regex allowed in a script's triggers, and the PCRE limits on matching one */
+const size_t max_trigger_regex = 256;
+const unsigned long trigger_match_limit = 10000;
+const unsigned long trigger_recursion_limit = 1000;
+
+/**
+ * Which messages a channel's script wants to see, from the `triggers` column of
+ * infobot_discord_javascript. It is checked before a heap is taken for the script,
+ * so that scripts aren't run just to ignore a message. The column holds JSON:
+ *
+ * {"prefixes": ["!", "?"], "regex": ["^hello"], "mentioned": true, "allow": ["<user id>"], "deny": ["<user id>"]}
+ *
+ * Authors in deny are always skipped, and if allow isn't empty only authors in it are let
+ * through. Then if any of prefixes, regex or mentioned are given, the message must match at
+ * least one of them. An empty column runs the script for every message.
+ */
+class TriggerFilter {
+	std::vector<std::string> prefixes;
+	std::vector<std::unique_ptr<PCRE>> patterns;
+	bool mentioned;
+	std::unordered_set<uint64_t> allow;
+	std::unordered_set<uint64_t> deny;
+
+public:
+	/* Throws std::exception or regex_exception* if the configuration is invalid */
+	TriggerFilter(const std::string &config);
+
+	/* True if the script should run for msg. mentioned is true if the message mentions the bot */
+	bool Matches(const dpp::message &msg, bool is_mentioned) const;
+};
@@ -0,0 +1,743 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <dpp/dpp.h>
+#include <fmt/format.h>
+#include <sporks/bot.h>
+#include <sporks/stringops.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include "webrequest.h"
+
+using steady = std::chrono::steady_clock;
+
+const auto dns_timeout = std::chrono::seconds(1);
+const auto connect_timeout = std::chrono::seconds(2);
+const auto total_timeout = std::chrono::seconds(5);
+const int max_redirects = 3;
+const size_t max_post = 256 * 1024;
+const size_t max_response = 1024 * 1024;
+const size_t max_headers = 64 * 1024;
+
+/* Longest a worker blocks without checking whether the bot is shutting down */
+const auto poll_slice = std::chrono::milliseconds(250);
+
+namespace {
+
+/* One TLS context shared by every request, freed when the module is unloaded */
+struct tls_context {
+	SSL_CTX* ctx;
+	tls_context() {
+		ctx = SSL_CTX_new(TLS_client_method());
+		if (ctx) {
+			SSL_CTX_set_default_verify_paths(ctx);
+			SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+			SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+			/* Plenty of servers close the connection without a close_notify */
+			SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+		}
+	}
+	~tls_context() {
+		SSL_CTX_free(ctx);
+	}
+} tls;
+
+struct url_parts {
+	bool https;
+	std::string host;
+	std::string port;
+	/* Path and query string */
+	std::string target;
+};
+
+bool parse_url(const std::string &url, url_parts &u)
+{
+	size_t start;
+	if (lowercase(url.substr(0, 7)) == "http://") {
+		u.https = false;
+		start = 7;
+	} else if (lowercase(url.substr(0, 8)) == "https://") {
+		u.https = true;
+		start = 8;
+	} else {
+		return false;
+	}
+	size_t end = url.find_first_of("/?#", start);
+	std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+	size_t at = authority.rfind('@');
+	if (at != std::string::npos) {
+		authority = authority.substr(at + 1);
+	}
+	u.port = u.https ? "443" : "80";
+	if (!authority.empty() && authority[0] == '[') {
+		size_t close = authority.find(']');
+		if (close == std::string::npos) {
+			return false;
+		}
+		u.host = authority.substr(1, close - 1);
+		if (close + 1 < authority.size()) {
+			if (authority[close + 1] != ':') {
+				return false;
+			}
+			u.port = authority.substr(close + 2);
+		}
+	} else {
+		size_t colon = authority.find(':');
+		u.host = authority.substr(0, colon);
+		if (colon != std::string::npos) {
+			u.port = authority.substr(colon + 1);
+		}
+	}
+	u.target = end == std::string::npos ? "/" : url.substr(end);
+	u.target = u.target.substr(0, u.target.find('#'));
+	if (u.target.empty() || u.target[0] != '/') {
+		u.target = "/" + u.target;
+	}
+	return !u.host.empty() && !u.port.empty() && u.port.length() <= 5 && u.port.find_first_not_of("0123456789") == std::string::npos &&
+		u.host.find_first_of(" \t\r\n") == std::string::npos && u.target.find_first_of(" \t\r\n") == std::string::npos;
+}
+
+bool is_ip_address(const std::string &host)
+{
+	unsigned char addr[sizeof(in6_addr)];
+	return inet_pton(AF_INET, host.c_str(), addr) == 1 || inet_pton(AF_INET6, host.c_str(), addr) == 1;
+}
+
+/* Value for the Host header */
+std::string host_header(const url_parts &u)
+{
+	std::string host = u.host.find(':') != std::string::npos ? "[" + u.host + "]" : u.host;
+	return u.port == (u.https ? "443" : "80") ? host : host + ":" + u.port;
+}
+
+/* Turn the Location header of a redirect into an absolute url */
+std::string resolve_location(const url_parts &base, const std::string &location)
+{
+	std::string scheme = lowercase(location.substr(0, 8));
+	if (scheme.find("http://") == 0 || scheme.find("https://") == 0) {
+		return location;
+	}
+	if (location.find("//") == 0) {
+		return (base.https ? "https:" : "http:") + location;
+	}
+	std::string origin = (base.https ? "https://" : "http://") + host_header(base);
+	if (!location.empty() && location[0] == '/') {
+		return origin + location;
+	}
+	std::string path = base.target.substr(0, base.target.find('?'));
+	return origin + path.substr(0, path.rfind('/') + 1) + location;
+}
+
+/* Same test do-web-requests.php made, a line of the post data which looks like a JSON object */
+bool looks_like_json(const std::string &postdata)
+{
+	size_t start = 0;
+	while (start < postdata.length()) {
+		size_t end = postdata.find('\n', start);
+		std::string line = postdata.substr(start, end == std::string::npos ? std::string::npos : end - start);
+		if (line.length() > 2 && line.front() == '{' && line.back() == '}') {
+			return true;
+		}
+		if (end == std::string::npos) {
+			break;
+		}
+		start = end + 1;
+	}
+	return false;
+}
+
+/* A DNS lookup which outlived its timeout but couldn't be cancelled, freed once it finishes */
+struct lookup {
+	gaicb cb;
+	addrinfo hints;
+	std::string host;
+	std::string port;
+};
+
+std::mutex abandoned_mutex;
+std::vector<lookup*> abandoned;
+
+void free_lookup(lookup* l)
+{
+	if (l->cb.ar_result) {
+		freeaddrinfo(l->cb.ar_result);
+	}
+	delete l;
+}
+
+void reap_abandoned()
+{
+	std::lock_guard<std::mutex> lock(abandoned_mutex);
+	for (auto i = abandoned.begin(); i != abandoned.end();) {
+		if (gai_error(&(*i)->cb) != EAI_INPROGRESS) {
+			free_lookup(*i);
+			i = abandoned.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+int remaining_ms(steady::time_point until)
+{
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(until - steady::now()) + std::chrono::milliseconds(1);
+	return (int)std::max<std::chrono::milliseconds::rep>(0, std::min(left, poll_slice).count());
+}
+
+/* Resolve host, giving up after dns_timeout. getaddrinfo() can't be given a timeout, so the lookup is made with getaddrinfo_a() */
+addrinfo* resolve(const url_parts &u, steady::time_point deadline, const std::atomic<bool> &terminating, std::string &error)
+{
+	reap_abandoned();
+
+	lookup* l = new lookup();
+	l->host = u.host;
+	l->port = u.port;
+	l->hints.ai_family = AF_UNSPEC;
+	l->hints.ai_socktype = SOCK_STREAM;
+	l->cb.ar_name = l->host.c_str();
+	l->cb.ar_service = l->port.c_str();
+	l->cb.ar_request = &l->hints;
+	gaicb* list[1] = { &l->cb };
+	int rv = getaddrinfo_a(GAI_NOWAIT, list, 1, nullptr);
+	if (rv != 0) {
+		error = fmt::format("Can't resolve {}: {}", u.host, gai_strerror(rv));
+		delete l;
+		return nullptr;
+	}
+
+	steady::time_point until = std::min(deadline, steady::now() + dns_timeout);
+	while ((rv = gai_error(&l->cb)) == EAI_INPROGRESS && !terminating && steady::now() < until) {
+		int ms = remaining_ms(until);
+		timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+		gai_suspend(list, 1, &ts);
+	}
+
+	if (rv == EAI_INPROGRESS) {
+		if (gai_cancel(&l->cb) == EAI_NOTCANCELED) {
+			std::lock_guard<std::mutex> lock(abandoned_mutex);
+			abandoned.push_back(l);
+		} else {
+			free_lookup(l);
+		}
+		error = fmt::format("Resolving {} timed out", u.host);
+		return nullptr;
+	}
+	if (rv != 0) {
+		error = fmt::format("Can't resolve {}: {}", u.host, gai_strerror(rv));
+		free_lookup(l);
+		return nullptr;
+	}
+	addrinfo* result = l->cb.ar_result;
+	l->cb.ar_result = nullptr;
+	free_lookup(l);
+	return result;
+}
+
+/* A non-blocking connection, plain or TLS, every operation of which gives up at the deadline */
+class connection {
+	int fd;
+	SSL* ssl;
+	steady::time_point deadline;
+	const std::atomic<bool> &terminating;
+
+	bool wait(short events, steady::time_point until)
+	{
+		while (true) {
+			if (terminating) {
+				error = "Shutting down";
+				return false;
+			}
+			if (steady::now() >= until) {
+				error = "Timed out";
+				return false;
+			}
+			pollfd p = { fd, events, 0 };
+			int r = poll(&p, 1, remaining_ms(until));
+			if (r > 0) {
+				return true;
+			} else if (r < 0 && errno != EINTR) {
+				error = strerror(errno);
+				return false;
+			}
+		}
+	}
+
+	/* Wait for whatever OpenSSL needs before retrying an operation which returned r */
+	bool tls_wait(int r)
+	{
+		int e = SSL_get_error(ssl, r);
+		if (e == SSL_ERROR_WANT_READ) {
+			return wait(POLLIN, deadline);
+		} else if (e == SSL_ERROR_WANT_WRITE) {
+			return wait(POLLOUT, deadline);
+		}
+		long verify = SSL_get_verify_result(ssl);
+		if (verify != X509_V_OK) {
+			error = fmt::format("Certificate verification failed: {}", X509_verify_cert_error_string(verify));
+		} else {
+			char message[256];
+			ERR_error_string_n(ERR_get_error(), message, sizeof(message));
+			error = fmt::format("TLS error: {}", message);
+		}
+		return false;
+	}
+
+public:
+	std::string error;
+
+	connection(steady::time_point _deadline, const std::atomic<bool> &_terminating) : fd(-1), ssl(nullptr), deadline(_deadline), terminating(_terminating)
+	{
+	}
+
+	~connection()
+	{
+		if (ssl) {
+			SSL_free(ssl);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	/* Connect to the first of addresses which answers, giving up after connect_timeout */
+	bool open(const addrinfo* addresses)
+	{
+		steady::time_point until = std::min(deadline, steady::now() + connect_timeout);
+		for (const addrinfo* a = addresses; a; a = a->ai_next) {
+			fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+			if (fd < 0) {
+				error = strerror(errno);
+				continue;
+			}
+			if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+				return true;
+			}
+			if (errno == EINPROGRESS && wait(POLLOUT, until)) {
+				int err = 0;
+				socklen_t len = sizeof(err);
+				getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (err == 0) {
+					return true;
+				}
+				error = strerror(err);
+			} else if (errno != EINPROGRESS) {
+				error = strerror(errno);
+			}
+			close(fd);
+			fd = -1;
+			if (steady::now() >= until || terminating) {
+				break;
+			}
+		}
+		error = "Can't connect: " + error;
+		return false;
+	}
+
+	bool start_tls(const std::string &host)
+	{
+		if (!tls.ctx || !(ssl = SSL_new(tls.ctx))) {
+			error = "Can't create TLS session";
+			return false;
+		}
+		SSL_set_fd(ssl, fd);
+		if (is_ip_address(host)) {
+			X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.c_str());
+		} else {
+			SSL_set_tlsext_host_name(ssl, host.c_str());
+			SSL_set1_host(ssl, host.c_str());
+		}
+		int r;
+		while ((r = SSL_connect(ssl)) != 1) {
+			if (!tls_wait(r)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool write_all(const std::string &data)
+	{
+		size_t done = 0;
+		while (done < data.length()) {
+			if (ssl) {
+				int r = SSL_write(ssl, data.data() + done, data.length() - done);
+				if (r > 0) {
+					done += r;
+				} else if (!tls_wait(r)) {
+					return false;
+				}
+			} else {
+				ssize_t r = send(fd, data.data() + done, data.length() - done, MSG_NOSIGNAL);
+				if (r >= 0) {
+					done += r;
+				} else if (errno == EAGAIN || errno == EINTR) {
+					if (!wait(POLLOUT, deadline)) {
+						return false;
+					}
+				} else {
+					error = strerror(errno);
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/* Append what is available to buffer, returns the number of bytes read, 0 at the end of the stream or -1 on error */
+	ssize_t read_some(std::string &buffer)
+	{
+		char chunk[16384];
+		while (true) {
+			if (ssl) {
+				int r = SSL_read(ssl, chunk, sizeof(chunk));
+				if (r > 0) {
+					buffer.append(chunk, r);
+					return r;
+				}
+				int e = SSL_get_error(ssl, r);
+				if (e == SSL_ERROR_ZERO_RETURN || (e == SSL_ERROR_SYSCALL && ERR_peek_error() == 0)) {
+					return 0;
+				} else if (!tls_wait(r)) {
+					return -1;
+				}
+			} else {
+				ssize_t r = recv(fd, chunk, sizeof(chunk), 0);
+				if (r >= 0) {
+					buffer.append(chunk, r);
+					return r;
+				} else if (errno == EAGAIN || errno == EINTR) {
+					if (!wait(POLLIN, deadline)) {
+						return -1;
+					}
+				} else {
+					error = strerror(errno);
+					return -1;
+				}
+			}
+		}
+	}
+};
+
+/* Decodes a body sent with Transfer-Encoding: chunked as it arrives */
+class chunk_decoder {
+	enum { size_line, data, data_end, finished } state = size_line;
+	size_t remaining = 0;
+public:
+	bool bad = false;
+
+	/* Move whatever can be decoded from the front of raw into body, returns true once the last chunk has arrived */
+	bool feed(std::string &raw, std::string &body)
+	{
+		size_t pos = 0;
+		while (state != finished && !bad) {
+			if (state == size_line) {
+				size_t eol = raw.find("\r\n", pos);
+				if (eol == std::string::npos) {
+					bad = raw.length() - pos > 1024;
+					break;
+				}
+				char* end;
+				remaining = strtoull(raw.c_str() + pos, &end, 16);
+				if (end == raw.c_str() + pos) {
+					bad = true;
+					break;
+				}
+				pos = eol + 2;
+				/* Trailers after the last chunk aren't wanted, so they're never read */
+				state = remaining ? data : finished;
+			} else if (state == data) {
+				size_t take = std::min(remaining, raw.length() - pos);
+				body.append(raw, pos, take);
+				pos += take;
+				remaining -= take;
+				if (remaining) {
+					break;
+				}
+				state = data_end;
+			} else {
+				if (raw.length() - pos < 2) {
+					break;
+				}
+				pos += 2;
+				state = size_line;
+			}
+		}
+		raw.erase(0, pos);
+		return state == finished;
+	}
+};
+
+/* One request and response, with no redirects followed. location is set from the response's Location header */
+WebRequests::response exchange(const std::string &method, const url_parts &u, const std::string &content_type, const std::string &postdata, steady::time_point deadline,
+	const std::atomic<bool> &terminating, std::string &location)
+{
+	WebRequests::response res;
+
+	addrinfo* addresses = resolve(u, deadline, terminating, res.error);
+	if (!addresses) {
+		return res;
+	}
+	connection c(deadline, terminating);
+	bool connected = c.open(addresses);
+	freeaddrinfo(addresses);
+	if (!connected || (u.https && !c.start_tls(u.host))) {
+		res.error = c.error;
+		return res;
+	}
+
+	std::string request = fmt::format("{} {} HTTP/1.1\r\nHost: {}\r\nUser-Agent: Sporks/1.2\r\nContent-Type: {}\r\nConnection: close\r\n", method, u.target, host_header(u), content_type);
+	if (method == "POST") {
+		request += fmt::format("Content-Length: {}\r\n\r\n", postdata.length()) + postdata;
+	} else {
+		request += "\r\n";
+	}
+	if (!c.write_all(request)) {
+		res.error = c.error;
+		return res;
+	}
+
+	/* Headers, skipping any 1xx interim responses */
+	std::string raw;
+	size_t header_end;
+	while (true) {
+		while ((header_end = raw.find("\r\n\r\n")) == std::string::npos) {
+			if (raw.length() > max_headers) {
+				res.error = "Response headers too long";
+				return res;
+			}
+			ssize_t r = c.read_some(raw);
+			if (r <= 0) {
+				res.error = r < 0 ? c.error : "Connection closed before response";
+				return res;
+			}
+		}
+		if (raw.compare(0, 5, "HTTP/") != 0 || raw.find(' ') == std::string::npos) {
+			res.error = "Not an HTTP response";
+			return res;
+		}
+		res.status = atoi(raw.c_str() + raw.find(' ') + 1);
+		if (res.status < 100 || res.status > 599) {
+			res.status = 0;
+			res.error = "Invalid HTTP status";
+			return res;
+		}
+		if (res.status >= 200) {
+			break;
+		}
+		raw.erase(0, header_end + 4);
+	}
+
+	bool chunked = false;
+	bool has_length = false;
+	size_t length = 0;
+	size_t line = raw.find("\r\n") + 2;
+	while (line < header_end) {
+		size_t eol = raw.find("\r\n", line);
+		std::string header = raw.substr(line, eol - line);
+		line = eol + 2;
+		size_t colon = header.find(':');
+		if (colon == std::string::npos) {
+			continue;
+		}
+		std::string name = lowercase(trim(header.substr(0, colon)));
+		std::string value = trim(header.substr(colon + 1));
+		if (name == "transfer-encoding") {
+			chunked = lowercase(value).find("chunked") != std::string::npos;
+		} else if (name == "content-length") {
+			has_length = true;
+			length = strtoull(value.c_str(), nullptr, 10);
+		} else if (name == "location") {
+			location = value;
+		}
+	}
+	raw.erase(0, header_end + 4);
+
+	if (res.status == 204 || res.status == 304) {
+		return res;
+	}
+
+	/* Body, truncated at max_response */
+	chunk_decoder decoder;
+	bool complete = false;
+	while (true) {
+		if (chunked) {
+			complete = decoder.feed(raw, res.body);
+			if (decoder.bad) {
+				res = WebRequests::response();
+				res.error = "Invalid chunked encoding";
+				return res;
+			}
+		} else {
+			res.body += raw;
+			raw.clear();
+			complete = has_length && res.body.length() >= length;
+		}
+		if (complete || res.body.length() >= max_response) {
+			break;
+		}
+		ssize_t r = c.read_some(raw);
+		if (r == 0) {
+			/* The end of the stream only ends the body properly if nothing said how long it was */
+			if (chunked || has_length) {
+				res = WebRequests::response();
+				res.error = "Connection closed before end of response";
+			}
+			return res;
+		} else if (r < 0) {
+			std::string error = c.error;
+			res = WebRequests::response();
+			res.error = error;
+			return res;
+		}
+	}
+	if (res.body.length() > max_response) {
+		res.body.resize(max_response);
+	}
+	if (has_length && !chunked && res.body.length() > length) {
+		res.body.resize(length);
+	}
+	return res;
+}
+
+bool is_redirect(int status)
+{
+	return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+
+};
+
+WebRequests::response WebRequests::Fetch(const std::string &method, const std::string &url, const std::string &postdata, const std::atomic<bool> &terminating)
+{
+	steady::time_point deadline = steady::now() + total_timeout;
+	std::string current_method = method;
+	std::string current_url = url;
+	std::string body = method == "POST" ? postdata.substr(0, max_post) : "";
+	std::string content_type = method == "POST" && looks_like_json(postdata) ? "application/json" : "application/x-www-form-urlencoded";
+
+	for (int redirects = 0;; ++redirects) {
+		url_parts u;
+		if (!parse_url(current_url, u)) {
+			response res;
+			res.error = "Invalid url " + current_url;
+			return res;
+		}
+		std::string location;
+		response res = exchange(current_method, u, content_type, body, deadline, terminating, location);
+		if (res.status == 0 || !is_redirect(res.status) || location.empty()) {
+			return res;
+		}
+		if (redirects == max_redirects) {
+			res = response();
+			res.error = fmt::format("Maximum ({}) redirects followed", max_redirects);
+			return res;
+		}
+		current_url = resolve_location(u, location);
+		if (res.status == 303 || (current_method == "POST" && res.status != 307 && res.status != 308)) {
+			current_method = "GET";
+			body.clear();
+		}
+	}
+}
+
+WebRequests::WebRequests(Bot* _bot, size_t worker_count, deliver_t _deliver) : bot(_bot), deliver(_deliver), terminating(false), completed(0), failed(0)
+{
+	for (size_t i = 0; i < std::max<size_t>(1, worker_count); ++i) {
+		workers.push_back(new std::thread(&WebRequests::Worker, this));
+	}
+}
+
+WebRequests::~WebRequests()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		terminating = true;
+	}
+	cv.notify_all();
+	for (auto w : workers) {
+		bot->DisposeThread(w);
+	}
+}
+
+uint64_t WebRequests::GetCompleted()
+{
+	return completed;
+}
+
+uint64_t WebRequests::GetFailed()
+{
+	return failed;
+}
+
+bool WebRequests::Submit(const request &r)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (terminating || in_flight.find(r.guild_id) != in_flight.end()) {
+		return false;
+	}
+	in_flight.insert(r.guild_id);
+	queue.push_back(r);
+	cv.notify_one();
+	return true;
+}
+
+void WebRequests::Worker()
+{
+	while (true) {
+		request r;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [this]() { return terminating || !queue.empty(); });
+			if (terminating) {
+				break;
+			}
+			r = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		response res = Fetch(r.method, r.url, r.postdata, terminating);
+		if (res.status == 0) {
+			failed++;
+			bot->core->log(dpp::ll_debug, fmt::format("JS web request for url {} on guild={}/channel={} failed: {}", r.url, r.guild_id, r.channel_id, res.error));
+		} else {
+			completed++;
+			bot->core->log(dpp::ll_debug, fmt::format("JS web request response {} received for url {}", res.status, r.url));
+		}
+
+		/* The guild may make another request as soon as its callback is on its way */
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			in_flight.erase(r.guild_id);
+		}
+		if (!terminating) {
+			deliver(r, res);
+		}
+	}
+}
@@ -0,0 +1,99 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+class Bot;
+
+/**
+ * Performs the web requests made by the get() and post() functions of scripts, on a pool of
+ * worker threads inside the bot, and passes each response straight back to be run as the
+ * script's callback.
+ *
+ * Requests are limited in the same way as they were by do-web-requests.php:
+ *
+ * - Only http:// and https:// URLs are fetched.
+ * - DNS resolution may only take 1 second, and the initial connection 2 seconds.
+ * - At most 3 redirections are followed.
+ * - The entire request may only take 5 seconds.
+ * - The POST body may be at most 256k and the response at most 1mb. Anything longer is truncated.
+ * - A guild can only have one request in flight at a time.
+ */
+class WebRequests {
+public:
+	struct request {
+		uint64_t guild_id;
+		uint64_t channel_id;
+		std::string method;
+		std::string url;
+		std::string postdata;
+		std::string callback;
+	};
+
+	struct response {
+		/* HTTP status code, or 0 if the request failed */
+		int status = 0;
+		std::string body;
+		/* Reason for failure, for logging */
+		std::string error;
+	};
+
+	typedef std::function<void(const request&, const response&)> deliver_t;
+
+private:
+	Bot* bot;
+	deliver_t deliver;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<request> queue;
+	std::unordered_set<uint64_t> in_flight;
+	std::atomic<bool> terminating;
+	std::vector<std::thread*> workers;
+
+	std::atomic<uint64_t> completed;
+	std::atomic<uint64_t> failed;
+
+	void Worker();
+
+public:
+	/* Start worker_count threads, handing every response to deliver on the worker which fetched it */
+	WebRequests(Bot* bot, size_t worker_count, deliver_t deliver);
+	~WebRequests();
+
+	/* Queue a request, returns false if the guild already has one which hasn't been answered */
+	bool Submit(const request &r);
+
+	uint64_t GetCompleted();
+	uint64_t GetFailed();
+
+	/* Perform one request on the calling thread, following redirects. Gives up early if terminating becomes true */
+	static response Fetch(const std::string &method, const std::string &url, const std::string &postdata, const std::atomic<bool> &terminating);
+};
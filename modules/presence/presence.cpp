@@ -47,7 +47,7 @@ public:
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 8$";
+		std::string version = "$ModVer 11$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -81,14 +81,19 @@ public:
 		}
 		int64_t ram = GetRSS();
 
-		db::resultset rs_fact = db::query("show table status like '?'", {std::string("infobot")});
-		bot->core->set_presence(dpp::presence(dpp::ps_online, dpp::at_custom, Comma(from_string<size_t>(rs_fact[0]["Rows"], std::dec)) + " facts, on " + Comma(servers) + " servers with " + Comma(users) + " users across " + Comma(bot->core->get_shards().size()) + " shards"));
+		/* Maintained by the infobot module, fall back to the table statistics if it isn't loaded */
+		uint64_t facts = 0;
+		if (!bot->GetCounter("facts", facts)) {
+			db::resultset rs_fact = db::query("show table status like '?'", {std::string("infobot")});
+			facts = rs_fact.size() ? from_string<uint64_t>(rs_fact[0]["Rows"], std::dec) : 0;
+		}
+		bot->core->set_presence(dpp::presence(dpp::ps_online, dpp::at_custom, Comma(facts) + " facts, on " + Comma(servers) + " servers with " + Comma(users) + " users across " + Comma(bot->core->get_shards().size()) + " shards"));
 		db::query("INSERT INTO infobot_discord_counts (shard_id, dev, user_count, server_count, shard_count, channel_count, sent_messages, received_messages, memory_usage) VALUES('?','?','?','?','?','?','?','?','?') ON DUPLICATE KEY UPDATE user_count = '?', server_count = '?', shard_count = '?', channel_count = '?', sent_messages = '?', received_messages = '?', memory_usage = '?'",
 			{
 				0, bot->IsDevMode(), users, servers, bot->core->get_shards().size(),
-				channel_count, bot->sent_messages, bot->received_messages, ram,
+				channel_count, bot->sent_messages.load(), bot->received_messages.load(), ram,
 				users, servers, bot->core->get_shards().size(),
-				channel_count, bot->sent_messages, bot->received_messages, ram
+				channel_count, bot->sent_messages.load(), bot->received_messages.load(), ram
 			}
 		);
 		if (++halfminutes > 20) {
@@ -60,7 +60,7 @@ public:
 					std::lock_guard<std::mutex> user_cache_lock(user_cache_mutex);
 					u = userqueue.front();
 					userqueue.pop();
-					bot->counters["userqueue"] = userqueue.size();
+					bot->SetCounter("userqueue", userqueue.size());
 				};
 				std::string bot = u.is_bot() ? "1" : "0";
 				db::query("INSERT INTO infobot_discord_user_cache (id, username, discriminator, avatar, bot) VALUES(?, '?', '?', '?', ?) ON DUPLICATE KEY UPDATE username = '?', discriminator = '?', avatar = '?'", {u.id, u.username, u.discriminator, u.avatar.to_string(), bot, u.username, u.discriminator, u.avatar.to_string()});
@@ -86,7 +86,7 @@ public:
 					std::lock_guard<std::mutex> user_cache_lock(guild_cache_mutex);
 					gc = guildqueue.front();
 					guildqueue.pop();
-					bot->counters["guildqueue"] = guildqueue.size();
+					bot->SetCounter("guildqueue", guildqueue.size());
 				};
 				for (auto i = gc.channels.begin(); i != gc.channels.end(); ++i) {
 					getSettings(bot, *i, gc.id);
@@ -97,7 +97,7 @@ public:
 						continue;
 					std::lock_guard<std::mutex> user_cache_lock(user_cache_mutex);
 					userqueue.push(*u);
-					bot->counters["userqueue"] = userqueue.size();
+					bot->SetCounter("userqueue", userqueue.size());
 					std::string roles_str;
 					for (auto n = i->second.roles.begin(); n != i->second.roles.end(); ++n) {
 						roles_str.append(std::to_string(*n)).append(",");
@@ -126,7 +126,7 @@ public:
 	SQLCacheModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml), thr_userqueue(nullptr), thr_guildqueue(nullptr), terminate(false)
 	{
 		ml->Attach({ I_OnGuildCreate, I_OnPresenceUpdate, I_OnGuildMemberAdd, I_OnChannelCreate, I_OnChannelDelete, I_OnGuildDelete, I_OnGuildMemberRemove }, this);
-		bot->counters["userqueue"] = 0;
+		bot->SetCounter("userqueue", 0);
 		thr_userqueue = new std::thread(&SQLCacheModule::SaveCachedUsersThread, this);
 		thr_guildqueue = new std::thread(&SQLCacheModule::SaveCachedGuildsThread, this);
 	}
@@ -136,14 +136,14 @@ public:
 		terminate = true;
 		bot->DisposeThread(thr_userqueue);
 		bot->DisposeThread(thr_guildqueue);
-		bot->counters["userqueue"] = 0;
-		bot->counters["guildqueue"] = 0;
+		bot->SetCounter("userqueue", 0);
+		bot->SetCounter("guildqueue", 0);
 	}
 
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 13$";
+		std::string version = "$ModVer 14$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -173,7 +173,7 @@ public:
 		{
 			std::lock_guard<std::mutex> guild_cache_lock(guild_cache_mutex);
 			guildqueue.push(*(gc.created));
-			bot->counters["guildqueue"] = guildqueue.size();
+			bot->SetCounter("guildqueue", guildqueue.size());
 		}
 
 		return true;
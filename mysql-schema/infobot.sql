@@ -37,7 +37,14 @@ CREATE TABLE `infobot_discord_javascript` (
   `script` longtext CHARACTER SET utf8mb4 DEFAULT NULL COMMENT 'Actual javascript content',
   `last_error` text CHARACTER SET utf8mb4 DEFAULT NULL COMMENT 'Last error message or empty/null',
   `last_memory_max` int(11) NOT NULL DEFAULT 0 COMMENT 'Last memory usage of script executed',
-  `dirty` tinyint(1) UNSIGNED NOT NULL DEFAULT 0 COMMENT 'Set to 1 if the bot is to reload this script'
+  `runs` bigint(20) UNSIGNED NOT NULL DEFAULT 0 COMMENT 'Number of times the script has run',
+  `errors` bigint(20) UNSIGNED NOT NULL DEFAULT 0 COMMENT 'Number of runs and compiles which failed',
+  `exec_ms_min` float NOT NULL DEFAULT 0 COMMENT 'Shortest execution time of recent runs',
+  `exec_ms_max` float NOT NULL DEFAULT 0 COMMENT 'Longest execution time of recent runs',
+  `exec_ms_p50` float NOT NULL DEFAULT 0 COMMENT 'Median execution time of recent runs',
+  `exec_ms_p95` float NOT NULL DEFAULT 0 COMMENT '95th percentile execution time of recent runs',
+  `dirty` tinyint(1) UNSIGNED NOT NULL DEFAULT 0 COMMENT 'Set to 1 if the bot is to reload this script',
+  `triggers` text CHARACTER SET utf8mb4 DEFAULT NULL COMMENT 'JSON filter of the messages the script runs for, empty for all'
 ) ENGINE=InnoDB DEFAULT CHARSET=latin1 COMMENT='Information on which channels are using javascript replies';
 
 CREATE TABLE `infobot_discord_list_sites` (
@@ -137,17 +144,6 @@ CREATE TABLE `infobot_vote_links` (
   `sortorder` float NOT NULL
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COMMENT='Voting URLs for the sites which have webhooks';
 
-CREATE TABLE `infobot_web_requests` (
-  `channel_id` bigint(20) UNSIGNED NOT NULL,
-  `guild_id` bigint(20) UNSIGNED NOT NULL,
-  `url` varchar(500) NOT NULL,
-  `type` varchar(20) NOT NULL DEFAULT 'GET',
-  `postdata` text DEFAULT NULL,
-  `callback` varchar(500) NOT NULL,
-  `returndata` longtext DEFAULT NULL,
-  `statuscode` char(3) NOT NULL DEFAULT '000'
-) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COMMENT='List of queued web requests';
-
 CREATE VIEW `vw_guild_members`  AS  select `infobot_discord_user_cache`.`id` AS `id`,`infobot_discord_user_cache`.`username` AS `username`,`infobot_discord_user_cache`.`discriminator` AS `discriminator`,`infobot_discord_user_cache`.`avatar` AS `avatar`,`infobot_discord_user_cache`.`bot` AS `bot`,`infobot_discord_user_cache`.`modified` AS `modified`,`infobot_shard_map`.`guild_id` AS `guild_id`,`infobot_shard_map`.`shard_id` AS `shard_id`,`infobot_shard_map`.`name` AS `name`,`infobot_shard_map`.`icon` AS `icon`,`infobot_shard_map`.`unavailable` AS `unavailable`,`infobot_shard_map`.`owner_id` AS `owner_id`,`infobot_membership`.`nick` AS `nick`,`infobot_membership`.`dashboard` AS `dashboard`,`infobot_membership`.`roles` AS `roles` from ((`infobot_membership` join `infobot_discord_user_cache` on(`infobot_discord_user_cache`.`id` = `infobot_membership`.`member_id`)) join `infobot_shard_map` on(`infobot_shard_map`.`guild_id` = `infobot_membership`.`guild_id`)) ;
 DROP TABLE IF EXISTS `vw_infobot_active_voters`;
 
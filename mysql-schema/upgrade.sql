@@ -0,0 +1,15 @@
+-- Upgrades for databases created from an older infobot.sql.
+-- Each statement is safe to run again on a database which already has the change.
+
+-- Message filters for channel scripts
+ALTER TABLE `infobot_discord_javascript`
+  ADD COLUMN IF NOT EXISTS `triggers` text CHARACTER SET utf8mb4 DEFAULT NULL COMMENT 'JSON filter of the messages the script runs for, empty for all';
+
+-- Channel script run totals and execution times
+ALTER TABLE `infobot_discord_javascript`
+  ADD COLUMN IF NOT EXISTS `runs` bigint(20) UNSIGNED NOT NULL DEFAULT 0 COMMENT 'Number of times the script has run',
+  ADD COLUMN IF NOT EXISTS `errors` bigint(20) UNSIGNED NOT NULL DEFAULT 0 COMMENT 'Number of runs and compiles which failed',
+  ADD COLUMN IF NOT EXISTS `exec_ms_min` float NOT NULL DEFAULT 0 COMMENT 'Shortest execution time of recent runs',
+  ADD COLUMN IF NOT EXISTS `exec_ms_max` float NOT NULL DEFAULT 0 COMMENT 'Longest execution time of recent runs',
+  ADD COLUMN IF NOT EXISTS `exec_ms_p50` float NOT NULL DEFAULT 0 COMMENT 'Median execution time of recent runs',
+  ADD COLUMN IF NOT EXISTS `exec_ms_p95` float NOT NULL DEFAULT 0 COMMENT '95th percentile execution time of recent runs';
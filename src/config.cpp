@@ -24,6 +24,7 @@
 #include <sporks/database.h>
 #include <sporks/stringops.h>
 #include <string>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <unordered_map>
@@ -36,9 +37,18 @@ using json = nlohmann::json;
 
 namespace settings {
 
+/* Column names can't be passed as query parameters, so only plain identifiers are let into the SQL */
+static bool validJSColumn(const std::string &variable)
+{
+	return !variable.empty() && std::all_of(variable.begin(), variable.end(), [](unsigned char c) { return isalnum(c) || c == '_'; });
+}
+
 /* Get one configuration variable for a channel by ID */
 std::string getJSConfig(int64_t channel_id, std::string variable)
 {
+	if (!validJSColumn(variable)) {
+		return "";
+	}
 	db::resultset r = db::query("SELECT `" + variable + "` FROM infobot_discord_javascript WHERE id = ?", {channel_id});
 	if (r.size() == 0) {
 		return "";
@@ -50,7 +60,10 @@ std::string getJSConfig(int64_t channel_id, std::string variable)
 /* Set one configuration variable for a channel by ID */
 void setJSConfig(int64_t channel_id, std::string variable, std::string value)
 {
-	db::resultset r = db::query("UPDATE infobot_discord_javascript SET `" + variable + "` = '?' WHERE id = ?", {value, channel_id});
+	if (!validJSColumn(variable)) {
+		return;
+	}
+	db::query("UPDATE infobot_discord_javascript SET `" + variable + "` = '?' WHERE id = ?", {value, channel_id});
 }
 
 };
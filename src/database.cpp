@@ -34,7 +34,9 @@ namespace db {
 
 	MYSQL connection;
 	std::mutex db_mutex;
-	std::string _error;
+	/* Per thread, so that error() reports on the caller's own last query */
+	thread_local std::string _error;
+	thread_local uint64_t _affected_rows = 0;
 
 	/**
 	 * Connect to mysql database, returns false if there was an error.
@@ -70,6 +72,10 @@ namespace db {
 		return _error;
 	}
 
+	uint64_t affected_rows() {
+		return _affected_rows;
+	}
+
 	/**
 	 * Run a mysql query, with automatic escaping of parameters to prevent SQL injection.
 	 * The parameters given should be a vector of strings. You can instantiate this using "{}".
@@ -84,6 +90,9 @@ namespace db {
 		 */
 		std::lock_guard<std::mutex> db_lock(db_mutex);
 
+		_error.clear();
+		_affected_rows = 0;
+
 		std::vector<std::string> escaped_parameters;
 
 		resultset rv;
@@ -93,7 +102,7 @@ namespace db {
 		 */
 		for (const auto& param : parameters) {
 			/* Worst case scenario: Every character becomes two, plus NULL terminator*/
-			std::visit([parameters, &escaped_parameters](const auto &p) {
+			std::visit([&escaped_parameters](const auto &p) {
 				std::ostringstream v;
 				v << p;
 				std::string s_param(v.str());
@@ -159,6 +168,10 @@ namespace db {
 					}
 				}
 				mysql_free_result(a_res);
+			} else {
+				/* Statements without a result set. mysql_affected_rows() returns -1 cast to unsigned on error */
+				uint64_t affected = mysql_affected_rows(&connection);
+				_affected_rows = (affected == (uint64_t)-1) ? 0 : affected;
 			}
 		} else {
 			/**
@@ -0,0 +1,138 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <sporks/embeds.h>
+#include <sporks/bot.h>
+#include <sporks/outbound.h>
+
+namespace {
+
+	/* Discord's limits on embed text, in bytes here so that they are never exceeded */
+	constexpr size_t max_title = 256;
+	constexpr size_t max_description = 4096;
+	constexpr size_t max_field_name = 256;
+	constexpr size_t max_field_value = 1024;
+	constexpr size_t max_footer = 2048;
+	constexpr size_t max_fields = 25;
+
+	/* Cut a string to at most max bytes without splitting a UTF-8 sequence */
+	std::string limit(const std::string &s, size_t max)
+	{
+		if (s.length() <= max) {
+			return s;
+		}
+		size_t end = max;
+		while (end > 0 && (static_cast<unsigned char>(s[end]) & 0xC0) == 0x80) {
+			--end;
+		}
+		return s.substr(0, end);
+	}
+
+	/* Discord rejects empty field names and values */
+	std::string not_empty(const std::string &s)
+	{
+		return s.empty() ? "\xe2\x80\x8b" : s;
+	}
+};
+
+EmbedBuilder::EmbedBuilder()
+{
+	embed.set_color(SPORKS_COLOUR);
+}
+
+EmbedBuilder& EmbedBuilder::Title(const std::string &title)
+{
+	embed.set_title(limit(title, max_title));
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Description(const std::string &description)
+{
+	embed.set_description(limit(description, max_description));
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Colour(uint32_t colour)
+{
+	embed.set_color(colour);
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Url(const std::string &url)
+{
+	embed.set_url(url);
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Image(const std::string &url)
+{
+	embed.set_image(url);
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Thumbnail(const std::string &url)
+{
+	embed.set_thumbnail(url);
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Author(const std::string &name, const std::string &url, const std::string &icon_url)
+{
+	embed.set_author(limit(name, max_title), url, icon_url);
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Timestamp(time_t when)
+{
+	embed.timestamp = when;
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Footer(const std::string &text, const std::string &icon_url)
+{
+	embed.set_footer(limit(text, max_footer), icon_url);
+	return *this;
+}
+
+EmbedBuilder& EmbedBuilder::Field(const std::string &name, const std::string &value, bool is_inline)
+{
+	if (embed.fields.size() < max_fields) {
+		embed.add_field(not_empty(limit(name, max_field_name)), not_empty(limit(value, max_field_value)), is_inline);
+	}
+	return *this;
+}
+
+const dpp::embed& EmbedBuilder::Get() const
+{
+	return embed;
+}
+
+bool EmbedBuilder::Send(Bot* bot, int64_t channelID) const
+{
+	dpp::channel* channel = dpp::find_channel(channelID);
+	if (!channel) {
+		return false;
+	}
+	dpp::message m;
+	m.channel_id = channel->id;
+	m.embeds.push_back(embed);
+	bot->outbound->Send(m, channel->guild_id);
+	return true;
+}
@@ -179,3 +179,8 @@ void Bot::onWebhooksUpdate (const dpp::webhooks_update_t &obj)
 	FOREACH_MOD(I_OnWebhooksUpdate, OnWebhooksUpdate(obj));
 }
 
+
+void Bot::onFactLock (const std::string &key, bool locked)
+{
+	FOREACH_MOD(I_OnFactLock, OnFactLock(key, locked));
+}
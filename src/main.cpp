@@ -41,6 +41,7 @@
 #include <sporks/config.h>
 #include <sporks/stringops.h>
 #include <sporks/modules.h>
+#include <sporks/outbound.h>
 
 using json = nlohmann::json;
 
@@ -52,11 +53,13 @@ json configdocument;
 /**
  * Constructor (creates threads, loads all modules)
  */
-Bot::Bot(bool development, bool testing, bool intents, dpp::cluster* dppcluster) : dev(development), test(testing), memberintents(intents), thr_presence(nullptr), terminate(false), shard_init_count(0), core(dppcluster), sent_messages(0), received_messages(0) {
+Bot::Bot(bool development, bool testing, bool intents, dpp::cluster* dppcluster) : dev(development), test(testing), memberintents(intents), thr_presence(nullptr), thr_signals(nullptr), terminate(false), shard_init_count(0), core(dppcluster), sent_messages(0), received_messages(0) {
+	outbound = new Outbound(this);
 	Loader = new ModuleLoader(this);
 	Loader->LoadAll();
 
 	thr_presence = new std::thread(&Bot::UpdatePresenceThread, this);
+	thr_signals = new std::thread(&Bot::SignalThread, this);
 }
 
 /**
@@ -77,8 +80,10 @@ Bot::~Bot() {
 	terminate = true;
 
 	DisposeThread(thr_presence);
+	DisposeThread(thr_signals);
 
 	delete Loader;
+	delete outbound;
 }
 
 /**
@@ -88,6 +93,11 @@ std::string Bot::GetConfig(const std::string &name) {
 	return configdocument[name].get<std::string>();
 }
 
+std::string Bot::GetConfig(const std::string &name, const std::string &default_value) {
+	auto i = configdocument.find(name);
+	return (i != configdocument.end() && i->is_string()) ? i->get<std::string>() : default_value;
+}
+
 /**
  * Returns true if the bot is running in development mode (different token)
  */
@@ -138,6 +148,28 @@ void Bot::onMember(const dpp::guild_member_add_t& gma) {
 	FOREACH_MOD(I_OnGuildMemberAdd, OnGuildMemberAdd(gma));
 }
 
+/**
+ * Sets a named counter. Counters are shared between modules and threads, so the map
+ * is only ever touched under its mutex.
+ */
+void Bot::SetCounter(const std::string &name, uint64_t value) {
+	std::lock_guard<std::mutex> counters_lock(counters_mutex);
+	counters[name] = value;
+}
+
+/**
+ * Gets a named counter, returns false and leaves value alone if it has never been set
+ */
+bool Bot::GetCounter(const std::string &name, uint64_t &value) {
+	std::lock_guard<std::mutex> counters_lock(counters_mutex);
+	auto c = counters.find(name);
+	if (c == counters.end()) {
+		return false;
+	}
+	value = c->second;
+	return true;
+}
+
 /**
  * Returns the bot's snowflake id
  */
@@ -234,6 +266,9 @@ int main(int argc, char** argv) {
 	int test = 0;
 	int members = 0;
 
+	/* Before any threads exist, so that they all inherit the signal mask */
+	Bot::SetSignals();
+
 	/* Set this specifically so that stringstreams don't do weird things on other locales printing decimal numbers for SQL */
 	std::setlocale(LC_ALL, "en_GB.UTF-8");
 
@@ -29,6 +29,7 @@
 #include <dlfcn.h>
 #include <sstream>
 #include <sporks/stringops.h>
+#include <sporks/embeds.h>
 
 using json = nlohmann::json;
 
@@ -73,6 +74,7 @@ const char* StringNames[I_END + 1] = {
 	"I_OnVoiceStateUpdate",
 	"I_OnVoiceServerUpdate",
 	"I_OnWebhooksUpdate",
+	"I_OnFactLock",
 	"I_END"
 };
 
@@ -209,7 +211,8 @@ bool ModuleLoader::Unload(const std::string &filename)
 		return false;
 	}
 
-	ModuleNative& mod = m->second;
+	/* A copy, as the entry is erased below */
+	ModuleNative mod = m->second;
 
 	/* Remove attached events */
 	for (int j = I_BEGIN; j != I_END; ++j) {
@@ -244,6 +247,24 @@ bool ModuleLoader::Unload(const std::string &filename)
 	return true;
 }
 
+/**
+ * Unload every loaded module, so that each one can write out anything it holds in memory.
+ * Used when the bot is shutting down.
+ */
+void ModuleLoader::UnloadAll()
+{
+	std::vector<std::string> names;
+	{
+		std::lock_guard l(mtx);
+		for (auto & m : Modules) {
+			names.push_back(m.first);
+		}
+	}
+	for (auto & name : names) {
+		Unload(name);
+	}
+}
+
 /**
  * Unload, then reload a loaded module. Returns true on success or false on failure.
  * Failure to unload causes load to be skipped, so you can't use this function to load
@@ -506,6 +527,11 @@ bool Module::OnWebhooksUpdate(const dpp::webhooks_update_t &obj)
 	return true;
 }
 
+bool Module::OnFactLock(const std::string &key, bool locked)
+{
+	return true;
+}
+
 bool Module::OnAllShardsReady()
 {
 	return true;
@@ -517,26 +543,7 @@ bool Module::OnAllShardsReady()
  */
 void Module::EmbedSimple(const std::string &message, int64_t channelID)
 {
-	std::stringstream s;
-	json embed_json;
-
-	s << "{\"color\":16767488, \"description\": \"" << message << "\"}";
-
-	try {
-		embed_json = json::parse(s.str());
-	}
-	catch (const std::exception &e) {
-		bot->core->log(dpp::ll_error, fmt::format("Invalid json for channel {} created by EmbedSimple: ", channelID, s.str()));
-	}
-	dpp::channel* channel = dpp::find_channel(channelID);
-	if (channel) {
-		if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == channel->guild_id) {
-			dpp::message m;
-			m.channel_id = channel->id;
-			m.embeds.push_back(dpp::embed(&embed_json));
-			bot->core->message_create(m);
-		}
-	} else {
+	if (!EmbedBuilder().Description(message).Send(bot, channelID)) {
 		bot->core->log(dpp::ll_error, fmt::format("Invalid channel {} passed to EmbedSimple", channelID));
 	}
 }
@@ -0,0 +1,171 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <fmt/format.h>
+#include <sporks/bot.h>
+#include <sporks/outbound.h>
+#include <sporks/stringops.h>
+#include <algorithm>
+#include <vector>
+
+/* Discord allows 5 messages per 5 seconds in a channel. Allow a burst of 5 then one a second */
+static constexpr double channel_burst = 5.0;
+static constexpr double channel_rate = 1.0;
+
+/* Most messages a channel may have waiting, about 20 seconds behind at the paced rate */
+static constexpr size_t channel_queue_limit = 20;
+
+/* Longest message Discord will accept, coalesced messages are kept under it */
+static constexpr size_t max_message_length = 2000;
+
+Outbound::Outbound(Bot* instigator) : bot(instigator), test_mode(instigator->IsTestMode()), test_server(0), queued(0), terminating(false), sender(nullptr)
+{
+	if (test_mode) {
+		test_server = from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec);
+	}
+	sender = new std::thread(&Outbound::SenderThread, this);
+}
+
+Outbound::~Outbound()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		terminating = true;
+		cv.notify_all();
+	}
+	bot->DisposeThread(sender);
+}
+
+bool Outbound::Allowed(uint64_t guild_id) const
+{
+	return !test_mode || guild_id == test_server;
+}
+
+void Outbound::Queue(pending &&p, uint64_t channel_id)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto c = channels.find(channel_id);
+	if (c == channels.end()) {
+		c = channels.emplace(channel_id, channel_state()).first;
+		c->second.tokens = channel_burst;
+		c->second.refilled = std::chrono::steady_clock::now();
+	}
+	std::deque<pending> &queue = c->second.queue;
+	if (queue.size() >= channel_queue_limit) {
+		/* Full, so drop the oldest plain text reply. Failing that drop this message if it is one,
+		 * otherwise the oldest message nobody is waiting on a callback for.
+		 */
+		auto drop = std::find_if(queue.begin(), queue.end(), [](const pending &q) { return q.coalesce; });
+		if (drop == queue.end() && p.coalesce) {
+			bot->core->log(dpp::ll_debug, fmt::format("Outbound queue for channel {} is full, dropped a message", channel_id));
+			return;
+		}
+		if (drop == queue.end()) {
+			drop = std::find_if(queue.begin(), queue.end(), [](const pending &q) { return !q.callback; });
+		}
+		if (drop != queue.end()) {
+			bot->core->log(dpp::ll_debug, fmt::format("Outbound queue for channel {} is full, dropped a message", channel_id));
+			queue.erase(drop);
+			queued--;
+		}
+	}
+	queue.push_back(std::move(p));
+	queued++;
+	cv.notify_one();
+}
+
+bool Outbound::Send(const dpp::message &msg, uint64_t guild_id, bool coalesce)
+{
+	if (!Allowed(guild_id)) {
+		return false;
+	}
+	/* Only plain text can be joined */
+	coalesce = coalesce && msg.embeds.empty();
+	Queue({msg, coalesce, {}}, msg.channel_id);
+	return true;
+}
+
+bool Outbound::Send(const dpp::message &msg, uint64_t guild_id, dpp::command_completion_event_t callback)
+{
+	if (!Allowed(guild_id)) {
+		return false;
+	}
+	Queue({msg, false, callback}, msg.channel_id);
+	return true;
+}
+
+size_t Outbound::GetQueued()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return queued;
+}
+
+Outbound::pending Outbound::Take(channel_state &c)
+{
+	pending p = std::move(c.queue.front());
+	c.queue.pop_front();
+	queued--;
+	while (p.coalesce && !c.queue.empty() && c.queue.front().coalesce && p.msg.content.length() + 1 + c.queue.front().msg.content.length() <= max_message_length) {
+		p.msg.content += "\n" + c.queue.front().msg.content;
+		c.queue.pop_front();
+		queued--;
+	}
+	return p;
+}
+
+void Outbound::SenderThread()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	while (!terminating) {
+		auto now = std::chrono::steady_clock::now();
+		auto wake = now + std::chrono::seconds(1);
+		std::vector<pending> ready;
+		for (auto c = channels.begin(); c != channels.end();) {
+			channel_state &s = c->second;
+			double elapsed = std::chrono::duration<double>(now - s.refilled).count();
+			s.tokens = std::min(channel_burst, s.tokens + elapsed * channel_rate);
+			s.refilled = now;
+			while (!s.queue.empty() && s.tokens >= 1.0) {
+				ready.push_back(Take(s));
+				s.tokens -= 1.0;
+			}
+			if (s.queue.empty() && s.tokens >= channel_burst) {
+				/* Idle and fully refilled, nothing to remember */
+				c = channels.erase(c);
+				continue;
+			}
+			if (!s.queue.empty()) {
+				auto refill = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((1.0 - s.tokens) / channel_rate));
+				wake = std::min(wake, now + refill);
+			}
+			++c;
+		}
+		if (!ready.empty()) {
+			lock.unlock();
+			for (auto & p : ready) {
+				bot->core->message_create(p.msg, p.callback);
+				bot->sent_messages++;
+			}
+			lock.lock();
+			continue;
+		}
+		cv.wait_until(lock, wake);
+	}
+}
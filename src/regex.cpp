@@ -35,18 +35,32 @@ regex_exception::regex_exception(const std::string &_message) : std::exception()
  * indicate if the expression should be treated as case sensitive (defaults to false).
  * Construction compiles the regex, which for a well formed regex may be more expensive than matching against a string.
  */
-PCRE::PCRE(const std::string &match, bool case_insensitive) {
+PCRE::PCRE(const std::string &match, bool case_insensitive) : extra(nullptr) {
 	compiled_regex = pcre_compile(match.c_str(), case_insensitive ? PCRE_CASELESS | PCRE_MULTILINE : PCRE_MULTILINE, &pcre_error, &pcre_error_ofs, NULL);
 	if (!compiled_regex) {
 		throw new regex_exception(pcre_error);
 	}
 }
 
+/**
+ * Set the most times pcre_exec() may call match() internally, and how deeply it may recurse,
+ * for one match. A match which goes over either limit fails, as if the string did not match,
+ * so a badly written expression can't hold a thread with catastrophic backtracking.
+ */
+void PCRE::SetMatchLimit(unsigned long match_limit, unsigned long recursion_limit) {
+	if (!extra) {
+		extra = new pcre_extra();
+	}
+	extra->flags = PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+	extra->match_limit = match_limit;
+	extra->match_limit_recursion = recursion_limit;
+}
+
 /**
  * Match regular expression against a string, returns true on match, false if no match.
  */
 bool PCRE::Match(const std::string &comparison) {
-	return (pcre_exec(compiled_regex, NULL, comparison.c_str(), comparison.length(), 0, 0, NULL, 0) > -1);
+	return (pcre_exec(compiled_regex, extra, comparison.c_str(), comparison.length(), 0, 0, NULL, 0) > -1);
 }
 
 /**
@@ -58,7 +72,7 @@ bool PCRE::Match(const std::string &comparison, std::vector<std::string>& matche
 	/* Match twice: first to find out how many matches there are, and again to capture them all */
 	matches.clear();
 	int matcharr[90];
-	int matchcount = pcre_exec(compiled_regex, NULL, comparison.c_str(), comparison.length(), 0, 0, matcharr, 90);
+	int matchcount = pcre_exec(compiled_regex, extra, comparison.c_str(), comparison.length(), 0, 0, matcharr, 90);
 	if (matchcount == 0) {
 		throw new regex_exception("Not enough room in matcharr");
 	}
@@ -76,5 +90,6 @@ PCRE::~PCRE()
 {
 	/* Ugh, C libraries */
 	free(compiled_regex);
+	delete extra;
 }
 
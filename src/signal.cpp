@@ -19,13 +19,19 @@
  ************************************************************************************/
 
 #include <signal.h>
+#include <unistd.h>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
 #include <sporks/bot.h>
+#include <sporks/modules.h>
 
 bool reload = false;
 
 /**
  * Set up signals to ignore some common non-fatals.
  * We'll use SIGHUP for commandline rehash.
+ * SIGTERM and SIGINT are blocked, and taken by SignalThread() instead, which can safely
+ * do far more than a signal handler can.
  */
 void Bot::SetSignals()
 {
@@ -34,6 +40,37 @@ void Bot::SetSignals()
 	signal(SIGPIPE, SIG_IGN);
 	signal(SIGCHLD, SIG_IGN);
 	signal(SIGXFSZ, SIG_IGN);
+
+	sigset_t shutdown_signals;
+	sigemptyset(&shutdown_signals);
+	sigaddset(&shutdown_signals, SIGTERM);
+	sigaddset(&shutdown_signals, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &shutdown_signals, nullptr);
+}
+
+/**
+ * Wait for SIGTERM or SIGINT, then unload every module before exiting. Modules keep some
+ * changes in memory for a while (queued key/value writes and script statistics, for example),
+ * and unloading is what writes them out, so a restart doesn't lose them.
+ */
+void Bot::SignalThread()
+{
+	sigset_t shutdown_signals;
+	sigemptyset(&shutdown_signals);
+	sigaddset(&shutdown_signals, SIGTERM);
+	sigaddset(&shutdown_signals, SIGINT);
+	struct timespec wait = { 1, 0 };
+	while (!this->terminate) {
+		int sig = sigtimedwait(&shutdown_signals, nullptr, &wait);
+		if (sig == SIGTERM || sig == SIGINT) {
+			core->log(dpp::ll_info, fmt::format("Caught signal {}, unloading modules and shutting down", sig));
+			Loader->UnloadAll();
+			core->log(dpp::ll_info, "Modules unloaded, exiting");
+			spdlog::shutdown();
+			/* Other threads are still running, so don't run static destructors under them */
+			_exit(0);
+		}
+	}
 }
 
 /**
@@ -0,0 +1,508 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <sporks/stringkernels.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define SPORKS_HAVE_SSE2 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	#include <immintrin.h>
+	#define SPORKS_HAVE_AVX2 1
+	#define SPORKS_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+	/* Plain C++ versions. These are also used for the tail end of each SIMD loop. */
+
+	inline char lower_ascii(char c) {
+		return (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;
+	}
+
+	inline char upper_ascii(char c) {
+		return (c >= 'a' && c <= 'z') ? (char)(c & ~0x20) : c;
+	}
+
+	inline bool is_space(char c) {
+		return c == ' ' || (unsigned char)(c - '\t') < 5;
+	}
+
+	/* Compare n bytes ignoring case, callers have already checked lengths */
+	inline bool iequals_n(const char* a, const char* b, size_t n) {
+		for (size_t i = 0; i < n; ++i) {
+			if (lower_ascii(a[i]) != lower_ascii(b[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void scalar_to_lower(char* dst, const char* src, size_t len) {
+		for (size_t i = 0; i < len; ++i) {
+			dst[i] = lower_ascii(src[i]);
+		}
+	}
+
+	void scalar_to_upper(char* dst, const char* src, size_t len) {
+		for (size_t i = 0; i < len; ++i) {
+			dst[i] = upper_ascii(src[i]);
+		}
+	}
+
+	size_t scalar_ifind_from(const char* h, size_t hlen, const char* n, size_t nlen, size_t start) {
+		if (nlen == 0) {
+			return start <= hlen ? start : stringkernels::npos;
+		}
+		if (nlen > hlen) {
+			return stringkernels::npos;
+		}
+		const char first = lower_ascii(n[0]);
+		for (size_t i = start; i + nlen <= hlen; ++i) {
+			if (lower_ascii(h[i]) == first && iequals_n(h + i + 1, n + 1, nlen - 1)) {
+				return i;
+			}
+		}
+		return stringkernels::npos;
+	}
+
+	size_t scalar_ifind(const char* h, size_t hlen, const char* n, size_t nlen) {
+		return scalar_ifind_from(h, hlen, n, nlen, 0);
+	}
+
+	bool scalar_iequals(const char* a, size_t alen, const char* b, size_t blen) {
+		return alen == blen && iequals_n(a, b, alen);
+	}
+
+	size_t scalar_first_not_space_from(const char* s, size_t len, size_t start) {
+		for (size_t i = start; i < len; ++i) {
+			if (!is_space(s[i])) {
+				return i;
+			}
+		}
+		return stringkernels::npos;
+	}
+
+	size_t scalar_first_not_space(const char* s, size_t len) {
+		return scalar_first_not_space_from(s, len, 0);
+	}
+
+	/* Searches backwards from s[end - 1] down to s[0] */
+	size_t scalar_last_not_space_before(const char* s, size_t end) {
+		while (end > 0) {
+			--end;
+			if (!is_space(s[end])) {
+				return end;
+			}
+		}
+		return stringkernels::npos;
+	}
+
+	size_t scalar_last_not_space(const char* s, size_t len) {
+		return scalar_last_not_space_before(s, len);
+	}
+
+	size_t scalar_first_of_from(const char* s, size_t len, const char* set, size_t setlen, size_t start) {
+		for (size_t i = start; i < len; ++i) {
+			if (memchr(set, s[i], setlen)) {
+				return i;
+			}
+		}
+		return stringkernels::npos;
+	}
+
+	size_t scalar_first_of(const char* s, size_t len, const char* set, size_t setlen) {
+		return scalar_first_of_from(s, len, set, setlen, 0);
+	}
+
+	bool scalar_is_ascii(const char* s, size_t len) {
+		for (size_t i = 0; i < len; ++i) {
+			if ((unsigned char)s[i] & 0x80) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+#ifdef SPORKS_HAVE_SSE2
+
+	/* SSE2 has no unsigned byte compare, so ranges are checked by shifting the range
+	 * down to start at -128 and doing a signed less-than. Bytes above 0x7F never fall
+	 * inside an ASCII range this way.
+	 */
+	inline __m128i sse2_in_range(__m128i v, char low, int count) {
+		const __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(128 - low)));
+		return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + count)));
+	}
+
+	inline __m128i sse2_lower(__m128i v) {
+		return _mm_or_si128(v, _mm_and_si128(sse2_in_range(v, 'A', 26), _mm_set1_epi8(0x20)));
+	}
+
+	inline __m128i sse2_upper(__m128i v) {
+		return _mm_andnot_si128(_mm_and_si128(sse2_in_range(v, 'a', 26), _mm_set1_epi8(0x20)), v);
+	}
+
+	inline __m128i sse2_space(__m128i v) {
+		return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), sse2_in_range(v, '\t', 5));
+	}
+
+	void sse2_to_lower(char* dst, const char* src, size_t len) {
+		size_t i = 0;
+		for (; i + 16 <= len; i += 16) {
+			_mm_storeu_si128((__m128i*)(dst + i), sse2_lower(_mm_loadu_si128((const __m128i*)(src + i))));
+		}
+		scalar_to_lower(dst + i, src + i, len - i);
+	}
+
+	void sse2_to_upper(char* dst, const char* src, size_t len) {
+		size_t i = 0;
+		for (; i + 16 <= len; i += 16) {
+			_mm_storeu_si128((__m128i*)(dst + i), sse2_upper(_mm_loadu_si128((const __m128i*)(src + i))));
+		}
+		scalar_to_upper(dst + i, src + i, len - i);
+	}
+
+	/* Compares the first and last byte of the needle against 16 candidate positions
+	 * at once, and only does a full comparison where both of those match.
+	 */
+	size_t sse2_ifind(const char* h, size_t hlen, const char* n, size_t nlen) {
+		if (nlen == 0 || nlen > hlen) {
+			return scalar_ifind(h, hlen, n, nlen);
+		}
+		const __m128i first = _mm_set1_epi8(lower_ascii(n[0]));
+		const __m128i last = _mm_set1_epi8(lower_ascii(n[nlen - 1]));
+		const size_t candidates = hlen - nlen + 1;
+		size_t i = 0;
+		for (; i + 16 <= candidates; i += 16) {
+			const __m128i block_first = sse2_lower(_mm_loadu_si128((const __m128i*)(h + i)));
+			const __m128i block_last = sse2_lower(_mm_loadu_si128((const __m128i*)(h + i + nlen - 1)));
+			unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+			while (mask) {
+				const unsigned bit = __builtin_ctz(mask);
+				if (nlen <= 2 || iequals_n(h + i + bit + 1, n + 1, nlen - 2)) {
+					return i + bit;
+				}
+				mask &= mask - 1;
+			}
+		}
+		return scalar_ifind_from(h, hlen, n, nlen, i);
+	}
+
+	bool sse2_iequals(const char* a, size_t alen, const char* b, size_t blen) {
+		if (alen != blen) {
+			return false;
+		}
+		size_t i = 0;
+		for (; i + 16 <= alen; i += 16) {
+			const __m128i va = sse2_lower(_mm_loadu_si128((const __m128i*)(a + i)));
+			const __m128i vb = sse2_lower(_mm_loadu_si128((const __m128i*)(b + i)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF) {
+				return false;
+			}
+		}
+		return iequals_n(a + i, b + i, alen - i);
+	}
+
+	size_t sse2_first_not_space(const char* s, size_t len) {
+		size_t i = 0;
+		for (; i + 16 <= len; i += 16) {
+			const unsigned mask = ~_mm_movemask_epi8(sse2_space(_mm_loadu_si128((const __m128i*)(s + i)))) & 0xFFFF;
+			if (mask) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+		return scalar_first_not_space_from(s, len, i);
+	}
+
+	size_t sse2_last_not_space(const char* s, size_t len) {
+		size_t i = len;
+		while (i >= 16) {
+			i -= 16;
+			const unsigned mask = ~_mm_movemask_epi8(sse2_space(_mm_loadu_si128((const __m128i*)(s + i)))) & 0xFFFF;
+			if (mask) {
+				return i + 31 - __builtin_clz(mask);
+			}
+		}
+		return scalar_last_not_space_before(s, i);
+	}
+
+	size_t sse2_first_of(const char* s, size_t len, const char* set, size_t setlen) {
+		size_t i = 0;
+		if (setlen == 0) {
+			return stringkernels::npos;
+		}
+		for (; i + 16 <= len; i += 16) {
+			const __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+			__m128i hits = _mm_setzero_si128();
+			for (size_t c = 0; c < setlen; ++c) {
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, _mm_set1_epi8(set[c])));
+			}
+			const unsigned mask = _mm_movemask_epi8(hits);
+			if (mask) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+		return scalar_first_of_from(s, len, set, setlen, i);
+	}
+
+	bool sse2_is_ascii(const char* s, size_t len) {
+		size_t i = 0;
+		__m128i acc = _mm_setzero_si128();
+		for (; i + 16 <= len; i += 16) {
+			acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(s + i)));
+		}
+		return _mm_movemask_epi8(acc) == 0 && scalar_is_ascii(s + i, len - i);
+	}
+
+#endif
+
+#ifdef SPORKS_HAVE_AVX2
+
+	/* AVX2 versions of the above, 32 bytes at a time. AVX2 only has a signed greater-than
+	 * byte compare, so the range check is the same trick as SSE2 with the operands swapped.
+	 */
+	SPORKS_AVX2 inline __m256i avx2_in_range(__m256i v, char low, int count) {
+		const __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8((char)(128 - low)));
+		return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + count)), shifted);
+	}
+
+	SPORKS_AVX2 inline __m256i avx2_lower(__m256i v) {
+		return _mm256_or_si256(v, _mm256_and_si256(avx2_in_range(v, 'A', 26), _mm256_set1_epi8(0x20)));
+	}
+
+	SPORKS_AVX2 inline __m256i avx2_upper(__m256i v) {
+		return _mm256_andnot_si256(_mm256_and_si256(avx2_in_range(v, 'a', 26), _mm256_set1_epi8(0x20)), v);
+	}
+
+	SPORKS_AVX2 inline __m256i avx2_space(__m256i v) {
+		return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), avx2_in_range(v, '\t', 5));
+	}
+
+	SPORKS_AVX2 void avx2_to_lower(char* dst, const char* src, size_t len) {
+		size_t i = 0;
+		for (; i + 32 <= len; i += 32) {
+			_mm256_storeu_si256((__m256i*)(dst + i), avx2_lower(_mm256_loadu_si256((const __m256i*)(src + i))));
+		}
+		scalar_to_lower(dst + i, src + i, len - i);
+	}
+
+	SPORKS_AVX2 void avx2_to_upper(char* dst, const char* src, size_t len) {
+		size_t i = 0;
+		for (; i + 32 <= len; i += 32) {
+			_mm256_storeu_si256((__m256i*)(dst + i), avx2_upper(_mm256_loadu_si256((const __m256i*)(src + i))));
+		}
+		scalar_to_upper(dst + i, src + i, len - i);
+	}
+
+	SPORKS_AVX2 size_t avx2_ifind(const char* h, size_t hlen, const char* n, size_t nlen) {
+		if (nlen == 0 || nlen > hlen) {
+			return scalar_ifind(h, hlen, n, nlen);
+		}
+		const __m256i first = _mm256_set1_epi8(lower_ascii(n[0]));
+		const __m256i last = _mm256_set1_epi8(lower_ascii(n[nlen - 1]));
+		const size_t candidates = hlen - nlen + 1;
+		size_t i = 0;
+		for (; i + 32 <= candidates; i += 32) {
+			const __m256i block_first = avx2_lower(_mm256_loadu_si256((const __m256i*)(h + i)));
+			const __m256i block_last = avx2_lower(_mm256_loadu_si256((const __m256i*)(h + i + nlen - 1)));
+			uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+			while (mask) {
+				const unsigned bit = __builtin_ctz(mask);
+				if (nlen <= 2 || iequals_n(h + i + bit + 1, n + 1, nlen - 2)) {
+					return i + bit;
+				}
+				mask &= mask - 1;
+			}
+		}
+		return scalar_ifind_from(h, hlen, n, nlen, i);
+	}
+
+	SPORKS_AVX2 bool avx2_iequals(const char* a, size_t alen, const char* b, size_t blen) {
+		if (alen != blen) {
+			return false;
+		}
+		size_t i = 0;
+		for (; i + 32 <= alen; i += 32) {
+			const __m256i va = avx2_lower(_mm256_loadu_si256((const __m256i*)(a + i)));
+			const __m256i vb = avx2_lower(_mm256_loadu_si256((const __m256i*)(b + i)));
+			if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != 0xFFFFFFFFu) {
+				return false;
+			}
+		}
+		return iequals_n(a + i, b + i, alen - i);
+	}
+
+	SPORKS_AVX2 size_t avx2_first_not_space(const char* s, size_t len) {
+		size_t i = 0;
+		for (; i + 32 <= len; i += 32) {
+			const uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(avx2_space(_mm256_loadu_si256((const __m256i*)(s + i))));
+			if (mask) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+		return scalar_first_not_space_from(s, len, i);
+	}
+
+	SPORKS_AVX2 size_t avx2_last_not_space(const char* s, size_t len) {
+		size_t i = len;
+		while (i >= 32) {
+			i -= 32;
+			const uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(avx2_space(_mm256_loadu_si256((const __m256i*)(s + i))));
+			if (mask) {
+				return i + 31 - __builtin_clz(mask);
+			}
+		}
+		return scalar_last_not_space_before(s, i);
+	}
+
+	SPORKS_AVX2 size_t avx2_first_of(const char* s, size_t len, const char* set, size_t setlen) {
+		size_t i = 0;
+		if (setlen == 0) {
+			return stringkernels::npos;
+		}
+		for (; i + 32 <= len; i += 32) {
+			const __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+			__m256i hits = _mm256_setzero_si256();
+			for (size_t c = 0; c < setlen; ++c) {
+				hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(set[c])));
+			}
+			const uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits);
+			if (mask) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+		return scalar_first_of_from(s, len, set, setlen, i);
+	}
+
+	SPORKS_AVX2 bool avx2_is_ascii(const char* s, size_t len) {
+		size_t i = 0;
+		__m256i acc = _mm256_setzero_si256();
+		for (; i + 32 <= len; i += 32) {
+			acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(s + i)));
+		}
+		return _mm256_movemask_epi8(acc) == 0 && scalar_is_ascii(s + i, len - i);
+	}
+
+#endif
+
+	/**
+	 * Table of kernel functions for one instruction set
+	 */
+	struct kernel_table {
+		void (*to_lower)(char*, const char*, size_t);
+		void (*to_upper)(char*, const char*, size_t);
+		size_t (*ifind)(const char*, size_t, const char*, size_t);
+		bool (*iequals)(const char*, size_t, const char*, size_t);
+		size_t (*first_not_space)(const char*, size_t);
+		size_t (*last_not_space)(const char*, size_t);
+		size_t (*first_of)(const char*, size_t, const char*, size_t);
+		bool (*is_ascii)(const char*, size_t);
+		const char* name;
+	};
+
+	/**
+	 * Pick the best kernels the CPU supports. The environment variable SPORKS_STRINGKERNELS
+	 * may be set to "scalar", "sse2" or "avx2" to force a lower level, e.g. for benchmarking.
+	 */
+	kernel_table select_kernels() {
+		const char* forced = getenv("SPORKS_STRINGKERNELS");
+		std::string want = forced ? forced : "";
+		kernel_table t = {
+			scalar_to_lower, scalar_to_upper, scalar_ifind, scalar_iequals,
+			scalar_first_not_space, scalar_last_not_space, scalar_first_of, scalar_is_ascii,
+			"scalar"
+		};
+		if (want == "scalar") {
+			return t;
+		}
+#ifdef SPORKS_HAVE_SSE2
+		t = {
+			sse2_to_lower, sse2_to_upper, sse2_ifind, sse2_iequals,
+			sse2_first_not_space, sse2_last_not_space, sse2_first_of, sse2_is_ascii,
+			"sse2"
+		};
+		if (want == "sse2") {
+			return t;
+		}
+#endif
+#ifdef SPORKS_HAVE_AVX2
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			t = {
+				avx2_to_lower, avx2_to_upper, avx2_ifind, avx2_iequals,
+				avx2_first_not_space, avx2_last_not_space, avx2_first_of, avx2_is_ascii,
+				"avx2"
+			};
+		}
+#endif
+		return t;
+	}
+
+	const kernel_table& kernels() {
+		static const kernel_table table = select_kernels();
+		return table;
+	}
+}
+
+namespace stringkernels {
+
+	void to_lower(char* dst, const char* src, size_t len) {
+		kernels().to_lower(dst, src, len);
+	}
+
+	void to_upper(char* dst, const char* src, size_t len) {
+		kernels().to_upper(dst, src, len);
+	}
+
+	size_t ifind(const char* haystack, size_t hlen, const char* needle, size_t nlen) {
+		return kernels().ifind(haystack, hlen, needle, nlen);
+	}
+
+	bool iequals(const char* a, size_t alen, const char* b, size_t blen) {
+		return kernels().iequals(a, alen, b, blen);
+	}
+
+	size_t find_first_not_space(const char* s, size_t len) {
+		return kernels().first_not_space(s, len);
+	}
+
+	size_t find_last_not_space(const char* s, size_t len) {
+		return kernels().last_not_space(s, len);
+	}
+
+	size_t find_first_of(const char* s, size_t len, const char* set, size_t setlen) {
+		return kernels().first_of(s, len, set, setlen);
+	}
+
+	bool is_ascii(const char* s, size_t len) {
+		return kernels().is_ascii(s, len);
+	}
+
+	const char* implementation() {
+		return kernels().name;
+	}
+};
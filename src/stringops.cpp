@@ -22,24 +22,99 @@
 #include <locale>
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
 
 /**
- * Search and replace a string within another string, case sensitive.
+ * Search and replace a string within another string, case insensitive.
+ * The output is built in one pass, without lowercasing copies of the subject.
  */
 std::string ReplaceString(std::string subject, const std::string& search, const std::string& replace) {
-	size_t pos = 0;
+	if (search.empty()) {
+		return subject;
+	}
+
+	size_t pos = ifind(subject, search);
+	if (pos == std::string::npos) {
+		return subject;
+	}
 
-	std::string subject_lc = lowercase(subject);
-	std::string search_lc = lowercase(search);
-	std::string replace_lc = lowercase(replace);
+	std::string result;
+	result.reserve(subject.length());
+	size_t last = 0;
+	while (pos != std::string::npos) {
+		result.append(subject, last, pos - last);
+		result.append(replace);
+		last = pos + search.length();
+		pos = ifind(subject, search, last);
+	}
+	result.append(subject, last, std::string::npos);
+	return result;
+}
 
-	while((pos = subject_lc.find(search_lc, pos)) != std::string::npos) {
+/* Replacement for each code point from U+00C0 to U+017F, applied by general_ci_fold().
+ * Letters which are an ASCII letter plus an accent become that letter, as do ß and ſ (s),
+ * other letters become their lowercase form, and anything else is left alone.
+ */
+static const uint16_t latin_collation[] = {
+	/* U+00C0 */ 0x61, 0x61, 0x61, 0x61, 0x61, 0x61, 0x0e6, 0x63, 0x65, 0x65, 0x65, 0x65, 0x69, 0x69, 0x69, 0x69,
+	/* U+00D0 */ 0x0f0, 0x6e, 0x6f, 0x6f, 0x6f, 0x6f, 0x6f, 0x0d7, 0x0f8, 0x75, 0x75, 0x75, 0x75, 0x79, 0x0fe, 0x73,
+	/* U+00E0 */ 0x61, 0x61, 0x61, 0x61, 0x61, 0x61, 0x0e6, 0x63, 0x65, 0x65, 0x65, 0x65, 0x69, 0x69, 0x69, 0x69,
+	/* U+00F0 */ 0x0f0, 0x6e, 0x6f, 0x6f, 0x6f, 0x6f, 0x6f, 0x0f7, 0x0f8, 0x75, 0x75, 0x75, 0x75, 0x79, 0x0fe, 0x79,
+	/* U+0100 */ 0x61, 0x61, 0x61, 0x61, 0x61, 0x61, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x64, 0x64,
+	/* U+0110 */ 0x111, 0x111, 0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x67, 0x67, 0x67, 0x67,
+	/* U+0120 */ 0x67, 0x67, 0x67, 0x67, 0x68, 0x68, 0x127, 0x127, 0x69, 0x69, 0x69, 0x69, 0x69, 0x69, 0x69, 0x69,
+	/* U+0130 */ 0x69, 0x131, 0x133, 0x133, 0x6a, 0x6a, 0x6b, 0x6b, 0x138, 0x6c, 0x6c, 0x6c, 0x6c, 0x6c, 0x6c, 0x140,
+	/* U+0140 */ 0x140, 0x142, 0x142, 0x6e, 0x6e, 0x6e, 0x6e, 0x6e, 0x6e, 0x149, 0x14b, 0x14b, 0x6f, 0x6f, 0x6f, 0x6f,
+	/* U+0150 */ 0x6f, 0x6f, 0x153, 0x153, 0x72, 0x72, 0x72, 0x72, 0x72, 0x72, 0x73, 0x73, 0x73, 0x73, 0x73, 0x73,
+	/* U+0160 */ 0x73, 0x73, 0x74, 0x74, 0x74, 0x74, 0x167, 0x167, 0x75, 0x75, 0x75, 0x75, 0x75, 0x75, 0x75, 0x75,
+	/* U+0170 */ 0x75, 0x75, 0x75, 0x75, 0x77, 0x77, 0x79, 0x79, 0x79, 0x7a, 0x7a, 0x7a, 0x7a, 0x7a, 0x7a, 0x73,
+};
 
-		 subject.replace(pos, search.length(), replace);
-		 subject_lc.replace(pos, search_lc.length(), replace_lc);
+static_assert(sizeof(latin_collation) / sizeof(*latin_collation) == 0x180 - 0xC0, "latin_collation must cover U+00C0 to U+017F");
 
-		 pos += replace.length();
+std::string general_ci_fold(const std::string& s) {
+	std::string k = lowercase(s);
+	k.erase(k.find_last_not_of(' ') + 1);
+	if (stringkernels::is_ascii(k.data(), k.length())) {
+		return k;
+	}
+	std::string out;
+	out.reserve(k.length());
+	for (size_t i = 0; i < k.length(); ++i) {
+		unsigned char c = k[i];
+		if (c >= 0xC3 && c <= 0xC5 && i + 1 < k.length() && ((unsigned char)k[i + 1] & 0xC0) == 0x80) {
+			unsigned int codepoint = ((c & 0x1F) << 6) | ((unsigned char)k[i + 1] & 0x3F);
+			if (codepoint >= 0xC0) {
+				uint16_t r = latin_collation[codepoint - 0xC0];
+				if (r < 0x80) {
+					out += (char)r;
+				} else {
+					out += (char)(0xC0 | (r >> 6));
+					out += (char)(0x80 | (r & 0x3F));
+				}
+				++i;
+				continue;
+			}
+		}
+		out += c;
 	}
-	return subject;
+	return out;
 }
 
+bool general_ci_exact(const std::string& s) {
+	if (stringkernels::is_ascii(s.data(), s.length())) {
+		return true;
+	}
+	for (size_t i = 0; i < s.length(); ++i) {
+		unsigned char c = s[i];
+		if (c < 0x80) {
+			continue;
+		}
+		/* Only two byte sequences for U+0080 to U+017F are covered. MySQL sorts µ (U+00B5) with Greek mu */
+		if (c < 0xC2 || c > 0xC5 || i + 1 >= s.length() || ((unsigned char)s[i + 1] & 0xC0) != 0x80 || (c == 0xC2 && (unsigned char)s[i + 1] == 0xB5)) {
+			return false;
+		}
+		++i;
+	}
+	return true;
+}
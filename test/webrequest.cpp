@@ -0,0 +1,195 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/**
+ * Loopback test for WebRequests::Fetch(). Starts a small HTTP server on 127.0.0.1 and checks
+ * the limits described in webrequest.h against it: the redirect cap, a 303 turning a POST
+ * into a GET, chunked responses, truncation at 1mb and the total request timeout.
+ * Build with -DBUILD_TESTS=ON and run ./test_webrequest, or ctest.
+ */
+
+#include <sporks/bot.h>
+#include "../modules/js/webrequest.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/* Only the worker pool uses the bot, and this test doesn't start one */
+void Bot::DisposeThread(std::thread* thread)
+{
+	thread->join();
+	delete thread;
+}
+
+namespace {
+
+	bool send_all(int fd, const std::string &data)
+	{
+		size_t sent = 0;
+		while (sent < data.length()) {
+			ssize_t r = send(fd, data.data() + sent, data.length() - sent, MSG_NOSIGNAL);
+			if (r <= 0) {
+				return false;
+			}
+			sent += r;
+		}
+		return true;
+	}
+
+	std::string reply(int status, const std::string &body, const std::string &headers = "")
+	{
+		return "HTTP/1.1 " + std::to_string(status) + " Test\r\nConnection: close\r\n" + headers +
+			"Content-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+	}
+
+	/* Read one request, answer it and close the connection */
+	void serve(int fd)
+	{
+		std::string request;
+		char buffer[4096];
+		size_t header_end;
+		while ((header_end = request.find("\r\n\r\n")) == std::string::npos) {
+			ssize_t r = recv(fd, buffer, sizeof(buffer), 0);
+			if (r <= 0) {
+				close(fd);
+				return;
+			}
+			request.append(buffer, r);
+		}
+		std::string method = request.substr(0, request.find(' '));
+		size_t path_start = method.length() + 1;
+		std::string path = request.substr(path_start, request.find(' ', path_start) - path_start);
+		size_t length = 0;
+		size_t cl = request.find("Content-Length: ");
+		if (cl != std::string::npos && cl < header_end) {
+			length = std::stoul(request.substr(cl + 16));
+		}
+		while (request.length() < header_end + 4 + length) {
+			ssize_t r = recv(fd, buffer, sizeof(buffer), 0);
+			if (r <= 0) {
+				break;
+			}
+			request.append(buffer, r);
+		}
+
+		if (path.compare(0, 7, "/redir/") == 0) {
+			int remaining = std::stoi(path.substr(7));
+			send_all(fd, remaining ? reply(302, "", "Location: /redir/" + std::to_string(remaining - 1) + "\r\n") : reply(200, "landed"));
+		} else if (path == "/see-other") {
+			send_all(fd, reply(303, "", "Location: /method\r\n"));
+		} else if (path == "/method") {
+			send_all(fd, reply(200, method + " " + std::to_string(length)));
+		} else if (path == "/chunked") {
+			send_all(fd, "HTTP/1.1 200 Test\r\nConnection: close\r\nTransfer-Encoding: chunked\r\n\r\n");
+			for (const std::string &part : { std::string("Hello, "), std::string("chunked"), std::string(5000, '!') }) {
+				std::stringstream size;
+				size << std::hex << part.length();
+				send_all(fd, size.str() + ";ext=1\r\n" + part + "\r\n");
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+			send_all(fd, "0\r\nTrailer: 1\r\n\r\n");
+		} else if (path == "/big") {
+			send_all(fd, reply(200, std::string(3 * 1024 * 1024, 'y')));
+		} else if (path == "/slow") {
+			/* Every read succeeds, but the whole response takes far longer than the request may */
+			send_all(fd, "HTTP/1.1 200 Test\r\nConnection: close\r\nContent-Length: 100\r\n\r\n");
+			for (int i = 0; i < 100 && send_all(fd, "z"); ++i) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			}
+		} else {
+			send_all(fd, reply(404, "not found"));
+		}
+		close(fd);
+	}
+
+	/* Listen on an ephemeral loopback port, returning the port, or 0 on failure */
+	int start_server()
+	{
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addrlen = sizeof(addr);
+		if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0 || getsockname(listener, (sockaddr*)&addr, &addrlen) != 0) {
+			return 0;
+		}
+		std::thread([listener]() {
+			while (true) {
+				int fd = accept(listener, nullptr, nullptr);
+				if (fd >= 0) {
+					std::thread(serve, fd).detach();
+				}
+			}
+		}).detach();
+		return ntohs(addr.sin_port);
+	}
+
+	bool ok = true;
+
+	void check(const std::string &name, bool passed, const WebRequests::response &res)
+	{
+		std::cout << (passed ? "PASS " : "FAIL ") << name << " (status " << res.status << ", " << res.body.length() << " bytes" << (res.error.empty() ? "" : ", " + res.error) << ")\n";
+		ok = ok && passed;
+	}
+
+};
+
+int main()
+{
+	int port = start_server();
+	if (!port) {
+		std::cerr << "Can't listen on the loopback interface\n";
+		return 1;
+	}
+	std::string base = "http://127.0.0.1:" + std::to_string(port);
+	std::atomic<bool> terminating(false);
+	WebRequests::response res;
+
+	res = WebRequests::Fetch("GET", base + "/redir/3", "", terminating);
+	check("three redirects are followed", res.status == 200 && res.body == "landed", res);
+
+	res = WebRequests::Fetch("GET", base + "/redir/4", "", terminating);
+	check("a fourth redirect fails", res.status == 0 && !res.error.empty(), res);
+
+	res = WebRequests::Fetch("POST", base + "/see-other", "a=1&b=2", terminating);
+	check("303 turns a POST into a GET without a body", res.status == 200 && res.body == "GET 0", res);
+
+	res = WebRequests::Fetch("POST", base + "/method", "a=1&b=2", terminating);
+	check("POST sends its body", res.status == 200 && res.body == "POST 7", res);
+
+	res = WebRequests::Fetch("GET", base + "/chunked", "", terminating);
+	check("chunked responses are decoded", res.status == 200 && res.body == "Hello, chunked" + std::string(5000, '!'), res);
+
+	res = WebRequests::Fetch("GET", base + "/big", "", terminating);
+	check("responses are truncated at 1mb", res.status == 200 && res.body == std::string(1024 * 1024, 'y'), res);
+
+	auto start = std::chrono::steady_clock::now();
+	res = WebRequests::Fetch("GET", base + "/slow", "", terminating);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	check("a slow response fails after 5 seconds", res.status == 0 && seconds >= 4.5 && seconds < 6.5, res);
+
+	return ok ? 0 : 1;
+}